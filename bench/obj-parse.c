@@ -0,0 +1,120 @@
+// Measures OBJ parse throughput on the files passed on the command line. The
+// files are mapped up front so only parsing is timed. "--synthetic N" adds a
+// generated N x N vertex grid of quads with texture coordinates and normals,
+// the last quad of each row ends in a comment right after its last index.
+// "--threads N" parses the files after it with the chunked parallel parser.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "array.h"
+#include "utils.h"
+#include "obj.h"
+
+#define MIN_BENCH_SECONDS 1.0
+
+// 1 for the serial parser
+static int threads_count = 1;
+
+static double get_seconds(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char* make_synthetic_obj(int size, size_t* length) {
+	// generous upper bound on the text of one vertex and one face
+	size_t capacity = (size_t)size * size * 200 + 1;
+	char* data = malloc(capacity);
+	char* p = data;
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			float u = (float)x / (size - 1);
+			float v = (float)y / (size - 1);
+			p += sprintf(p, "v %.6f %.6f %.6f\n", u * 10.0f - 5.0f, (u - 0.5f) * (v - 0.5f), v * 10.0f - 5.0f);
+			p += sprintf(p, "vt %.6f %.6f\n", u, v);
+			p += sprintf(p, "vn %.6f %.6f %.6f\n", 0.0f, 1.0f, 0.0f);
+		}
+	}
+	for (int y = 0; y + 1 < size; y++) {
+		for (int x = 0; x + 1 < size; x++) {
+			int a = y * size + x + 1;
+			int b = a + 1;
+			int c = a + size + 1;
+			int d = a + size;
+			char* comment = x + 2 == size ? "#row end" : "";
+			p += sprintf(p, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d%s\n", a, a, a, b, b, b, c, c, c, d, d, d, comment);
+		}
+	}
+	*length = p - data;
+	return data;
+}
+
+static void bench_obj(char* name, char* data, size_t size) {
+	int runs = 0;
+	int triangles_count = 0;
+	double start = get_seconds();
+	double elapsed = 0;
+	// repeat until the timer has something meaningful to measure
+	while (elapsed < MIN_BENCH_SECONDS) {
+		mesh_t mesh = { 0 };
+		bool is_parsed = threads_count > 1 ?
+			parse_obj_data_parallel(&mesh, data, size, threads_count) :
+			parse_obj_data(&mesh, data, size);
+		if (!is_parsed) {
+			printf("%-24s failed to parse\n", name);
+			return;
+		}
+		triangles_count = array_length(mesh.faces);
+		array_free(mesh.vertices);
+		array_free(mesh.normals);
+		array_free(mesh.faces);
+		runs++;
+		elapsed = get_seconds() - start;
+	}
+	double megabytes = 1024.0 * 1024.0;
+	printf(
+		"%-24s %8d %10.1f %10d %8d %10.1f %12.1f\n",
+		name,
+		threads_count,
+		size / 1024.0,
+		triangles_count,
+		runs,
+		elapsed / runs * 1000.0,
+		size * runs / megabytes / elapsed
+	);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		printf("usage: %s [--threads N] [--synthetic N] file.obj ...\n", argv[0]);
+		return 1;
+	}
+	printf("%-24s %8s %10s %10s %8s %10s %12s\n", "file", "threads", "obj KB", "triangles", "runs", "ms/run", "MB/s");
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			int count = atoi(argv[++i]);
+			threads_count = MAX(1, count);
+			continue;
+		}
+		if (strcmp(argv[i], "--synthetic") == 0 && i + 1 < argc) {
+			int size = atoi(argv[++i]);
+			size_t length = 0;
+			char* data = make_synthetic_obj(size, &length);
+			char name[32];
+			snprintf(name, sizeof(name), "synthetic %dx%d", size, size);
+			bench_obj(name, data, length);
+			free(data);
+			continue;
+		}
+		size_t size = 0;
+		char* data = map_file(argv[i], &size);
+		if (data == NULL) {
+			printf("%-24s could not be read\n", argv[i]);
+			continue;
+		}
+		bench_obj(argv[i], data, size);
+		unmap_file(data, size);
+	}
+	return 0;
+}
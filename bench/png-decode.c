@@ -0,0 +1,78 @@
+// Measures PNG decode throughput of upng on the files passed on the command line.
+// Link it against another upng.c to compare implementations, see the README.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "upng.h"
+
+#define MIN_BENCH_SECONDS 1.0
+
+static double get_seconds(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned char* read_file(char* filename, unsigned long* size) {
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	*size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	unsigned char* buffer = malloc(*size);
+	if (fread(buffer, 1, *size, file) != *size) {
+		free(buffer);
+		buffer = NULL;
+	}
+	fclose(file);
+	return buffer;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		printf("usage: %s file.png ...\n", argv[0]);
+		return 1;
+	}
+	printf("%-24s %10s %10s %8s %12s %12s\n", "file", "png KB", "raw KB", "runs", "png MB/s", "raw MB/s");
+	for (int i = 1; i < argc; i++) {
+		unsigned long size = 0;
+		unsigned char* data = read_file(argv[i], &size);
+		if (data == NULL) {
+			printf("%-24s could not be read\n", argv[i]);
+			continue;
+		}
+		unsigned long decoded_size = 0;
+		int runs = 0;
+		double start = get_seconds();
+		double elapsed = 0;
+		// repeat until the timer has something meaningful to measure
+		while (elapsed < MIN_BENCH_SECONDS) {
+			upng_t* png = upng_new_from_bytes(data, size);
+			if (upng_decode(png) != UPNG_EOK) {
+				printf("%-24s failed to decode (error %d)\n", argv[i], upng_get_error(png));
+				upng_free(png);
+				break;
+			}
+			decoded_size = upng_get_size(png);
+			upng_free(png);
+			runs++;
+			elapsed = get_seconds() - start;
+		}
+		if (runs > 0) {
+			double megabytes = 1024.0 * 1024.0;
+			printf(
+				"%-24s %10.1f %10.1f %8d %12.1f %12.1f\n",
+				argv[i],
+				size / 1024.0,
+				decoded_size / 1024.0,
+				runs,
+				size * runs / megabytes / elapsed,
+				decoded_size * runs / megabytes / elapsed
+			);
+		}
+		free(data);
+	}
+	return 0;
+}
@@ -0,0 +1,93 @@
+// Checks that the batched bilinear sampler returns the same texels as the scalar
+// one and measures both on the pngs passed on the command line.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "texture.h"
+
+#define SAMPLES_COUNT (1 << 16)
+#define MIN_BENCH_SECONDS 1.0
+
+static double get_seconds(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// UVs past both edges, so wrapping and negative coordinates are covered
+static float random_uv(void) {
+	return (float)rand() / RAND_MAX * 5.0f - 2.0f;
+}
+
+// nanoseconds per sample
+static double measure_scalar(texture_2d_t* texture, float* u, float* v, uint32_t* out) {
+	int runs = 0;
+	double start = get_seconds();
+	double elapsed = 0;
+	while (elapsed < MIN_BENCH_SECONDS) {
+		for (int i = 0; i < SAMPLES_COUNT; i++) {
+			out[i] = sample_texture_bilinear(texture, u[i], v[i]);
+		}
+		runs++;
+		elapsed = get_seconds() - start;
+	}
+	return elapsed * 1e9 / ((double)runs * SAMPLES_COUNT);
+}
+
+static double measure_batch(texture_2d_t* texture, float* u, float* v, uint32_t* out) {
+	int runs = 0;
+	double start = get_seconds();
+	double elapsed = 0;
+	while (elapsed < MIN_BENCH_SECONDS) {
+		sample_texture_bilinear_batch(texture, u, v, SAMPLES_COUNT, out);
+		runs++;
+		elapsed = get_seconds() - start;
+	}
+	return elapsed * 1e9 / ((double)runs * SAMPLES_COUNT);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		printf("usage: %s file.png ...\n", argv[0]);
+		return 1;
+	}
+	float* u = malloc(sizeof(float) * SAMPLES_COUNT);
+	float* v = malloc(sizeof(float) * SAMPLES_COUNT);
+	uint32_t* scalar = malloc(sizeof(uint32_t) * SAMPLES_COUNT);
+	uint32_t* batch = malloc(sizeof(uint32_t) * SAMPLES_COUNT);
+	srand(1);
+	for (int i = 0; i < SAMPLES_COUNT; i++) {
+		u[i] = random_uv();
+		v[i] = random_uv();
+	}
+
+	int mismatches_count = 0;
+	printf("%-24s %10s %12s %12s %12s\n", "file", "size", "mismatches", "scalar ns", "batch ns");
+	for (int i = 1; i < argc; i++) {
+		texture_2d_t* texture = load_png_data(argv[i]);
+		if (texture == NULL) {
+			printf("%-24s could not be loaded\n", argv[i]);
+			continue;
+		}
+		// odd counts leave a tail for the scalar loop after the groups of four
+		int file_mismatches_count = 0;
+		for (int count = SAMPLES_COUNT - 3; count <= SAMPLES_COUNT; count++) {
+			sample_texture_bilinear_batch(texture, u, v, count, batch);
+			for (int j = 0; j < count; j++) {
+				file_mismatches_count += batch[j] != sample_texture_bilinear(texture, u[j], v[j]);
+			}
+		}
+		double scalar_ns = measure_scalar(texture, u, v, scalar);
+		double batch_ns = measure_batch(texture, u, v, batch);
+		printf("%-24s %4dx%-5d %12d %12.2f %12.2f\n", argv[i], texture->width, texture->height, file_mismatches_count, scalar_ns, batch_ns);
+		mismatches_count += file_mismatches_count;
+		free_texture(texture);
+	}
+
+	free(u);
+	free(v);
+	free(scalar);
+	free(batch);
+	return mismatches_count == 0 ? 0 : 1;
+}
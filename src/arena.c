@@ -0,0 +1,87 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "utils.h"
+#include "arena.h"
+
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+struct arena_block_t {
+	arena_block_t* next;
+	size_t size;
+	size_t used;
+};
+
+// the data of a block starts after its header, rounded up to the alignment
+#define ARENA_BLOCK_DATA(block) ((uint8_t*)(block) + ARENA_ALIGN(sizeof(arena_block_t)))
+
+void init_arena(arena_t* arena, size_t block_size) {
+	arena->blocks = NULL;
+	arena->block_size = ARENA_ALIGN(MAX(block_size, 1));
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+	size = ARENA_ALIGN(MAX(size, 1));
+	arena_block_t* block = arena->blocks;
+	if (block == NULL || block->size - block->used < size) {
+		size_t block_size = MAX(arena->block_size, size);
+		block = malloc(ARENA_ALIGN(sizeof(arena_block_t)) + block_size);
+		if (block == NULL) {
+			printf("Arena could not allocate %zu bytes\n", block_size);
+			return NULL;
+		}
+		block->next = arena->blocks;
+		block->size = block_size;
+		block->used = 0;
+		arena->blocks = block;
+	}
+	void* memory = ARENA_BLOCK_DATA(block) + block->used;
+	block->used += size;
+	return memory;
+}
+
+void* arena_resize(arena_t* arena, void* memory, size_t size, size_t new_size) {
+	if (memory == NULL) {
+		return arena_alloc(arena, new_size);
+	}
+	arena_block_t* block = arena->blocks;
+	size_t aligned_size = ARENA_ALIGN(MAX(size, 1));
+	size_t aligned_new_size = ARENA_ALIGN(MAX(new_size, 1));
+	bool is_last = block != NULL && (uint8_t*)memory + aligned_size == ARENA_BLOCK_DATA(block) + block->used;
+	if (is_last && block->size - (block->used - aligned_size) >= aligned_new_size) {
+		block->used = block->used - aligned_size + aligned_new_size;
+		return memory;
+	}
+	void* new_memory = arena_alloc(arena, new_size);
+	if (new_memory != NULL) {
+		memcpy(new_memory, memory, MIN(size, new_size));
+	}
+	return new_memory;
+}
+
+void reset_arena(arena_t* arena) {
+	arena_block_t* block = arena->blocks;
+	if (block == NULL) {
+		return;
+	}
+	arena_block_t* next = block->next;
+	while (next != NULL) {
+		arena_block_t* following = next->next;
+		free(next);
+		next = following;
+	}
+	block->next = NULL;
+	block->used = 0;
+}
+
+void free_arena(arena_t* arena) {
+	arena_block_t* block = arena->blocks;
+	while (block != NULL) {
+		arena_block_t* next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->blocks = NULL;
+}
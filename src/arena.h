@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Allocations are aligned to this, enough for any type the renderer stores
+#define ARENA_ALIGNMENT 16
+
+typedef struct arena_block_t arena_block_t;
+
+// A bump allocator for temporaries that die together. Allocating moves a
+// pointer forward in the current block, a new block is chained on when it is
+// full. Nothing is freed on its own, reset_arena() and free_arena() drop
+// everything at once. Not thread safe
+typedef struct {
+	arena_block_t* blocks;
+	size_t block_size;
+} arena_t;
+
+// Blocks are allocated lazily, block_size bytes or more for larger allocations
+void init_arena(arena_t* arena, size_t block_size);
+void* arena_alloc(arena_t* arena, size_t size);
+// Grows or shrinks in place when memory is the last allocation and still fits,
+// otherwise copies it into a new one
+void* arena_resize(arena_t* arena, void* memory, size_t size, size_t new_size);
+// Keeps the newest block for reuse and frees the others
+void reset_arena(arena_t* arena);
+void free_arena(arena_t* arena);
+
+#endif
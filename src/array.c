@@ -1,40 +1,103 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "array.h"
 
-#define ARRAY_RAW_DATA(array) ((int*)(array) - 2)
-#define ARRAY_CAPACITY(array) (ARRAY_RAW_DATA(array)[0])
-#define ARRAY_OCCUPIED(array) (ARRAY_RAW_DATA(array)[1])
+typedef struct {
+    size_t capacity;
+    size_t occupied;
+    // NULL for arrays on the heap
+    arena_t* arena;
+} array_header_t;
 
-void* array_hold(void* array, int count, int item_size) {
-    if (array == NULL) {
-        int raw_size = (sizeof(int) * 2) + (item_size * count);
-        int* base = (int*)malloc(raw_size);
-        base[0] = count;  // capacity
-        base[1] = count;  // occupied
-        return base + 2;
-    } else if (ARRAY_OCCUPIED(array) + count <= ARRAY_CAPACITY(array)) {
-        ARRAY_OCCUPIED(array) += count;
-        return array;
+_Static_assert(sizeof(array_header_t) <= ARRAY_HEADER_SIZE, "array header does not fit");
+_Static_assert(ARRAY_HEADER_SIZE % ARENA_ALIGNMENT == 0, "array items are misaligned");
+
+#define ARRAY_HEADER(array) ((array_header_t*)((char*)(array) - ARRAY_HEADER_SIZE))
+
+static void* array_realloc(void* array, size_t capacity, size_t item_size) {
+    array_header_t* header = array != NULL ? ARRAY_HEADER(array) : NULL;
+    arena_t* arena = header != NULL ? header->arena : NULL;
+    size_t occupied = header != NULL ? header->occupied : 0;
+    if (capacity > (SIZE_MAX - ARRAY_HEADER_SIZE) / (item_size > 0 ? item_size : 1)) {
+        printf("Array of %zu items of %zu bytes is too large\n", capacity, item_size);
+        abort();
+    }
+    size_t raw_size = ARRAY_HEADER_SIZE + item_size * capacity;
+    if (arena != NULL) {
+        size_t old_raw_size = ARRAY_HEADER_SIZE + item_size * header->capacity;
+        header = arena_resize(arena, header, old_raw_size, raw_size);
     } else {
-        int needed_size = ARRAY_OCCUPIED(array) + count;
-        int float_curr = ARRAY_CAPACITY(array) * 2;
-        int capacity = needed_size > float_curr ? needed_size : float_curr;
-        int occupied = needed_size;
-        int raw_size = sizeof(int) * 2 + item_size * capacity;
-        int* base = (int*)realloc(ARRAY_RAW_DATA(array), raw_size);
-        base[0] = capacity;
-        base[1] = occupied;
-        return base + 2;
+        header = realloc(header, raw_size);
+    }
+    if (header == NULL) {
+        printf("Could not allocate an array of %zu bytes\n", raw_size);
+        abort();
+    }
+    header->capacity = capacity;
+    header->occupied = occupied;
+    header->arena = arena;
+    return (char*)header + ARRAY_HEADER_SIZE;
+}
+
+void* array_hold(void* array, size_t count, size_t item_size) {
+    size_t occupied = array_size(array);
+    if (array == NULL) {
+        array = array_realloc(NULL, count, item_size);
+    } else if (count > ARRAY_HEADER(array)->capacity - occupied) {
+        // doubled, so pushing one at a time stays amortized constant
+        size_t doubled = ARRAY_HEADER(array)->capacity * 2;
+        size_t needed = occupied + count;
+        array = array_realloc(array, needed > doubled ? needed : doubled, item_size);
+    }
+    ARRAY_HEADER(array)->occupied = occupied + count;
+    return array;
+}
+
+void* array_make(arena_t* arena, size_t capacity, size_t item_size) {
+    size_t raw_size = ARRAY_HEADER_SIZE + item_size * capacity;
+    array_header_t* header = arena != NULL ? arena_alloc(arena, raw_size) : malloc(raw_size);
+    if (header == NULL) {
+        printf("Could not allocate an array of %zu bytes\n", raw_size);
+        abort();
     }
+    header->capacity = capacity;
+    header->occupied = 0;
+    header->arena = arena;
+    return (char*)header + ARRAY_HEADER_SIZE;
+}
+
+void* array_reserve_items(void* array, size_t capacity, size_t item_size) {
+    if (array == NULL) {
+        return array_make(NULL, capacity, item_size);
+    }
+    return capacity > ARRAY_HEADER(array)->capacity ? array_realloc(array, capacity, item_size) : array;
+}
+
+void* array_wrap(void* memory, size_t count) {
+    array_header_t* header = memory;
+    header->capacity = count;
+    header->occupied = count;
+    header->arena = NULL;
+    return (char*)memory + ARRAY_HEADER_SIZE;
 }
 
 int array_length(void* array) {
-    return (array != NULL) ? ARRAY_OCCUPIED(array) : 0;
+    return (int)array_size(array);
+}
+
+size_t array_size(void* array) {
+    return (array != NULL) ? ARRAY_HEADER(array)->occupied : 0;
+}
+
+void array_pop(void* array) {
+    if (array != NULL && ARRAY_HEADER(array)->occupied > 0) {
+        ARRAY_HEADER(array)->occupied--;
+    }
 }
 
 void array_free(void* array) {
-    if (array != NULL) {
-        free(ARRAY_RAW_DATA(array));
+    if (array != NULL && ARRAY_HEADER(array)->arena == NULL) {
+        free(ARRAY_HEADER(array));
     }
-}
\ No newline at end of file
+}
@@ -1,14 +1,37 @@
 #ifndef ARRAY_H
 #define ARRAY_H
 
+#include <stddef.h>
+#include "arena.h"
+
 #define array_push(array, value)                                              \
     do {                                                                      \
         (array) = array_hold((array), 1, sizeof(*(array)));                   \
-        (array)[array_length(array) - 1] = (value);                           \
+        (array)[array_size(array) - 1] = (value);                             \
     } while (0);
 
-void* array_hold(void* array, int count, int item_size);
+// Makes room for at least capacity items without changing the length
+#define array_reserve(array, capacity)                                        \
+    do {                                                                      \
+        (array) = array_reserve_items((array), (capacity), sizeof(*(array))); \
+    } while (0);
+
+// Bytes in front of the items of every array, which start ARENA_ALIGNMENT aligned
+#define ARRAY_HEADER_SIZE 32
+
+void* array_hold(void* array, size_t count, size_t item_size);
+// An empty array with room for capacity items. Arrays made in an arena grow
+// inside it and go away with it, array_free() leaves them alone. NULL arena
+// for the heap
+void* array_make(arena_t* arena, size_t capacity, size_t item_size);
+void* array_reserve_items(void* array, size_t capacity, size_t item_size);
+// Lays an array of count items over memory the caller owns, starting with
+// ARRAY_HEADER_SIZE bytes for the header. It must not be grown or freed
+void* array_wrap(void* memory, size_t count);
+// int for the loops indexing meshes, array_size() past INT_MAX items
 int array_length(void* array);
+size_t array_size(void* array);
+void array_pop(void* array);
 void array_free(void* array);
 
-#endif
\ No newline at end of file
+#endif
@@ -13,9 +13,22 @@ static int window_height = 0;
 
 static float window_scale = 1;
 
+// The screen color target is a ring of buffers. The render thread draws into
+// color_buffers[render_buffer_idx] while the main thread uploads and presents
+// the previously finished ones in order.
+static color_framebuffer* color_buffers[SCREEN_COLOR_BUFFERS_COUNT];
 static color_framebuffer* color_buffer = NULL;
+static int render_buffer_idx = 0;
 static depth_framebuffer* z_buffer = NULL;
 
+#ifndef __EMSCRIPTEN__
+static int present_buffer_idx = 0;
+// counts finished buffers waiting to be presented
+static SDL_sem* present_ready_sem = NULL;
+// counts presented buffers the render thread can draw into again
+static SDL_sem* present_free_sem = NULL;
+#endif
+
 color_framebuffer* get_screen_color_buffer(void) {
 	return color_buffer;
 }
@@ -55,6 +68,40 @@ EM_BOOL emsc_window_size_changed(int eventType, const EmscriptenUiEvent *e, void
 }
 #endif
 
+static bool create_renderer(void) {
+	renderer = SDL_CreateRenderer(window, -1, 0);
+	if (!renderer) {
+		SDL_Log("Error creating SDL renderer");
+		return false;
+	}
+
+	color_buffer_texture = SDL_CreateTexture(
+		renderer,
+		SDL_PIXELFORMAT_RGBA32,
+		SDL_TEXTUREACCESS_STREAMING,
+		window_width,
+		window_height
+	);
+
+	return true;
+}
+
+static void present_color_buffer(color_framebuffer* framebuffer) {
+	SDL_UpdateTexture(
+		color_buffer_texture,
+		NULL,
+		framebuffer->buffer,
+		(int)(window_width * sizeof(uint32_t))
+	);
+	SDL_RenderCopy(
+		renderer,
+		color_buffer_texture,
+		NULL,
+		NULL
+	);
+	SDL_RenderPresent(renderer);
+}
+
 bool initialize_window(void) {
 	int sdl_success;
 	#ifdef __EMSCRIPTEN__
@@ -103,29 +150,28 @@ bool initialize_window(void) {
 		return false;
 	}
 
-	renderer = SDL_CreateRenderer(window, -1, 0);
-	if (!renderer) {
-		SDL_Log("Error creating SDL renderer");
-		return false;
-	}
-
 	#ifndef __EMSCRIPTEN__
 		SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
 		// SDL_SetWindowSize(window, window_width, window_height);
 	#endif
 	
-	color_buffer = make_color_buffer(window_width, window_height);
+	for (int i = 0; i < SCREEN_COLOR_BUFFERS_COUNT; i++) {
+		color_buffers[i] = make_color_buffer(window_width, window_height);
+	}
+	render_buffer_idx = 0;
+	color_buffer = color_buffers[render_buffer_idx];
 	z_buffer = make_depth_buffer(window_width, window_height);
 
-	color_buffer_texture = SDL_CreateTexture(
-		renderer,
-		SDL_PIXELFORMAT_RGBA32,
-		SDL_TEXTUREACCESS_STREAMING,
-		window_width,
-		window_height
-	);
+	#ifndef __EMSCRIPTEN__
+		present_buffer_idx = 0;
+		present_ready_sem = SDL_CreateSemaphore(0);
+		// the render thread owns the first buffer, the rest start out free
+		present_free_sem = SDL_CreateSemaphore(SCREEN_COLOR_BUFFERS_COUNT - 1);
+	#endif
 
-	return true;
+	// SDL only supports rendering on the thread that created the window (macOS
+	// enforces it), so the renderer lives on the main thread
+	return create_renderer();
 }
 
 void clear_color(uint32_t color) {
@@ -170,26 +216,40 @@ inline void draw_line_on_screen(
 }
 
 void render_color_buffer(void) {
-	
-	SDL_UpdateTexture(
-		color_buffer_texture,
-		NULL,
-		color_buffer->buffer,
-		(int)(window_width * sizeof(uint32_t))
-	);
-	SDL_RenderCopy(
-		renderer,
-		color_buffer_texture,
-		NULL,
-		NULL
-	);
-	SDL_RenderPresent(renderer);
+	#ifdef __EMSCRIPTEN__
+		// no threads on the web build, present synchronously into the same buffer
+		present_color_buffer(color_buffer);
+	#else
+		// queue the finished frame for the main thread and move on to the next
+		// buffer in the ring, waiting only if all of them are still queued
+		SDL_SemPost(present_ready_sem);
+		SDL_SemWait(present_free_sem);
+		render_buffer_idx = (render_buffer_idx + 1) % SCREEN_COLOR_BUFFERS_COUNT;
+		color_buffer = color_buffers[render_buffer_idx];
+	#endif
+}
+
+void present_color_buffers(void) {
+	#ifndef __EMSCRIPTEN__
+		while (SDL_SemTryWait(present_ready_sem) == 0) {
+			present_color_buffer(color_buffers[present_buffer_idx]);
+			present_buffer_idx = (present_buffer_idx + 1) % SCREEN_COLOR_BUFFERS_COUNT;
+			SDL_SemPost(present_free_sem);
+		}
+	#endif
 }
 
 void destroy_window(void) {
-	destroy_color_buffer(color_buffer);
-	destroy_depth_buffer(z_buffer);
+	SDL_DestroyTexture(color_buffer_texture);
 	SDL_DestroyRenderer(renderer);
+	#ifndef __EMSCRIPTEN__
+		SDL_DestroySemaphore(present_ready_sem);
+		SDL_DestroySemaphore(present_free_sem);
+	#endif
+	for (int i = 0; i < SCREEN_COLOR_BUFFERS_COUNT; i++) {
+		destroy_color_buffer(color_buffers[i]);
+	}
+	destroy_depth_buffer(z_buffer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 }
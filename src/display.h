@@ -11,6 +11,8 @@
 
 #define FPS 60
 #define FRAME_TARGET_TIME (1000 / FPS)
+// 3 buffers let the render thread start a new frame while one is being presented and another is queued
+#define SCREEN_COLOR_BUFFERS_COUNT 3
 
 #ifdef __EMSCRIPTEN__
 EM_BOOL emsc_window_size_changed(int eventType, const EmscriptenUiEvent *e, void *rawState);
@@ -29,7 +31,11 @@ void set_window_scale(float scale);
 
 void draw_rect_on_screen(int start_x, int start_y, int width, int height, uint32_t color, color_framebuffer* color_buffer);
 void draw_line_on_screen(int x0, int y0, int x1, int y1, uint32_t color);
+// Called by the thread that draws, queues the finished screen buffer and
+// switches to the next free one
 void render_color_buffer(void);
+// Main thread only, uploads and presents every queued screen buffer
+void present_color_buffers(void);
 void clear_color(uint32_t color);
 void clear_depth();
 
@@ -11,6 +11,7 @@
 #include "../geometry.h"
 #include "../triangle.h"
 #include "../pipeline.h"
+#include "../snapshot.h"
 
 #include "depth-buffer-demo.h"
 
@@ -20,6 +21,7 @@ static mesh_t* efa = NULL;
 static int vwidth = 0;
 static int vheight = 0;
 static int mask_right_border_x = 0;
+static int render_mask_right_border_x = 0;
 static float mask_border_velocity = 0.5;
 
 static float zoom_distance = 0;
@@ -55,7 +57,7 @@ void depth_buffer_example_setup(void) {
 	
 	init_frustum_planes(fovx, fovy, z_near, z_far);
 
-	efa = load_mesh(
+	efa = load_mesh_async(
 		"./assets/crab.obj",
 		"./assets/crab.png",
 		vec3_new(1, 1, 1),
@@ -65,6 +67,11 @@ void depth_buffer_example_setup(void) {
 	efa->scale.x = 0.5;
 	efa->scale.y = 0.5;
 	efa->scale.z = 0.5;
+
+	snapshot_track_data(persp_camera, sizeof(perspective_camera_t));
+	snapshot_track_data(&mask_right_border_x, sizeof(mask_right_border_x));
+	// the crab is swapped in by the asset loader while the render thread draws
+	snapshot_track_mesh(efa, false);
 }
 
 void depth_buffer_example_process_input(SDL_Event* event, int delta_time) {
@@ -116,23 +123,6 @@ void depth_buffer_example_update(int delta_time, int elapsed_time) {
 	}
 }
 
-static void main_vertex_shader(
-	int camera_type,
-	void* camera,
-	mesh_t* mesh,
-	vertex_t* vertex
-) {
-	float half_viewport_width = get_viewport_width() / 2;
-	float half_viewport_height = get_viewport_height() / 2;
-
-	vertex->position.x *= half_viewport_width;
-	vertex->position.y *= half_viewport_height;
-	vertex->position.y *= -1;
-	
-	vertex->position.x += half_viewport_width;
-	vertex->position.y += half_viewport_height;
-}
-
 static fragment_shader_result_t efa_triangle_fragment_shader(
 	int camera_type,
 	void* camera,
@@ -143,7 +133,7 @@ static fragment_shader_result_t efa_triangle_fragment_shader(
 	uint8_t a = round((1 - inputs->interpolated_w) * 255.0);
 	uint8_t depth_color_arr[4] = {1, a, a, a};
 	uint32_t depth_color = u8_to_u32(depth_color_arr);
-	bool is_mask = inputs->x < mask_right_border_x;
+	bool is_mask = inputs->x < render_mask_right_border_x;
 	fragment_shader_result_t fs_out = {
 		.color_buffer = get_screen_color_buffer(),
 		.depth_buffer = get_screen_depth_buffer(),
@@ -154,18 +144,19 @@ static fragment_shader_result_t efa_triangle_fragment_shader(
 }
 
 void depth_buffer_example_render(int delta_time, int elapsed_time) {
-	
+	render_mask_right_border_x = *(int*)snapshot_get_data(&mask_right_border_x);
+
 	pipeline_draw(
 		PERSPECTIVE_CAMERA,
 		persp_camera,
 		efa,
 		CULL_BACKFACE,
 		RENDER_TRIANGLE,
-		main_vertex_shader,
+		NULL,
 		efa_triangle_fragment_shader
 	);
 
-	draw_line_on_screen(mask_right_border_x, 0, mask_right_border_x, vheight, 0xffff0000);
+	draw_line_on_screen(render_mask_right_border_x, 0, render_mask_right_border_x, vheight, 0xffff0000);
 }
 
 void depth_buffer_example_free_resources(void) {
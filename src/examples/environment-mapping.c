@@ -11,12 +11,17 @@
 #include "../geometry.h"
 #include "../triangle.h"
 #include "../pipeline.h"
+#include "../snapshot.h"
+#include "../loader.h"
 
 #include "depth-buffer-demo.h"
 
 #define BOX_SIDES 6
 
 static texture_cube_t cube_texture;
+// the faces the render thread samples, from the snapshot so loads landing on
+// the simulation thread never swap them mid frame
+static texture_cube_t render_cube_texture;
 static perspective_camera_t* persp_camera = NULL;
 static mesh_t* sphere = NULL;
 static mesh_t* skybox_sides[BOX_SIDES];
@@ -81,13 +86,21 @@ void environment_mapping_example_setup(void) {
 
 	sphere = make_sphere(1, 20, 20, 0, M_PI * 2, 0, M_PI);
 
-	cube_texture = make_cube_texture(skybox_images);
+	load_cube_texture_async(&cube_texture, skybox_images);
 
 	for (int i = 0; i < BOX_SIDES; i++) {
 		skybox_sides[i] = make_plane(18, 18, 1, 1);
 		skybox_sides[i]->rotation = skybox_rotations[i];
 		skybox_sides[i]->translation = skybox_positions[i];
-		skybox_sides[i]->texture = &cube_texture.face_textures[i];
+		load_texture_async(skybox_images[i], &skybox_sides[i]->texture);
+	}
+
+	snapshot_track_data(persp_camera, sizeof(perspective_camera_t));
+	// the loader swaps the face and skybox textures in on the simulation thread
+	snapshot_track_data(&cube_texture, sizeof(cube_texture));
+	snapshot_track_mesh(sphere, false);
+	for (int i = 0; i < BOX_SIDES; i++) {
+		snapshot_track_mesh(skybox_sides[i], false);
 	}
 }
 
@@ -137,23 +150,6 @@ void environment_mapping_example_update(int delta_time, int elapsed_time) {
 	// ...
 }
 
-static void main_vertex_shader(
-	int camera_type,
-	void* camera,
-	mesh_t* mesh,
-	vertex_t* vertex
-) {
-	float half_viewport_width = get_viewport_width() / 2;
-	float half_viewport_height = get_viewport_height() / 2;
-
-	vertex->position.x *= half_viewport_width;
-	vertex->position.y *= half_viewport_height;
-	vertex->position.y *= -1;
-	
-	vertex->position.x += half_viewport_width;
-	vertex->position.y += half_viewport_height;
-}
-
 static fragment_shader_result_t fragment_shader(
 	int camera_type,
 	void* camera,
@@ -166,7 +162,16 @@ static fragment_shader_result_t fragment_shader(
 		.color_buffer = get_screen_color_buffer(),
 		.depth_buffer = get_screen_depth_buffer(),
 		.depth = inputs->interpolated_w,
-		.color = mesh->texture == NULL ? 0xff0000ff : sample_texture(mesh->texture, inputs->u, inputs->v)
+		.color = mesh->texture == NULL ? 0xff0000ff : sample_texture_grad(
+			mesh->texture,
+			inputs->u,
+			inputs->v,
+			inputs->du_dx,
+			inputs->dv_dx,
+			inputs->du_dy,
+			inputs->dv_dy,
+			TEXTURE_MIP_TRILINEAR
+		)
 	};
 	return fs_out;
 }
@@ -190,20 +195,20 @@ static fragment_shader_result_t fragment_shader_sphere(
 		.color_buffer = get_screen_color_buffer(),
 		.depth_buffer = get_screen_depth_buffer(),
 		.depth = inputs->interpolated_w,
-		.color = sample_cube_texture(&cube_texture, direction)
+		.color = sample_cube_texture(&render_cube_texture, direction)
 	};
 	return fs_out;
 }
 
 void environment_mapping_example_render(int delta_time, int elapsed_time) {
-	
+	render_cube_texture = *(texture_cube_t*)snapshot_get_data(&cube_texture);
 	pipeline_draw(
 		PERSPECTIVE_CAMERA,
 		persp_camera,
 		sphere,
 		CULL_BACKFACE,
 		RENDER_TRIANGLE,
-		main_vertex_shader,
+		NULL,
 		fragment_shader_sphere
 	);
 
@@ -216,7 +221,7 @@ void environment_mapping_example_render(int delta_time, int elapsed_time) {
 			skybox_side,
 			CULL_BACKFACE,
 			RENDER_TRIANGLE,
-			main_vertex_shader,
+			NULL,
 			fragment_shader
 		);
 	}
@@ -224,4 +229,5 @@ void environment_mapping_example_render(int delta_time, int elapsed_time) {
 
 void environment_mapping_example_free_resources(void) {
 	dispose_meshes();
+	free_cube_texture(&cube_texture);
 }
\ No newline at end of file
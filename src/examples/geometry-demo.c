@@ -11,6 +11,7 @@
 #include "../triangle.h"
 #include "../light.h"
 #include "../pipeline.h"
+#include "../snapshot.h"
 
 #include "geometry-demo.h"
 
@@ -40,33 +41,33 @@ void geometry_example_setup(void) {
 	init_frustum_planes(fovx, fovy, z_near, z_far);
 
 	plane = make_plane(3, 3, 3, 3);
-	load_mesh_png_data(plane, "./assets/debug.png");
+	load_mesh_png_data_async(plane, "./assets/debug.png");
 	plane->rotation.x = M_PI / 2;
 	plane->translation.x = 2;
 	plane->translation.z = 3;
 
 	sphere = make_sphere(1, 10, 10, 0, M_PI * 2, 0, M_PI);
-	load_mesh_png_data(sphere, "./assets/debug.png");
+	load_mesh_png_data_async(sphere, "./assets/debug.png");
 	sphere->translation.x = -2;
 	sphere->translation.z = 3;
 
 	box = make_box(1, 1, 1, 4, 4, 4);
-	load_mesh_png_data(box, "./assets/debug.png");
+	load_mesh_png_data_async(box, "./assets/debug.png");
 	box->translation.x = 2;
 	box->translation.z = 0;
 
 	ring = make_ring(0.5, 1, 32, 10, 0, M_PI * 2);
 	ring->rotation.x = M_PI / 2;
-	load_mesh_png_data(ring, "./assets/debug.png");
+	load_mesh_png_data_async(ring, "./assets/debug.png");
 	ring->translation.x = -2;
 	ring->translation.z = 0;
 
 	torus = make_torus(1, 0.4, 12, 48, M_PI * 2);
-	load_mesh_png_data(torus, "./assets/debug.png");
+	load_mesh_png_data_async(torus, "./assets/debug.png");
 	torus->translation.x = 2;
 	torus->translation.z = -3;
 
-	efa = load_mesh(
+	efa = load_mesh_async(
 		"./assets/efa.obj",
 		"./assets/efa.png",
 		vec3_new(1, 1, 1),
@@ -78,6 +79,11 @@ void geometry_example_setup(void) {
 	efa->scale.x = 0.75;
 	efa->scale.y = 0.75;
 	efa->scale.z = 0.75;
+
+	snapshot_track_data(camera, sizeof(perspective_camera_t));
+	for (int mesh_index = 0; mesh_index < get_meshes_count(); mesh_index++) {
+		snapshot_track_mesh(get_mesh(mesh_index), false);
+	}
 }
 
 void geometry_example_process_input(SDL_Event* event, int delta_time) {
@@ -137,23 +143,6 @@ void geometry_example_update(int delta_time, int elapsed_time) {
 	efa->rotation.y += delta_time * delta_multiplier;
 }
 
-static void main_vertex_shader(
-	int camera_type,
-	void* camera,
-	mesh_t* mesh,
-	vertex_t* vertex
-) {
-	float half_viewport_width = get_viewport_width() / 2;
-	float half_viewport_height = get_viewport_height() / 2;
-
-	vertex->position.x *= half_viewport_width;
-	vertex->position.y *= half_viewport_height;
-	vertex->position.y *= -1;
-	
-	vertex->position.x += half_viewport_width;
-	vertex->position.y += half_viewport_height;
-}
-
 static fragment_shader_result_t main_fragment_shader(
 	int camera_type,
 	void* camera,
@@ -165,7 +154,16 @@ static fragment_shader_result_t main_fragment_shader(
 		.color_buffer = get_screen_color_buffer(),
 		.depth_buffer = get_screen_depth_buffer(),
 		.depth = inputs->interpolated_w,
-		.color = sample_texture(mesh->texture, inputs->u, inputs->v)
+		.color = sample_texture_grad(
+			mesh->texture,
+			inputs->u,
+			inputs->v,
+			inputs->du_dx,
+			inputs->dv_dx,
+			inputs->du_dy,
+			inputs->dv_dy,
+			TEXTURE_MIP_NEAREST
+		)
 	};
 	return fs_out;
 }
@@ -179,7 +177,7 @@ void geometry_example_render(int delta_time, int elapsed_time) {
 			mesh,
 			CULL_BACKFACE,
 			RENDER_TRIANGLE,
-			main_vertex_shader,
+			NULL,
 			main_fragment_shader
 		);
 	}
@@ -7,6 +7,7 @@
 #include "../vector.h"
 #include "../matrix.h"
 #include "../display.h"
+#include "../snapshot.h"
 
 #include "physics-2d.h"
 
@@ -159,6 +160,8 @@ void physics2D_example_setup(void) {
 		lines[i] = line;
 	}
 
+	snapshot_track_data(particles, sizeof(particles));
+
 // printf("bbox.x %f bbox.y %f bbox.w %f bbox.h %f midx %f midy %f\n", line1.bounding_box.x, line1.bounding_box.y, line1.bounding_box.z, line1.bounding_box.w, line1.mid_x, line1.mid_y);
 	
 }
@@ -198,8 +201,9 @@ void physics2D_example_update(int delta_time, int elapsed_time) {
 }
 
 void physics2D_example_render(int delta_time, int elapsed_time) {
+	particle_t* render_particles = snapshot_get_data(particles);
 	for (int i = 0; i < PARTICLES_COUNT; i++) {
-		particle_t* particle = &particles[i];
+		particle_t* particle = &render_particles[i];
 		draw_rect_on_screen(particle->x, particle->y, particle->radius, particle->radius, 0xffaaaaaa, get_screen_color_buffer());
 	}
 
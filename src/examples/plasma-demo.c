@@ -12,6 +12,7 @@
 #include "../triangle.h"
 #include "../color.h"
 #include "../pipeline.h"
+#include "../snapshot.h"
 
 #include "plasma-demo.h"
 
@@ -25,6 +26,7 @@ static uint32_t palette[256];
 static int vwidth = 0;
 static int vheight = 0;
 static int paletteShift;
+static int render_palette_shift;
 
 static float zoom_distance = 0;
 static float zoom_distance_end = 0;
@@ -79,6 +81,10 @@ void plasma_demo_setup(void) {
 		color_rgb.b = 128.0 + 128 * sin(3.1415 * x / 128.0);
 		palette[x] = rgb_to_uint32(&color_rgb);
   }
+
+	snapshot_track_data(persp_camera, sizeof(perspective_camera_t));
+	snapshot_track_data(&paletteShift, sizeof(paletteShift));
+	snapshot_track_mesh(mesh, false);
 }
 
 void plasma_demo_process_input(SDL_Event* event, int delta_time) {
@@ -130,23 +136,6 @@ void plasma_demo_update(int delta_time, int elapsed_time) {
 	mesh->rotation.z += delta_time * 0.00075;
 }
 
-static void vertex_shader(
-	int camera_type,
-	void* camera,
-	mesh_t* mesh,
-	vertex_t* vertex
-) {
-	float half_viewport_width = get_viewport_width() / 2;
-	float half_viewport_height = get_viewport_height() / 2;
-
-	vertex->position.x *= half_viewport_width;
-	vertex->position.y *= half_viewport_height;
-	vertex->position.y *= -1;
-	
-	vertex->position.x += half_viewport_width;
-	vertex->position.y += half_viewport_height;
-}
-
 static fragment_shader_result_t fragment_shader(
 	int camera_type,
 	void* camera,
@@ -157,7 +146,7 @@ static fragment_shader_result_t fragment_shader(
 
 	int x = (int)(fabs(inputs->u * PLASMA_BUFFER_SIZE)) % PLASMA_BUFFER_SIZE;
 	int y = (int)(fabs(inputs->v * PLASMA_BUFFER_SIZE)) % PLASMA_BUFFER_SIZE;
-	uint32_t color = palette[(plasma[y][x] + paletteShift) % 256];
+	uint32_t color = palette[(plasma[y][x] + render_palette_shift) % 256];
 
 	fragment_shader_result_t fs_out = {
 		.color_buffer = get_screen_color_buffer(),
@@ -169,13 +158,14 @@ static fragment_shader_result_t fragment_shader(
 }
 
 void plasma_demo_render(int delta_time, int elapsed_time) {
+	render_palette_shift = *(int*)snapshot_get_data(&paletteShift);
 	pipeline_draw(
 		PERSPECTIVE_CAMERA,
 		persp_camera,
 		mesh,
 		CULL_NONE,
 		RENDER_TRIANGLE,
-		vertex_shader,
+		NULL,
 		fragment_shader
 	);
 }
@@ -11,13 +11,15 @@
 #include "../geometry.h"
 #include "../triangle.h"
 #include "../pipeline.h"
+#include "../snapshot.h"
 
 #define SHADOW_DEPTH_BUFFER_SIZE 512
-#define SHADOW_DEPTH_BUFFER_HALF_SIZE 256
 
 static perspective_camera_t* persp_camera = NULL;
 static orthographic_camera_t* depth_camera = NULL;
+static render_target_t* shadow_render_target = NULL;
 static depth_framebuffer* shadow_depth_buffer = NULL;
+static texture_view_t shadow_map_view;
 static mesh_t* efa = NULL;
 static mesh_t* plane = NULL;
 static time_t timer_elapsed_time;
@@ -70,11 +72,9 @@ void shadow_map_example_setup(void) {
 		ortho_cam_target
 	);
 
-	shadow_depth_buffer = make_depth_buffer(SHADOW_DEPTH_BUFFER_SIZE, SHADOW_DEPTH_BUFFER_SIZE);
-	
 	init_frustum_planes(fovx, fovy, z_near, z_far);
 
-	efa = load_mesh(
+	efa = load_mesh_async(
 		"./assets/efa.obj",
 		"./assets/efa.png",
 		vec3_new(1, 1, 1),
@@ -87,10 +87,17 @@ void shadow_map_example_setup(void) {
 	efa->translation.y = 2.0;
 
 	plane = make_plane(5, 5, 5, 5);
+	// animated below, so it can not share its vertices
+	detach_mesh_geometry(plane);
 	plane->rotation.x = M_PI / 2;
 
 	timer_elapsed_time = time(NULL);
 	next_time = timer_elapsed_time + (uint32_t)2;
+
+	snapshot_track_data(persp_camera, sizeof(perspective_camera_t));
+	snapshot_track_mesh(efa, false);
+	// the plane is animated by displacing its vertices
+	snapshot_track_mesh(plane, true);
 }
 
 void shadow_map_example_process_input(SDL_Event* event, int delta_time) {
@@ -199,20 +206,6 @@ void shadow_map_example_update(int delta_time, int elapsed_time) {
 	efa->rotation.z += (jet_rotation_target.z - efa->rotation.z) * (delta_time * 0.0015);
 }
 
-void depth_vertex_shader(
-	int camera_type,
-	void* camera,
-	mesh_t* mesh,
-	vertex_t* vertex
-) {
-	vertex->position.x *= SHADOW_DEPTH_BUFFER_HALF_SIZE;
-	vertex->position.y *= SHADOW_DEPTH_BUFFER_HALF_SIZE;
-	vertex->position.y *= -1;
-	
-	vertex->position.x += SHADOW_DEPTH_BUFFER_HALF_SIZE;
-	vertex->position.y += SHADOW_DEPTH_BUFFER_HALF_SIZE;
-}
-
 fragment_shader_result_t depth_fragment_shader(
 	int camera_type,
 	void* camera,
@@ -227,23 +220,6 @@ fragment_shader_result_t depth_fragment_shader(
 	return fs_out;
 }
 
-static void main_vertex_shader(
-	int camera_type,
-	void* camera,
-	mesh_t* mesh,
-	vertex_t* vertex
-) {
-	float half_viewport_width = get_viewport_width() / 2;
-	float half_viewport_height = get_viewport_height() / 2;
-
-	vertex->position.x *= half_viewport_width;
-	vertex->position.y *= half_viewport_height;
-	vertex->position.y *= -1;
-	
-	vertex->position.x += half_viewport_width;
-	vertex->position.y += half_viewport_height;
-}
-
 static fragment_shader_result_t efa_triangle_fragment_shader(
 	int camera_type,
 	void* camera,
@@ -310,18 +286,13 @@ fragment_shader_result_t plane_fragment_shader(
 	mat4_t inverse_vp_matrix = mat4_mul_mat4(depth_camera->projection_matrix, depth_camera->view_matrix);
 	vec4_t shadow_pos = mat4_mul_vec4_project(inverse_vp_matrix, pos);
 
-	int shadow_x = shadow_pos.x * SHADOW_DEPTH_BUFFER_HALF_SIZE;
-	int shadow_y = shadow_pos.y * SHADOW_DEPTH_BUFFER_HALF_SIZE;
-	shadow_y *= -1;
-
-	shadow_x += SHADOW_DEPTH_BUFFER_HALF_SIZE;
-	shadow_y += SHADOW_DEPTH_BUFFER_HALF_SIZE;
-
-	int idx = shadow_y * SHADOW_DEPTH_BUFFER_SIZE + shadow_x; // index in the shadowbuffer array
+	// NDC to shadow map texture coordinates, flipping y like the viewport transform does
+	float shadow_u = shadow_pos.x * 0.5 + 0.5;
+	float shadow_v = -shadow_pos.y * 0.5 + 0.5;
 
 	fs_out.color = 0xffbbbbbb;
 
-	if ((get_depth_buffer_at_idx(shadow_depth_buffer, idx) < (1 - shadow_pos.z))) {
+	if (sample_depth_texture_view(&shadow_map_view, shadow_u, shadow_v) < (1 - shadow_pos.z)) {
 		fs_out.color += 0xffeeeeee;
 	}
 
@@ -329,30 +300,38 @@ fragment_shader_result_t plane_fragment_shader(
 }
 
 void shadow_map_example_render(int delta_time, int elapsed_time) {
-	
+	// the shadow map only lives for the frame, the pool hands back last frame's memory
+	shadow_render_target = acquire_render_target(SHADOW_DEPTH_BUFFER_SIZE, SHADOW_DEPTH_BUFFER_SIZE, RENDER_TARGET_DEPTH);
+	shadow_depth_buffer = shadow_render_target->depth_buffer;
+	shadow_map_view = make_depth_texture_view(shadow_depth_buffer, TEXTURE_WRAP_CLAMP, TEXTURE_FILTER_NEAREST);
 	clear_depth_buffer(shadow_depth_buffer);
 
 	// render shadow map
 
+	pipeline_rect_t screen_viewport = pipeline_get_viewport();
+	pipeline_set_viewport(0, 0, SHADOW_DEPTH_BUFFER_SIZE, SHADOW_DEPTH_BUFFER_SIZE);
+
 	pipeline_draw(
 		ORTHOGRAPHIC_CAMERA,
 		depth_camera,
 		efa,
 		CULL_BACKFACE,
 		RENDER_TRIANGLE,
-		depth_vertex_shader,
+		NULL,
 		depth_fragment_shader
 	);
 
 	// render main scene
 
+	pipeline_set_viewport(screen_viewport.x, screen_viewport.y, screen_viewport.width, screen_viewport.height);
+
 	pipeline_draw(
 		PERSPECTIVE_CAMERA,
 		persp_camera,
 		plane,
 		CULL_BACKFACE,
 		RENDER_TRIANGLE,
-		main_vertex_shader,
+		NULL,
 		plane_fragment_shader
 	);
 	
@@ -362,12 +341,13 @@ void shadow_map_example_render(int delta_time, int elapsed_time) {
 		efa,
 		CULL_BACKFACE,
 		RENDER_TRIANGLE,
-		main_vertex_shader,
+		NULL,
 		efa_triangle_fragment_shader
 	);
+
+	release_render_target(shadow_render_target);
 }
 
 void shadow_map_example_free_resources(void) {
 	dispose_meshes();
-	destroy_depth_buffer(shadow_depth_buffer);
 }
\ No newline at end of file
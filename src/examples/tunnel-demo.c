@@ -12,6 +12,7 @@
 #include "../triangle.h"
 #include "../color.h"
 #include "../pipeline.h"
+#include "../snapshot.h"
 
 #include "plasma-demo.h"
 
@@ -27,10 +28,15 @@ static uint32_t angle_table[TUNNEL_TEXTURE_SIZE_X2][TUNNEL_TEXTURE_SIZE_X2];
 
 static int vwidth = 0;
 static int vheight = 0;
-static int shift_x = 0;
-static int shift_y = 0;
-static int shift_look_x = 0;
-static int shift_look_y = 0;
+typedef struct {
+	int shift_x;
+	int shift_y;
+	int shift_look_x;
+	int shift_look_y;
+} tunnel_animation_t;
+
+static tunnel_animation_t animation = { 0 };
+static tunnel_animation_t render_animation = { 0 };
 
 static float zoom_distance = 0;
 static float zoom_distance_end = 0;
@@ -84,6 +90,10 @@ void tunnel_demo_setup(void) {
 			angle_table[y][x] = angle;
 		}
 	}
+
+	snapshot_track_data(persp_camera, sizeof(perspective_camera_t));
+	snapshot_track_data(&animation, sizeof(animation));
+	snapshot_track_mesh(mesh, false);
 }
 
 void tunnel_demo_process_input(SDL_Event* event, int delta_time) {
@@ -129,35 +139,18 @@ void tunnel_demo_process_input(SDL_Event* event, int delta_time) {
 }
 
 void tunnel_demo_update(int delta_time, int elapsed_time) {
-	float animation = elapsed_time * 0.001;
-	shift_x = (int)(TUNNEL_TEXTURE_SIZE * 1.0 * animation);
-	shift_y = (int)(TUNNEL_TEXTURE_SIZE * 0.25 * animation);
+	float animation_time = elapsed_time * 0.001;
+	animation.shift_x = (int)(TUNNEL_TEXTURE_SIZE * 1.0 * animation_time);
+	animation.shift_y = (int)(TUNNEL_TEXTURE_SIZE * 0.25 * animation_time);
 
-	shift_look_x = TUNNEL_TEXTURE_SIZE / 2 + (int)(TUNNEL_TEXTURE_SIZE / 3 * sin(animation));
-	shift_look_y = TUNNEL_TEXTURE_SIZE / 2 + (int)(TUNNEL_TEXTURE_SIZE / 3 * sin(animation * 2.0));
+	animation.shift_look_x = TUNNEL_TEXTURE_SIZE / 2 + (int)(TUNNEL_TEXTURE_SIZE / 3 * sin(animation_time));
+	animation.shift_look_y = TUNNEL_TEXTURE_SIZE / 2 + (int)(TUNNEL_TEXTURE_SIZE / 3 * sin(animation_time * 2.0));
 
 	mesh->rotation.x += delta_time * 0.00075;
 	mesh->rotation.y += delta_time * 0.00075;
 	mesh->rotation.z += delta_time * 0.00075;
 }
 
-static void vertex_shader(
-	int camera_type,
-	void* camera,
-	mesh_t* mesh,
-	vertex_t* vertex
-) {
-	float half_viewport_width = get_viewport_width() / 2;
-	float half_viewport_height = get_viewport_height() / 2;
-
-	vertex->position.x *= half_viewport_width;
-	vertex->position.y *= half_viewport_height;
-	vertex->position.y *= -1;
-	
-	vertex->position.x += half_viewport_width;
-	vertex->position.y += half_viewport_height;
-}
-
 static fragment_shader_result_t fragment_shader(
 	int camera_type,
 	void* camera,
@@ -169,10 +162,12 @@ static fragment_shader_result_t fragment_shader(
 	int y = (int)(fabs(inputs->v * TUNNEL_TEXTURE_SIZE)) % TUNNEL_TEXTURE_SIZE;
 
 	// uint32_t color = tunnel_texture[(uint)(distance_table[y][x] + shift_x) % TUNNEL_TEXTURE_SIZE][(uint)(angle_table[y][x] + shift_y) % TUNNEL_TEXTURE_SIZE];
+	int shift_look_x = render_animation.shift_look_x;
+	int shift_look_y = render_animation.shift_look_y;
 	uint32_t color = tunnel_texture[
-		(unsigned int)(distance_table[x + shift_look_x][y + shift_look_y] + shift_x) % TUNNEL_TEXTURE_SIZE
+		(unsigned int)(distance_table[x + shift_look_x][y + shift_look_y] + render_animation.shift_x) % TUNNEL_TEXTURE_SIZE
 	][
-		(unsigned int)(angle_table[x + shift_look_x][y + shift_look_y]+ shift_y) % TUNNEL_TEXTURE_SIZE
+		(unsigned int)(angle_table[x + shift_look_x][y + shift_look_y]+ render_animation.shift_y) % TUNNEL_TEXTURE_SIZE
 	];
 
 	fragment_shader_result_t fs_out = {
@@ -185,13 +180,14 @@ static fragment_shader_result_t fragment_shader(
 }
 
 void tunnel_demo_render(int delta_time, int elapsed_time) {
+	render_animation = *(tunnel_animation_t*)snapshot_get_data(&animation);
 	pipeline_draw(
 		PERSPECTIVE_CAMERA,
 		persp_camera,
 		mesh,
 		CULL_NONE,
 		RENDER_TRIANGLE,
-		vertex_shader,
+		NULL,
 		fragment_shader
 	);
 }
@@ -1,23 +1,34 @@
 #include <stdlib.h>
 #include <assert.h>
 #include "stdio.h"
+#include "array.h"
 #include "framebuffer.h"
 
-static color_framebuffer color_framebuffers[MAX_NUM_COLORBUFFERS];
-static depth_framebuffer depth_framebuffers[MAX_NUM_DEPTHBUFFERS];
-static int color_framebuffer_count = 0;
-static int depth_framebuffer_count = 0;
+typedef struct {
+	int width;
+	int height;
+	int attachments;
+	render_target_t** free_render_targets;
+} render_target_bucket_t;
+
+static render_target_bucket_t* render_target_buckets = NULL;
+
+static void* make_aligned_buffer(size_t size) {
+	// aligned_alloc wants the size to be a multiple of the alignment
+	size_t aligned_size = (size + FRAMEBUFFER_ALIGNMENT - 1) & ~(size_t)(FRAMEBUFFER_ALIGNMENT - 1);
+	void* buffer = aligned_alloc(FRAMEBUFFER_ALIGNMENT, aligned_size);
+	assert(buffer != NULL);
+	return buffer;
+}
 
 color_framebuffer* make_color_buffer(int width, int height) {
-	printf("Create color framebuffer %d\n", color_framebuffer_count);
-	assert(color_framebuffer_count < MAX_NUM_COLORBUFFERS);
-	color_framebuffer* framebuffer = &color_framebuffers[color_framebuffer_count];
+	printf("Create color framebuffer %dx%d\n", width, height);
+	color_framebuffer* framebuffer = (color_framebuffer*)malloc(sizeof(color_framebuffer));
+	assert(framebuffer != NULL);
 
 	framebuffer->width = width;
 	framebuffer->height = height;
-	framebuffer->buffer = (uint32_t*)malloc(sizeof(uint32_t) * width * height);
-
-	color_framebuffer_count++;
+	framebuffer->buffer = (uint32_t*)make_aligned_buffer(sizeof(uint32_t) * width * height);
 
 	return framebuffer;
 }
@@ -36,23 +47,26 @@ void clear_color_buffer(color_framebuffer* framebuffer, uint32_t color) {
 		framebuffer->buffer[i] = color;
 	}
 }
+
 void destroy_color_buffer(color_framebuffer* framebuffer) {
+	if (framebuffer == NULL) {
+		return;
+	}
 	free(framebuffer->buffer);
+	free(framebuffer);
 }
 
 depth_framebuffer* make_depth_buffer(int width, int height) {
-	printf("Create depth framebuffer %d\n", depth_framebuffer_count);
-	assert(depth_framebuffer_count < MAX_NUM_COLORBUFFERS);
-	depth_framebuffer* framebuffer = &depth_framebuffers[depth_framebuffer_count];
+	printf("Create depth framebuffer %dx%d\n", width, height);
+	depth_framebuffer* framebuffer = (depth_framebuffer*)malloc(sizeof(depth_framebuffer));
+	assert(framebuffer != NULL);
 
 	framebuffer->width = width;
 	framebuffer->height = height;
-	framebuffer->buffer = (float*)malloc(sizeof(float) * width * height);	
+	framebuffer->buffer = (float*)make_aligned_buffer(sizeof(float) * width * height);
 
 	clear_depth_buffer(framebuffer);
 
-	depth_framebuffer_count++;
-
 	return framebuffer;
 }
 
@@ -62,10 +76,6 @@ void clear_depth_buffer(depth_framebuffer* framebuffer) {
 	}
 }
 
-depth_framebuffer* get_depth_buffer(int idx) {
-	return &depth_framebuffers[idx];
-}
-
 float get_depth_buffer_at(depth_framebuffer* framebuffer, int x, int y) {
 	if (x < 0 || x >= framebuffer->width || y < 0 || y >= framebuffer->height) {
 		return 1.0;
@@ -89,6 +99,87 @@ void update_depth_buffer_at(depth_framebuffer* framebuffer, int x, int y, float
 }
 
 void destroy_depth_buffer(depth_framebuffer* framebuffer) {
+	if (framebuffer == NULL) {
+		return;
+	}
 	free(framebuffer->buffer);
-	depth_framebuffer_count--;
+	free(framebuffer);
+}
+
+render_target_t* make_render_target(int width, int height, int attachments) {
+	render_target_t* render_target = (render_target_t*)malloc(sizeof(render_target_t));
+	assert(render_target != NULL);
+
+	render_target->width = width;
+	render_target->height = height;
+	render_target->attachments = attachments;
+	render_target->color_buffer = NULL;
+	render_target->depth_buffer = NULL;
+
+	if (attachments & RENDER_TARGET_COLOR) {
+		render_target->color_buffer = make_color_buffer(width, height);
+	}
+	if (attachments & RENDER_TARGET_DEPTH) {
+		render_target->depth_buffer = make_depth_buffer(width, height);
+	}
+
+	return render_target;
+}
+
+void destroy_render_target(render_target_t* render_target) {
+	if (render_target == NULL) {
+		return;
+	}
+	destroy_color_buffer(render_target->color_buffer);
+	destroy_depth_buffer(render_target->depth_buffer);
+	free(render_target);
+}
+
+static render_target_bucket_t* get_render_target_bucket(int width, int height, int attachments) {
+	for (int i = 0; i < array_length(render_target_buckets); i++) {
+		render_target_bucket_t* bucket = &render_target_buckets[i];
+		if (bucket->width == width && bucket->height == height && bucket->attachments == attachments) {
+			return bucket;
+		}
+	}
+	render_target_bucket_t bucket = {
+		.width = width,
+		.height = height,
+		.attachments = attachments,
+		.free_render_targets = NULL
+	};
+	array_push(render_target_buckets, bucket);
+	return &render_target_buckets[array_length(render_target_buckets) - 1];
+}
+
+render_target_t* acquire_render_target(int width, int height, int attachments) {
+	render_target_bucket_t* bucket = get_render_target_bucket(width, height, attachments);
+	int free_count = array_length(bucket->free_render_targets);
+	if (free_count == 0) {
+		return make_render_target(width, height, attachments);
+	}
+	render_target_t* render_target = bucket->free_render_targets[free_count - 1];
+	array_pop(bucket->free_render_targets);
+	return render_target;
+}
+
+void release_render_target(render_target_t* render_target) {
+	render_target_bucket_t* bucket = get_render_target_bucket(
+		render_target->width,
+		render_target->height,
+		render_target->attachments
+	);
+	array_push(bucket->free_render_targets, render_target);
+}
+
+void free_render_target_pool(void) {
+	for (int i = 0; i < array_length(render_target_buckets); i++) {
+		render_target_bucket_t* bucket = &render_target_buckets[i];
+		for (int j = 0; j < array_length(bucket->free_render_targets); j++) {
+			destroy_render_target(bucket->free_render_targets[j]);
+		}
+		array_free(bucket->free_render_targets);
+	}
+	array_free(render_target_buckets);
+	render_target_buckets = NULL;
 }
@@ -3,8 +3,9 @@
 
 #include <stdint.h>
 
-#define MAX_NUM_COLORBUFFERS 5
-#define MAX_NUM_DEPTHBUFFERS 5
+// Framebuffer memory is aligned to a cache line so rows of neighbouring
+// buffers never share lines and wide stores stay aligned
+#define FRAMEBUFFER_ALIGNMENT 64
 
 typedef struct {
 	int width;
@@ -18,6 +19,19 @@ typedef struct {
 	float* buffer;
 } depth_framebuffer;
 
+enum render_target_attachment {
+	RENDER_TARGET_COLOR = 1 << 0,
+	RENDER_TARGET_DEPTH = 1 << 1
+};
+
+typedef struct {
+	int width;
+	int height;
+	int attachments;
+	color_framebuffer* color_buffer;
+	depth_framebuffer* depth_buffer;
+} render_target_t;
+
 color_framebuffer* make_color_buffer(int width, int height);
 void update_color_buffer_at(color_framebuffer* framebuffer, int x, int y, uint32_t color);
 void clear_color_buffer(color_framebuffer* framebuffer, uint32_t color);
@@ -25,10 +39,32 @@ void destroy_color_buffer(color_framebuffer* framebuffer);
 
 depth_framebuffer* make_depth_buffer(int width, int height);
 void clear_depth_buffer(depth_framebuffer* framebuffer);
-depth_framebuffer* get_depth_buffer(int idx);
 float get_depth_buffer_at(depth_framebuffer* framebuffer, int x, int y);
 float get_depth_buffer_at_idx(depth_framebuffer* framebuffer, int idx);
 void update_depth_buffer_at(depth_framebuffer* framebuffer, int x, int y, float value);
 void destroy_depth_buffer(depth_framebuffer* framebuffer);
 
-#endif
\ No newline at end of file
+// Unchecked accessors for the rasterizer, which clips against the pipeline
+// viewport and scissor once per triangle instead of once per pixel
+static inline void update_color_buffer_at_unchecked(color_framebuffer* framebuffer, int x, int y, uint32_t color) {
+	framebuffer->buffer[y * framebuffer->width + x] = color;
+}
+
+static inline float get_depth_buffer_at_unchecked(depth_framebuffer* framebuffer, int x, int y) {
+	return framebuffer->buffer[y * framebuffer->width + x];
+}
+
+static inline void update_depth_buffer_at_unchecked(depth_framebuffer* framebuffer, int x, int y, float value) {
+	framebuffer->buffer[y * framebuffer->width + x] = value;
+}
+
+render_target_t* make_render_target(int width, int height, int attachments);
+void destroy_render_target(render_target_t* render_target);
+
+// Transient render targets come from a pool bucketed by size and attachments,
+// so acquiring one every frame reuses the memory released the frame before
+render_target_t* acquire_render_target(int width, int height, int attachments);
+void release_render_target(render_target_t* render_target);
+void free_render_target_pool(void);
+
+#endif
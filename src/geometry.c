@@ -2,175 +2,429 @@
 // https://github.com/mrdoob/three.js/tree/master/src/geometries
 
 #include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
 #include "stdio.h"
 #include "math.h"
 #include "array.h"
 #include "geometry.h"
 #include "utils.h"
 
-void make_plane_geometry(
-	mesh_t *mesh,
-	float width,
-	float height,
-	int width_segments,
-	int height_segments
-) {
-	float half_width = width / 2;
-	float half_height = height / 2;
-	int grid_x1 = width_segments + 1;
-	int grid_y1 = height_segments + 1;
-	float segment_width = width / (float)width_segments;
-	float segment_height = height / (float)height_segments;
-	
-	vec3_t vertex;
-	tex2_t uv;
-
-	tex2_t *texcoords = NULL;
+// Grids with fewer vertices are not worth starting threads for
+#define GEOMETRY_PARALLEL_MIN_VERTICES (1 << 16)
+#define GEOMETRY_MAX_THREADS 16
+#define GEOMETRY_MAX_PARAMETERS 7
+
+enum geometry_type {
+	GEOMETRY_PLANE,
+	GEOMETRY_SPHERE,
+	GEOMETRY_BOX,
+	GEOMETRY_RING,
+	GEOMETRY_TORUS
+};
+
+typedef struct {
+	int type;
+	float parameters[GEOMETRY_MAX_PARAMETERS];
+	vec3_t* vertices;
+	vec3_t* normals;
+	face_t* faces;
+	int ref_count;
+} geometry_cache_entry_t;
+
+static geometry_cache_entry_t* geometry_cache = NULL;
+
+static bool acquire_cached_geometry(mesh_t* mesh, int type, float* parameters, int parameters_count) {
+	for (int i = 0; i < array_length(geometry_cache); i++) {
+		geometry_cache_entry_t* entry = &geometry_cache[i];
+		if (entry->type == type && memcmp(entry->parameters, parameters, sizeof(float) * parameters_count) == 0) {
+			entry->ref_count++;
+			mesh->vertices = entry->vertices;
+			mesh->normals = entry->normals;
+			mesh->faces = entry->faces;
+			mesh->vertices_count = array_length(entry->vertices);
+			return true;
+		}
+	}
+	return false;
+}
 
-	int vertices_count = 0;
+static void insert_cached_geometry(mesh_t* mesh, int type, float* parameters, int parameters_count) {
+	geometry_cache_entry_t entry = {
+		.type = type,
+		.vertices = mesh->vertices,
+		.normals = mesh->normals,
+		.faces = mesh->faces,
+		.ref_count = 1
+	};
+	memcpy(entry.parameters, parameters, sizeof(float) * parameters_count);
+	array_push(geometry_cache, entry);
+}
 
-	for (int iy = 0; iy < grid_y1; iy++) {
-		float y = (float)iy * segment_height - half_height;
-		for (int ix = 0; ix < grid_x1; ix++) {
-			float x = (float)ix * segment_width - half_width;
-			vertex.x = -x;
-			vertex.y = -y;
-			vertex.z = 0;
-			array_push(mesh->vertices, vertex);
-
-			array_push(mesh->normals, vec3_new(0, 0, 1));
-
-			uv.u = 1 - (float)ix / width_segments;
-			uv.v = 1 - (float)iy / height_segments;
-			array_push(texcoords, uv);
-			vertices_count++;
+bool is_cached_geometry(mesh_t* mesh) {
+	for (int i = 0; i < array_length(geometry_cache); i++) {
+		if (mesh->vertices != NULL && geometry_cache[i].vertices == mesh->vertices) {
+			return true;
 		}
 	}
+	return false;
+}
 
-	for (int iy = 0; iy < height_segments; iy++) {
-		for (int ix = 0; ix < width_segments; ix++) {
+bool release_cached_geometry(mesh_t* mesh) {
+	for (int i = 0; i < array_length(geometry_cache); i++) {
+		geometry_cache_entry_t* entry = &geometry_cache[i];
+		if (mesh->vertices == NULL || entry->vertices != mesh->vertices) {
+			continue;
+		}
+		entry->ref_count--;
+		if (entry->ref_count == 0) {
+			array_free(entry->vertices);
+			array_free(entry->normals);
+			array_free(entry->faces);
+			*entry = geometry_cache[array_length(geometry_cache) - 1];
+			array_pop(geometry_cache);
+		}
+		if (array_length(geometry_cache) == 0) {
+			array_free(geometry_cache);
+			geometry_cache = NULL;
+		}
+		return true;
+	}
+	return false;
+}
 
-			int a = ix + grid_x1 * iy;
-			int b = ix + grid_x1 * (iy + 1);
-			int c = (ix + 1) + grid_x1 * (iy + 1);
-			int d = (ix + 1) + grid_x1 * iy;
+// Fills rows [first_row, last_row) of a generator
+typedef void (*geometry_rows_callback)(void* generator, int first_row, int last_row);
 
-			face_t face_a = {
+typedef struct {
+	geometry_rows_callback fill_rows;
+	void* generator;
+	int first_row;
+	int last_row;
+} geometry_rows_job_t;
+
+static int geometry_rows_thread_main(void* data) {
+	geometry_rows_job_t* job = data;
+	job->fill_rows(job->generator, job->first_row, job->last_row);
+	return 0;
+}
+
+// Rows write disjoint parts of preallocated arrays, so large grids split them
+// over threads and run inline when a thread can not be created
+static void fill_geometry_rows(geometry_rows_callback fill_rows, void* generator, int rows_count, int vertices_count) {
+	int threads_count = 1;
+#ifndef __EMSCRIPTEN__
+	if (vertices_count >= GEOMETRY_PARALLEL_MIN_VERTICES) {
+		threads_count = CLAMP(1, MIN(GEOMETRY_MAX_THREADS, rows_count), SDL_GetCPUCount());
+	}
+#endif
+	geometry_rows_job_t jobs[GEOMETRY_MAX_THREADS];
+	SDL_Thread* threads[GEOMETRY_MAX_THREADS] = { NULL };
+	for (int i = 0; i < threads_count; i++) {
+		jobs[i] = (geometry_rows_job_t){
+			.fill_rows = fill_rows,
+			.generator = generator,
+			.first_row = rows_count * i / threads_count,
+			.last_row = rows_count * (i + 1) / threads_count
+		};
+	}
+	for (int i = 1; i < threads_count; i++) {
+		threads[i] = SDL_CreateThread(geometry_rows_thread_main, "Geometry", &jobs[i]);
+		if (threads[i] == NULL) {
+			geometry_rows_thread_main(&jobs[i]);
+		}
+	}
+	geometry_rows_thread_main(&jobs[0]);
+	for (int i = 1; i < threads_count; i++) {
+		if (threads[i] != NULL) {
+			SDL_WaitThread(threads[i], NULL);
+		}
+	}
+}
+
+static void alloc_geometry(mesh_t* mesh, int vertices_count, int faces_count) {
+	mesh->vertices = array_hold(NULL, vertices_count, sizeof(vec3_t));
+	mesh->normals = array_hold(NULL, vertices_count, sizeof(vec3_t));
+	mesh->faces = array_hold(NULL, faces_count, sizeof(face_t));
+	mesh->vertices_count = vertices_count;
+}
+
+// A (columns + 1) x (rows + 1) grid of vertices with two faces per cell. The
+// generators embed it as their first member
+typedef struct grid grid_t;
+struct grid {
+	mesh_t* mesh;
+	// where the grid starts in the mesh arrays, the box puts six in one mesh
+	int first_vertex;
+	int first_face;
+	int columns;
+	int rows;
+	// the torus winds its cells from the next row back to this one
+	bool is_winding_flipped;
+	void (*make_vertex)(grid_t* grid, int ix, int iy, vec3_t* vertex, vec3_t* normal);
+	// called once all vertices are in place
+	tex2_t (*get_uv)(grid_t* grid, int ix, int iy);
+};
+
+static inline int get_grid_vertex(grid_t* grid, int ix, int iy) {
+	return grid->first_vertex + iy * (grid->columns + 1) + ix;
+}
+
+static void fill_grid_vertices(void* generator, int first_row, int last_row) {
+	grid_t* grid = generator;
+	for (int iy = first_row; iy < last_row; iy++) {
+		for (int ix = 0; ix <= grid->columns; ix++) {
+			int index = get_grid_vertex(grid, ix, iy);
+			grid->make_vertex(grid, ix, iy, &grid->mesh->vertices[index], &grid->mesh->normals[index]);
+		}
+	}
+}
+
+static void fill_grid_faces(void* generator, int first_row, int last_row) {
+	grid_t* grid = generator;
+	for (int iy = first_row; iy < last_row; iy++) {
+		int row = grid->is_winding_flipped ? iy + 1 : iy;
+		int next_row = grid->is_winding_flipped ? iy : iy + 1;
+		face_t* faces = &grid->mesh->faces[grid->first_face + iy * grid->columns * 2];
+		// the right edge of a cell is the left edge of the next one
+		int a = get_grid_vertex(grid, 0, row);
+		int b = get_grid_vertex(grid, 0, next_row);
+		tex2_t a_uv = grid->get_uv(grid, 0, row);
+		tex2_t b_uv = grid->get_uv(grid, 0, next_row);
+		for (int ix = 0; ix < grid->columns; ix++) {
+			int c = b + 1;
+			int d = a + 1;
+			tex2_t c_uv = grid->get_uv(grid, ix + 1, next_row);
+			tex2_t d_uv = grid->get_uv(grid, ix + 1, row);
+
+			faces[ix * 2] = (face_t){
 				.a = a,
 				.b = b,
 				.c = d,
-				.a_uv = texcoords[a],
-				.b_uv = texcoords[b],
-				.c_uv = texcoords[d],
+				.a_uv = a_uv,
+				.b_uv = b_uv,
+				.c_uv = d_uv,
 				.color = MESH_DEBUG_COLOR
 			};
-			array_push(mesh->faces, face_a);
-
-			face_t face_b = {
+			faces[ix * 2 + 1] = (face_t){
 				.a = b,
 				.b = c,
 				.c = d,
-				.a_uv = texcoords[b],
-				.b_uv = texcoords[c],
-				.c_uv = texcoords[d],
+				.a_uv = b_uv,
+				.b_uv = c_uv,
+				.c_uv = d_uv,
 				.color = MESH_DEBUG_COLOR
 			};
-			array_push(mesh->faces, face_b);
-		}
 
+			a = d;
+			b = c;
+			a_uv = d_uv;
+			b_uv = c_uv;
+		}
 	}
+}
 
-	mesh->vertices_count = vertices_count;
-
-	array_free(texcoords);
+static int get_grid_vertices_count(grid_t* grid) {
+	return (grid->columns + 1) * (grid->rows + 1);
 }
 
-void make_sphere_geometry(
-	mesh_t *mesh,
-	float radius,
-	int width_segments,
-	int height_segments,
-	float phi_start,
-	float phi_length,
-	float theta_start,
-	float theta_length
-) {
-	width_segments = MAX(3, width_segments);
-	height_segments = MAX(2, height_segments);
+static int get_grid_faces_count(grid_t* grid) {
+	return grid->columns * grid->rows * 2;
+}
 
-	float theta_end = MIN(theta_start + theta_length, M_PI);
-	int index = 0;
-	int grid[height_segments + 1][width_segments + 1];
+static void fill_grid(grid_t* grid) {
+	int vertices_count = get_grid_vertices_count(grid);
+	// faces read the UVs of the next row, so every vertex goes in first
+	fill_geometry_rows(fill_grid_vertices, grid, grid->rows + 1, vertices_count);
+	fill_geometry_rows(fill_grid_faces, grid, grid->rows, vertices_count);
+}
 
-	tex2_t* texcoords = NULL;
+typedef struct {
+	grid_t grid;
+	float half_width;
+	float half_height;
+	float segment_width;
+	float segment_height;
+} plane_grid_t;
+
+static void make_plane_vertex(grid_t* grid, int ix, int iy, vec3_t* vertex, vec3_t* normal) {
+	plane_grid_t* plane = (plane_grid_t*)grid;
+	float x = (float)ix * plane->segment_width - plane->half_width;
+	float y = (float)iy * plane->segment_height - plane->half_height;
+	vertex->x = -x;
+	vertex->y = -y;
+	vertex->z = 0;
+	*normal = vec3_new(0, 0, 1);
+}
 
-	tex2_t uv;
+static tex2_t get_plane_uv(grid_t* grid, int ix, int iy) {
+	return (tex2_t){
+		.u = 1 - (float)ix / grid->columns,
+		.v = 1 - (float)iy / grid->rows
+	};
+}
 
-	for (int iy = 0; iy <= height_segments; iy++) {
-		float v = (float)iy / (float)height_segments;
-		float u_offset = 0;
+void make_plane_geometry(
+	mesh_t *mesh,
+	float width,
+	float height,
+	int width_segments,
+	int height_segments
+) {
+	float parameters[] = { width, height, width_segments, height_segments };
+	if (acquire_cached_geometry(mesh, GEOMETRY_PLANE, parameters, 4)) {
+		return;
+	}
+	plane_grid_t plane = {
+		.grid = {
+			.mesh = mesh,
+			.columns = width_segments,
+			.rows = height_segments,
+			.make_vertex = make_plane_vertex,
+			.get_uv = get_plane_uv
+		},
+		.half_width = width / 2,
+		.half_height = height / 2,
+		.segment_width = width / (float)width_segments,
+		.segment_height = height / (float)height_segments
+	};
+	alloc_geometry(mesh, get_grid_vertices_count(&plane.grid), get_grid_faces_count(&plane.grid));
+	fill_grid(&plane.grid);
+	insert_cached_geometry(mesh, GEOMETRY_PLANE, parameters, 4);
+}
 
-		if (iy == 0 && theta_start == 0) {
-			u_offset = 0.5 / (float)(width_segments);
-		} else if (iy == height_segments && M_PI - theta_end < 0.001) {
-			u_offset = -0.5 / (float)(width_segments);
-		}
+typedef struct {
+	grid_t grid;
+	float radius;
+	float phi_start;
+	float phi_length;
+	float theta_start;
+	float theta_length;
+	float theta_end;
+} sphere_grid_t;
+
+static void make_sphere_vertex(grid_t* grid, int ix, int iy, vec3_t* vertex, vec3_t* normal) {
+	sphere_grid_t* sphere = (sphere_grid_t*)grid;
+	float u = (float)ix / (float)grid->columns;
+	float v = (float)iy / (float)grid->rows;
+	vertex->x = -sphere->radius * cos(sphere->phi_start + u * sphere->phi_length) * sin(sphere->theta_start + v * sphere->theta_length);
+	vertex->y = sphere->radius * cos(sphere->theta_start + v * sphere->theta_length);
+	vertex->z = sphere->radius * sin(sphere->phi_start + u * sphere->phi_length) * sin(sphere->theta_start + v * sphere->theta_length);
+	*normal = vec3_clone(vertex);
+	vec3_normalize(normal);
+}
 
-		for (int ix = 0; ix <= width_segments; ix++) {
-			float u = (float)ix / (float)width_segments;
-			vec3_t vertex;
-			vertex.x = -radius * cos(phi_start + u * phi_length) * sin(theta_start + v * theta_length);
-			vertex.y = radius * cos(theta_start + v * theta_length);
-			vertex.z = radius * sin(phi_start + u * phi_length) * sin(theta_start + v * theta_length);
-			array_push(mesh->vertices, vertex);
+static tex2_t get_sphere_uv(grid_t* grid, int ix, int iy) {
+	sphere_grid_t* sphere = (sphere_grid_t*)grid;
+	float u = (float)ix / (float)grid->columns;
+	float v = (float)iy / (float)grid->rows;
+	float u_offset = 0;
+	if (iy == 0 && sphere->theta_start == 0) {
+		u_offset = 0.5 / (float)(grid->columns);
+	} else if (iy == grid->rows && M_PI - sphere->theta_end < 0.001) {
+		u_offset = -0.5 / (float)(grid->columns);
+	}
+	return (tex2_t){
+		.u = 1 - (u + u_offset),
+		.v = 1 - v
+	};
+}
 
-			vec3_t normal = vec3_clone(&vertex);
-			vec3_normalize(&normal);
-			array_push(mesh->normals, normal);
+// the rows touching a pole drop the triangle that would collapse onto it
+static inline bool has_sphere_top_face(sphere_grid_t* sphere, int iy) {
+	return iy != 0 || sphere->theta_start > 0;
+}
 
-			uv.u = 1 - (u + u_offset);
-			uv.v = 1 - v;
-			array_push(texcoords, uv);
+static inline bool has_sphere_bottom_face(sphere_grid_t* sphere, int iy) {
+	return iy != sphere->grid.rows - 1 || sphere->theta_end < M_PI;
+}
 
-			grid[iy][ix] = index++;
-		}
+static int get_sphere_faces_before_row(sphere_grid_t* sphere, int iy) {
+	// only the first and the last row can be short
+	int faces_count = iy * sphere->grid.columns * 2;
+	if (iy > 0 && !has_sphere_top_face(sphere, 0)) {
+		faces_count -= sphere->grid.columns;
+	}
+	if (iy > sphere->grid.rows - 1 && !has_sphere_bottom_face(sphere, sphere->grid.rows - 1)) {
+		faces_count -= sphere->grid.columns;
 	}
+	return faces_count;
+}
 
-	for (int iy = 0; iy < height_segments; iy++) {
-		for (int ix = 0; ix < width_segments; ix++) {
-
-			int a = grid[iy][ix + 1];
-			int b = grid[iy][ix];
-			int c = grid[iy + 1][ix];
-			int d = grid[iy + 1][ix + 1];
-
-			face_t face;
-
-			if (iy != 0 || theta_start > 0) {
-				face.a = a;
-				face.b = b;
-				face.c = d;
-				face.a_uv = texcoords[a];
-				face.b_uv = texcoords[b];
-				face.c_uv = texcoords[d];
-				face.color = MESH_DEBUG_COLOR;
-				array_push(mesh->faces, face);
+static void fill_sphere_faces(void* generator, int first_row, int last_row) {
+	sphere_grid_t* sphere = generator;
+	grid_t* grid = &sphere->grid;
+	for (int iy = first_row; iy < last_row; iy++) {
+		face_t* face = &grid->mesh->faces[get_sphere_faces_before_row(sphere, iy)];
+		bool has_top_face = has_sphere_top_face(sphere, iy);
+		bool has_bottom_face = has_sphere_bottom_face(sphere, iy);
+		for (int ix = 0; ix < grid->columns; ix++) {
+			int a = get_grid_vertex(grid, ix + 1, iy);
+			int b = get_grid_vertex(grid, ix, iy);
+			int c = get_grid_vertex(grid, ix, iy + 1);
+			int d = get_grid_vertex(grid, ix + 1, iy + 1);
+
+			if (has_top_face) {
+				*face++ = (face_t){
+					.a = a,
+					.b = b,
+					.c = d,
+					.a_uv = get_sphere_uv(grid, ix + 1, iy),
+					.b_uv = get_sphere_uv(grid, ix, iy),
+					.c_uv = get_sphere_uv(grid, ix + 1, iy + 1),
+					.color = MESH_DEBUG_COLOR
+				};
 			}
 
-			if (iy != height_segments - 1 || theta_end < M_PI) {
-				face.a = b;
-				face.b = c;
-				face.c = d;
-				face.a_uv = texcoords[b];
-				face.b_uv = texcoords[c];
-				face.c_uv = texcoords[d];
-				face.color = MESH_DEBUG_COLOR;
-				array_push(mesh->faces, face);
+			if (has_bottom_face) {
+				*face++ = (face_t){
+					.a = b,
+					.b = c,
+					.c = d,
+					.a_uv = get_sphere_uv(grid, ix, iy),
+					.b_uv = get_sphere_uv(grid, ix, iy + 1),
+					.c_uv = get_sphere_uv(grid, ix + 1, iy + 1),
+					.color = MESH_DEBUG_COLOR
+				};
 			}
 		}
 	}
+}
 
-	array_free(texcoords);
+void make_sphere_geometry(
+	mesh_t *mesh,
+	float radius,
+	int width_segments,
+	int height_segments,
+	float phi_start,
+	float phi_length,
+	float theta_start,
+	float theta_length
+) {
+	float parameters[] = { radius, width_segments, height_segments, phi_start, phi_length, theta_start, theta_length };
+	if (acquire_cached_geometry(mesh, GEOMETRY_SPHERE, parameters, 7)) {
+		return;
+	}
+	sphere_grid_t sphere = {
+		.grid = {
+			.mesh = mesh,
+			.columns = MAX(3, width_segments),
+			.rows = MAX(2, height_segments),
+			.make_vertex = make_sphere_vertex,
+			.get_uv = get_sphere_uv
+		},
+		.radius = radius,
+		.phi_start = phi_start,
+		.phi_length = phi_length,
+		.theta_start = theta_start,
+		.theta_length = theta_length,
+		.theta_end = MIN(theta_start + theta_length, M_PI)
+	};
+	int vertices_count = get_grid_vertices_count(&sphere.grid);
+	alloc_geometry(mesh, vertices_count, get_sphere_faces_before_row(&sphere, sphere.grid.rows));
+	fill_geometry_rows(fill_grid_vertices, &sphere, sphere.grid.rows + 1, vertices_count);
+	fill_geometry_rows(fill_sphere_faces, &sphere, sphere.grid.rows, vertices_count);
+	insert_cached_geometry(mesh, GEOMETRY_SPHERE, parameters, 7);
 }
 
 typedef enum {
@@ -179,7 +433,46 @@ typedef enum {
 	XYZ
 } plane_xyz_arrangement;
 
-void build_plane(
+typedef struct {
+	grid_t grid;
+	int xyz_arrangement;
+	float udir;
+	float vdir;
+	float segment_width;
+	float segment_height;
+	float half_width;
+	float half_height;
+	float half_depth;
+} box_side_grid_t;
+
+static void make_box_side_vertex(grid_t* grid, int ix, int iy, vec3_t* vertex, vec3_t* normal) {
+	box_side_grid_t* side = (box_side_grid_t*)grid;
+	float x = (float)ix * side->segment_width - side->half_width;
+	float y = (float)iy * side->segment_height - side->half_height;
+	if (side->xyz_arrangement == ZYX) {
+		vertex->z = x * side->udir;
+		vertex->y = y * side->vdir;
+		vertex->x = side->half_depth;
+	} else if (side->xyz_arrangement == XZY) {
+		vertex->x = x * side->udir;
+		vertex->z = y * side->vdir;
+		vertex->y = side->half_depth;
+	} else if (side->xyz_arrangement == XYZ) {
+		vertex->x = x * side->udir;
+		vertex->y = y * side->vdir;
+		vertex->z = side->half_depth;
+	}
+	*normal = *vertex;
+}
+
+static tex2_t get_box_side_uv(grid_t* grid, int ix, int iy) {
+	return (tex2_t){
+		.u = 1 - (float)ix / (float)grid->columns,
+		.v = 1 - ((float)iy / (float)grid->rows)
+	};
+}
+
+static box_side_grid_t make_box_side(
 	int xyz_arrangement,
 	float udir,
 	float vdir,
@@ -187,98 +480,24 @@ void build_plane(
 	float height,
 	float depth,
 	int grid_x,
-	int grid_y,
-	int* vertices_count,
-	mesh_t* mesh
+	int grid_y
 ) {
-	float segment_width = width / (float)grid_x;
-	float segment_height = height / (float)grid_y;
-
-	float half_width = width / 2;
-	float half_height = height / 2;
-	float half_depth = depth / 2;
-
-	int grid_x1 = grid_x + 1;
-	int grid_y1 = grid_y + 1;
-	int vertex_counter = 0;
-
-	vec3_t vertex;
-	tex2_t uv;
-	
-	tex2_t* texcoords = NULL;
-
-	for (int iy = 0; iy < grid_y1; iy++) {
-		
-		float y = (float)iy * segment_height - half_height;
-
-		for (int ix = 0; ix < grid_x1; ix++) {
-			float x = (float)ix * segment_width - half_width;
-			if (xyz_arrangement == ZYX) {
-				vertex.z = x * udir;
-				vertex.y = y * vdir;
-				vertex.x = half_depth;
-			} else if (xyz_arrangement == XZY) {
-				vertex.x = x * udir;
-				vertex.z = y * vdir;
-				vertex.y = half_depth;
-			} else if (xyz_arrangement == XYZ) {
-				vertex.x = x * udir;
-				vertex.y = y * vdir;
-				vertex.z = half_depth;
-			}
-			array_push(mesh->normals, vertex);
-			array_push(mesh->vertices, vertex);
-			
-			uv.u = 1 - (float)ix / (float)grid_x;
-			uv.v = 1 - ((float)iy / (float)grid_y);
-
-			array_push(texcoords, uv);
-
-			vertex_counter++;
-
-		}
-	}
-
-	for (int iy = 0; iy < grid_y; iy++) {
-
-		for (int ix = 0; ix < grid_x; ix++) {
-			int a = ix + grid_x1 * iy;
-			int b = ix + grid_x1 * (iy + 1);
-			int c = (ix + 1) + grid_x1 * (iy + 1);
-			int d = (ix + 1) + grid_x1 * iy;
-
-			// faces
-
-			face_t face_a = {
-				.a = *vertices_count + a,
-				.b = *vertices_count + b,
-				.c = *vertices_count + d,
-				.a_uv = texcoords[a],
-				.b_uv = texcoords[b],
-				.c_uv = texcoords[d],
-				.color = MESH_DEBUG_COLOR
-			};
-			array_push(mesh->faces, face_a);
-
-			face_t face_b = {
-				.a = *vertices_count + b,
-				.b = *vertices_count + c,
-				.c = *vertices_count + d,
-				.a_uv = texcoords[b],
-				.b_uv = texcoords[c],
-				.c_uv = texcoords[d],
-				.color = MESH_DEBUG_COLOR
-			};
-			array_push(mesh->faces, face_b);
-
-		}
-	}
-
-	*vertices_count += vertex_counter;
-	mesh->vertices_count = vertex_counter;
-
-	array_free(texcoords);
-
+	return (box_side_grid_t){
+		.grid = {
+			.columns = grid_x,
+			.rows = grid_y,
+			.make_vertex = make_box_side_vertex,
+			.get_uv = get_box_side_uv
+		},
+		.xyz_arrangement = xyz_arrangement,
+		.udir = udir,
+		.vdir = vdir,
+		.segment_width = width / (float)grid_x,
+		.segment_height = height / (float)grid_y,
+		.half_width = width / 2,
+		.half_height = height / 2,
+		.half_depth = depth / 2
+	};
 }
 
 void make_box_geometry(
@@ -290,14 +509,59 @@ void make_box_geometry(
 	int height_segments,
 	int depth_segments
 ) {
+	float parameters[] = { width, height, depth, width_segments, height_segments, depth_segments };
+	if (acquire_cached_geometry(mesh, GEOMETRY_BOX, parameters, 6)) {
+		return;
+	}
+	box_side_grid_t sides[] = {
+		make_box_side(ZYX, -1, -1, depth, height, width, depth_segments, height_segments),
+		make_box_side(ZYX, 1, -1, depth, height, - width, depth_segments, height_segments),
+		make_box_side(XZY, 1, 1, width, depth, height, width_segments, depth_segments),
+		make_box_side(XZY, 1, -1, width, depth, - height, width_segments, depth_segments),
+		make_box_side(XYZ, 1, -1, width, height, depth, width_segments, height_segments),
+		make_box_side(XYZ, -1, -1, width, height, - depth, width_segments, height_segments)
+	};
 	int vertices_count = 0;
-	build_plane(ZYX, -1, -1, depth, height, width, depth_segments, height_segments, &vertices_count, mesh);
-	build_plane(ZYX, 1, -1, depth, height, - width, depth_segments, height_segments, &vertices_count, mesh);
-	build_plane(XZY, 1, 1, width, depth, height, width_segments, depth_segments, &vertices_count, mesh);
-	build_plane(XZY, 1, -1, width, depth, - height, width_segments, depth_segments, &vertices_count, mesh);
-	build_plane(XYZ, 1, -1, width, height, depth, width_segments, height_segments, &vertices_count, mesh);
-	build_plane(XYZ, -1, -1, width, height, - depth, width_segments, height_segments, &vertices_count, mesh);
-	mesh->vertices_count = vertices_count;
+	int faces_count = 0;
+	for (int i = 0; i < 6; i++) {
+		sides[i].grid.mesh = mesh;
+		sides[i].grid.first_vertex = vertices_count;
+		sides[i].grid.first_face = faces_count;
+		vertices_count += get_grid_vertices_count(&sides[i].grid);
+		faces_count += get_grid_faces_count(&sides[i].grid);
+	}
+	alloc_geometry(mesh, vertices_count, faces_count);
+	for (int i = 0; i < 6; i++) {
+		fill_grid(&sides[i].grid);
+	}
+	insert_cached_geometry(mesh, GEOMETRY_BOX, parameters, 6);
+}
+
+typedef struct {
+	grid_t grid;
+	float outer_radius;
+	float theta_start;
+	float theta_length;
+	// one per row, summed up step by step
+	float* radii;
+} ring_grid_t;
+
+static void make_ring_vertex(grid_t* grid, int ix, int iy, vec3_t* vertex, vec3_t* normal) {
+	ring_grid_t* ring = (ring_grid_t*)grid;
+	float segment = ring->theta_start + ((float)ix / (float)grid->columns) * ring->theta_length;
+	vertex->x = -ring->radii[iy] * cos(segment);
+	vertex->y = ring->radii[iy] * sin(segment);
+	vertex->z = 0;
+	*normal = vec3_new(0, 0, 1);
+}
+
+static tex2_t get_ring_uv(grid_t* grid, int ix, int iy) {
+	ring_grid_t* ring = (ring_grid_t*)grid;
+	vec3_t vertex = grid->mesh->vertices[get_grid_vertex(grid, ix, iy)];
+	return (tex2_t){
+		.u = (vertex.x / ring->outer_radius + 1) / 2,
+		.v = (vertex.y / ring->outer_radius + 1) / 2
+	};
 }
 
 void make_ring_geometry(
@@ -309,74 +573,69 @@ void make_ring_geometry(
 	float theta_start,
 	float theta_length
 ) {
-	tex2_t* texcoords = NULL;
-
+	float parameters[] = { inner_radius, outer_radius, theta_segments, phi_segments, theta_start, theta_length };
+	if (acquire_cached_geometry(mesh, GEOMETRY_RING, parameters, 6)) {
+		return;
+	}
 	theta_segments = MAX(3, theta_segments);
 	phi_segments = MAX(1, phi_segments);
 
 	float radius = inner_radius;
 	float radius_step = (outer_radius - inner_radius) / (float)phi_segments;
-
-	vec3_t vertex;
-	tex2_t uv;
-
-	int vertices_count = 0;
-
+	float* radii = malloc(sizeof(float) * (phi_segments + 1));
 	for (int j = 0; j <= phi_segments; j++) {
-		for (int i = 0; i <= theta_segments; i++) {
-			float segment = theta_start + ((float)i / (float)theta_segments) * theta_length;
-			vertex.x = -radius * cos(segment);
-			vertex.y = radius * sin(segment);
-			vertex.z = 0;
+		radii[j] = radius;
+		radius += radius_step;
+	}
 
-			array_push(mesh->vertices, vertex);
-			vertices_count++;
+	ring_grid_t ring = {
+		.grid = {
+			.mesh = mesh,
+			.columns = theta_segments,
+			.rows = phi_segments,
+			.make_vertex = make_ring_vertex,
+			.get_uv = get_ring_uv
+		},
+		.outer_radius = outer_radius,
+		.theta_start = theta_start,
+		.theta_length = theta_length,
+		.radii = radii
+	};
+	alloc_geometry(mesh, get_grid_vertices_count(&ring.grid), get_grid_faces_count(&ring.grid));
+	fill_grid(&ring.grid);
+	free(radii);
+	insert_cached_geometry(mesh, GEOMETRY_RING, parameters, 6);
+}
 
-			array_push(mesh->normals, vec3_new(0, 0, 1));
+typedef struct {
+	grid_t grid;
+	float radius;
+	float tube;
+	float arc;
+} torus_grid_t;
 
-			uv.u = (vertex.x / outer_radius + 1) / 2;
-			uv.v = (vertex.y / outer_radius + 1) / 2;
-			array_push(texcoords, uv);
-			printf("UV: %f %f\n", uv.u, uv.v);
-		}
-		radius += radius_step;
-	}
+static void make_torus_vertex(grid_t* grid, int ix, int iy, vec3_t* vertex, vec3_t* normal) {
+	torus_grid_t* torus = (torus_grid_t*)grid;
+	float u = (float)ix / (float)grid->columns * torus->arc;
+	float v = (float)iy / (float)grid->rows * M_PI * 2;
 
-	for (int j = 0; j < phi_segments; j++) {
-		int theta_segment_level = j * (theta_segments + 1);
+	vertex->x = (torus->radius + torus->tube * cos(v)) * cos(u);
+	vertex->y = (torus->radius + torus->tube * cos(v)) * sin(u);
+	vertex->z = torus->tube * sin(v);
 
-		for (int i = 0; i < theta_segments; i++) {
-			int segment = i + theta_segment_level;
-			int a = segment;
-			int b = segment + theta_segments + 1;
-			int c = segment + theta_segments + 2;
-			int d = segment + 1;
+	float center_x = cos(u) * torus->radius;
+	float center_y = sin(u) * torus->radius;
 
-			face_t face_a = {
-				.a = a,
-				.b = b,
-				.c = d,
-				.a_uv = texcoords[a],
-				.b_uv = texcoords[b],
-				.c_uv = texcoords[d],
-				.color = MESH_DEBUG_COLOR
-			};
-			array_push(mesh->faces, face_a);
+	normal->x = vertex->x - center_x;
+	normal->y = vertex->y - center_y;
+	normal->z = vertex->z;
+}
 
-			face_t face_b = {
-				.a = b,
-				.b = c,
-				.c = d,
-				.a_uv = texcoords[b],
-				.b_uv = texcoords[c],
-				.c_uv = texcoords[d],
-				.color = MESH_DEBUG_COLOR
-			};
-			array_push(mesh->faces, face_b);
-		}
-	}
-	mesh->vertices_count = vertices_count;
-	array_free(texcoords);
+static tex2_t get_torus_uv(grid_t* grid, int ix, int iy) {
+	return (tex2_t){
+		.u = 1 - ix / (float)grid->columns,
+		.v = iy / (float)grid->rows
+	};
 }
 
 void make_torus_geometry(
@@ -387,72 +646,24 @@ void make_torus_geometry(
 	int tubular_segments,
 	float arc
 ) {
-	tex2_t *texcoords = NULL;
-
-	vec3_t vertex;
-	vec3_t normal;
-	tex2_t uv;
-
-	int vertices_count = 0;
-
-	for (int j = 0; j <= radial_segments; j++) {
-		for (int i = 0; i <= tubular_segments; i++) {
-			float u = (float)i / (float)tubular_segments * arc;
-			float v = (float)j / (float)radial_segments * M_PI * 2;
-
-			vertex.x = (radius + tube * cos(v)) * cos(u);
-			vertex.y = (radius + tube * cos(v)) * sin(u);
-			vertex.z = tube * sin(v);
-
-			array_push(mesh->vertices, vertex);
-			vertices_count++;
-
-			float center_x = cos(u) * radius;
-			float center_y = sin(u) * radius;
-
-			normal.x = vertex.x - center_x;
-			normal.y = vertex.y - center_y;
-			normal.z = vertex.z;
-			array_push(mesh->normals, normal);
-
-			uv.u = 1 - i / (float)tubular_segments;
-			uv.v = j / (float)radial_segments;
-			array_push(texcoords, uv);
-		}
-	}
-
-	for (int j = 1; j <= radial_segments; j++) {
-		for (int i = 1; i <= tubular_segments; i++) {
-			int a = (tubular_segments + 1) * j + i - 1;
-			int b = (tubular_segments + 1) * (j - 1) + i - 1;
-			int c = (tubular_segments + 1) * (j - 1) + i;
-			int d = (tubular_segments + 1) * j + i;
-
-			face_t face_a = {
-				.a = a,
-				.b = b,
-				.c = d,
-				.a_uv = texcoords[a],
-				.b_uv = texcoords[b],
-				.c_uv = texcoords[d],
-				.color = MESH_DEBUG_COLOR
-			};
-			array_push(mesh->faces, face_a);
-
-			face_t face_b = {
-				.a = b,
-				.b = c,
-				.c = d,
-				.a_uv = texcoords[b],
-				.b_uv = texcoords[c],
-				.c_uv = texcoords[d],
-				.color = MESH_DEBUG_COLOR
-			};
-			array_push(mesh->faces, face_b);
-		}
-
+	float parameters[] = { radius, tube, radial_segments, tubular_segments, arc };
+	if (acquire_cached_geometry(mesh, GEOMETRY_TORUS, parameters, 5)) {
+		return;
 	}
-
-	mesh->vertices_count = vertices_count;
-
-}
\ No newline at end of file
+	torus_grid_t torus = {
+		.grid = {
+			.mesh = mesh,
+			.columns = tubular_segments,
+			.rows = radial_segments,
+			.is_winding_flipped = true,
+			.make_vertex = make_torus_vertex,
+			.get_uv = get_torus_uv
+		},
+		.radius = radius,
+		.tube = tube,
+		.arc = arc
+	};
+	alloc_geometry(mesh, get_grid_vertices_count(&torus.grid), get_grid_faces_count(&torus.grid));
+	fill_grid(&torus.grid);
+	insert_cached_geometry(mesh, GEOMETRY_TORUS, parameters, 5);
+}
@@ -3,6 +3,9 @@
 
 #include "mesh.h"
 
+// The generators fill exactly sized arrays, rows split over threads for large
+// segment counts. Results are cached by generator and parameters, so meshes
+// made with the same ones share one read only copy
 void make_plane_geometry(
 	mesh_t *mesh,
 	float width,
@@ -51,4 +54,10 @@ void make_torus_geometry(
 	float arc
 );
 
+// Whether the mesh arrays belong to the geometry cache
+bool is_cached_geometry(mesh_t* mesh);
+// Drops the mesh's reference to cached geometry, the last one frees it. False
+// when the arrays do not come from the cache
+bool release_cached_geometry(mesh_t* mesh);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "array.h"
+#include "utils.h"
+#include "json.h"
+#include "gltf.h"
+
+#define GLB_HEADER_SIZE 12
+#define GLB_CHUNK_HEADER_SIZE 8
+#define GLTF_MODE_TRIANGLES 4
+
+enum gltf_component_type {
+	GLTF_UNSIGNED_BYTE = 5121,
+	GLTF_UNSIGNED_SHORT = 5123,
+	GLTF_UNSIGNED_INT = 5125,
+	GLTF_FLOAT = 5126
+};
+
+typedef struct {
+	json_document_t json;
+	const uint8_t* bin;
+	size_t bin_size;
+} gltf_t;
+
+// Where the elements of an accessor live in the BIN chunk, bounds checked
+typedef struct {
+	const uint8_t* data;
+	int count;
+	int stride;
+	int component_type;
+	int components_count;
+	bool is_normalized;
+} gltf_accessor_t;
+
+typedef struct {
+	gltf_accessor_t positions;
+	gltf_accessor_t normals;
+	gltf_accessor_t texcoords;
+	gltf_accessor_t indices;
+	bool has_normals;
+	bool has_texcoords;
+	bool has_indices;
+} gltf_primitive_t;
+
+static int get_gltf_component_size(int component_type) {
+	switch (component_type) {
+		case GLTF_UNSIGNED_BYTE:
+			return 1;
+		case GLTF_UNSIGNED_SHORT:
+			return 2;
+		case GLTF_UNSIGNED_INT:
+		case GLTF_FLOAT:
+			return 4;
+		default:
+			return 0;
+	}
+}
+
+static int get_gltf_components_count(json_document_t* json, int type) {
+	char* types[] = { "SCALAR", "VEC2", "VEC3", "VEC4" };
+	for (int i = 0; i < 4; i++) {
+		if (is_json_string(json, type, types[i])) {
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+static int get_gltf_int(json_document_t* json, int object, const char* key, int fallback) {
+	double value = get_json_number(json, get_json_member(json, object, key), fallback);
+	return value >= INT32_MIN && value <= INT32_MAX ? (int)value : fallback;
+}
+
+// Resolves an accessor to its bytes in the BIN chunk. Sparse accessors and
+// buffers other than the BIN chunk are not supported
+static bool get_gltf_accessor(gltf_t* gltf, int index, gltf_accessor_t* accessor) {
+	json_document_t* json = &gltf->json;
+	int accessor_token = get_json_item(json, get_json_member(json, 0, "accessors"), index);
+	int view_token = get_json_item(json, get_json_member(json, 0, "bufferViews"), get_gltf_int(json, accessor_token, "bufferView", -1));
+	if (accessor_token == -1 || view_token == -1 || get_gltf_int(json, view_token, "buffer", -1) != 0) {
+		return false;
+	}
+	accessor->count = get_gltf_int(json, accessor_token, "count", -1);
+	accessor->component_type = get_gltf_int(json, accessor_token, "componentType", -1);
+	accessor->components_count = get_gltf_components_count(json, get_json_member(json, accessor_token, "type"));
+	accessor->is_normalized = get_json_bool(json, get_json_member(json, accessor_token, "normalized"), false);
+	int element_size = get_gltf_component_size(accessor->component_type) * accessor->components_count;
+	accessor->stride = get_gltf_int(json, view_token, "byteStride", element_size);
+	int view_offset = get_gltf_int(json, view_token, "byteOffset", 0);
+	int view_length = get_gltf_int(json, view_token, "byteLength", -1);
+	int offset = get_gltf_int(json, accessor_token, "byteOffset", 0);
+	if (accessor->count <= 0 || element_size == 0 || accessor->stride < element_size || view_offset < 0 || view_length < 0 || offset < 0) {
+		return false;
+	}
+	// the last element has to end inside both the view and the chunk
+	uint64_t end = (uint64_t)offset + (uint64_t)accessor->stride * (accessor->count - 1) + element_size;
+	if (end > (uint64_t)view_length || (uint64_t)view_offset + view_length > gltf->bin_size) {
+		return false;
+	}
+	accessor->data = gltf->bin + view_offset + offset;
+	return true;
+}
+
+static float read_gltf_component(const uint8_t* data, int component_type, bool is_normalized) {
+	uint16_t u16;
+	float f32;
+	switch (component_type) {
+		case GLTF_UNSIGNED_BYTE:
+			return is_normalized ? *data / 255.0f : *data;
+		case GLTF_UNSIGNED_SHORT:
+			memcpy(&u16, data, sizeof(u16));
+			return is_normalized ? u16 / 65535.0f : u16;
+		default:
+			memcpy(&f32, data, sizeof(f32));
+			return f32;
+	}
+}
+
+// Writes count tightly packed elements of accessor->components_count floats
+static void read_gltf_floats(gltf_accessor_t* accessor, float* out) {
+	int components_count = accessor->components_count;
+	size_t element_size = sizeof(float) * components_count;
+	if (accessor->component_type == GLTF_FLOAT && accessor->stride == (int)element_size) {
+		memcpy(out, accessor->data, element_size * accessor->count);
+		return;
+	}
+	int component_size = get_gltf_component_size(accessor->component_type);
+	for (int i = 0; i < accessor->count; i++) {
+		const uint8_t* element = accessor->data + (size_t)accessor->stride * i;
+		for (int j = 0; j < components_count; j++) {
+			out[i * components_count + j] = read_gltf_component(element + component_size * j, accessor->component_type, accessor->is_normalized);
+		}
+	}
+}
+
+static bool get_gltf_primitive(gltf_t* gltf, int primitive_token, gltf_primitive_t* primitive) {
+	json_document_t* json = &gltf->json;
+	int attributes = get_json_member(json, primitive_token, "attributes");
+	int normals = get_json_member(json, attributes, "NORMAL");
+	int texcoords = get_json_member(json, attributes, "TEXCOORD_0");
+	int indices = get_json_member(json, primitive_token, "indices");
+	primitive->has_normals = normals != -1;
+	primitive->has_texcoords = texcoords != -1;
+	primitive->has_indices = indices != -1;
+
+	gltf_accessor_t* positions = &primitive->positions;
+	bool is_valid = get_gltf_accessor(gltf, get_gltf_int(json, attributes, "POSITION", -1), positions) &&
+		positions->component_type == GLTF_FLOAT && positions->components_count == 3;
+	if (is_valid && primitive->has_normals) {
+		gltf_accessor_t* accessor = &primitive->normals;
+		is_valid = get_gltf_accessor(gltf, get_gltf_int(json, attributes, "NORMAL", -1), accessor) &&
+			accessor->component_type == GLTF_FLOAT && accessor->components_count == 3 &&
+			accessor->count == positions->count;
+	}
+	if (is_valid && primitive->has_texcoords) {
+		gltf_accessor_t* accessor = &primitive->texcoords;
+		is_valid = get_gltf_accessor(gltf, get_gltf_int(json, attributes, "TEXCOORD_0", -1), accessor) &&
+			accessor->component_type != GLTF_UNSIGNED_INT && accessor->components_count == 2 &&
+			accessor->count == positions->count;
+	}
+	if (is_valid && primitive->has_indices) {
+		gltf_accessor_t* accessor = &primitive->indices;
+		is_valid = get_gltf_accessor(gltf, get_gltf_int(json, primitive_token, "indices", -1), accessor) &&
+			accessor->component_type != GLTF_FLOAT && accessor->components_count == 1 &&
+			accessor->count % 3 == 0;
+	} else if (is_valid) {
+		is_valid = positions->count % 3 == 0;
+	}
+	return is_valid;
+}
+
+static uint32_t read_gltf_index(gltf_primitive_t* primitive, int i) {
+	if (!primitive->has_indices) {
+		return i;
+	}
+	gltf_accessor_t* indices = &primitive->indices;
+	const uint8_t* data = indices->data + (size_t)indices->stride * i;
+	uint16_t u16;
+	uint32_t u32;
+	switch (indices->component_type) {
+		case GLTF_UNSIGNED_BYTE:
+			return *data;
+		case GLTF_UNSIGNED_SHORT:
+			memcpy(&u16, data, sizeof(u16));
+			return u16;
+		default:
+			memcpy(&u32, data, sizeof(u32));
+			return u32;
+	}
+}
+
+// Base color texture of a material when it is a PNG inside the BIN chunk
+static texture_2d_t* load_gltf_texture(gltf_t* gltf, int material_index, char* name) {
+	json_document_t* json = &gltf->json;
+	int material = get_json_item(json, get_json_member(json, 0, "materials"), material_index);
+	int base_color = get_json_member(json, get_json_member(json, material, "pbrMetallicRoughness"), "baseColorTexture");
+	int texture = get_json_item(json, get_json_member(json, 0, "textures"), get_gltf_int(json, base_color, "index", -1));
+	int image = get_json_item(json, get_json_member(json, 0, "images"), get_gltf_int(json, texture, "source", -1));
+	int view = get_json_item(json, get_json_member(json, 0, "bufferViews"), get_gltf_int(json, image, "bufferView", -1));
+	if (view == -1 || !is_json_string(json, get_json_member(json, image, "mimeType"), "image/png")) {
+		return NULL;
+	}
+	int offset = get_gltf_int(json, view, "byteOffset", 0);
+	int length = get_gltf_int(json, view, "byteLength", -1);
+	if (get_gltf_int(json, view, "buffer", -1) != 0 || offset < 0 || length <= 0 || (uint64_t)offset + length > gltf->bin_size) {
+		return NULL;
+	}
+	return load_png_bytes(gltf->bin + offset, length, name);
+}
+
+static bool read_glb_chunks(gltf_t* gltf, const uint8_t* data, size_t size) {
+	uint32_t header[3];
+	if (size < GLB_HEADER_SIZE + GLB_CHUNK_HEADER_SIZE) {
+		return false;
+	}
+	memcpy(header, data, sizeof(header));
+	if (header[0] != GLB_MAGIC || header[1] != GLB_VERSION || header[2] > size) {
+		return false;
+	}
+	size = header[2];
+	const char* json_text = NULL;
+	size_t json_size = 0;
+	gltf->bin = NULL;
+	gltf->bin_size = 0;
+	// the JSON chunk comes first, an optional BIN chunk second, unknown ones are skipped
+	for (size_t offset = GLB_HEADER_SIZE; offset + GLB_CHUNK_HEADER_SIZE <= size;) {
+		uint32_t chunk[2];
+		memcpy(chunk, data + offset, sizeof(chunk));
+		offset += GLB_CHUNK_HEADER_SIZE;
+		if (chunk[0] > size - offset) {
+			return false;
+		}
+		if (chunk[1] == GLB_CHUNK_JSON && json_text == NULL) {
+			json_text = (const char*)data + offset;
+			json_size = chunk[0];
+		} else if (chunk[1] == GLB_CHUNK_BIN && gltf->bin == NULL) {
+			gltf->bin = data + offset;
+			gltf->bin_size = chunk[0];
+		}
+		offset += chunk[0];
+	}
+	return json_text != NULL && parse_json(&gltf->json, json_text, json_size);
+}
+
+bool parse_glb_data(mesh_t* mesh, const uint8_t* data, size_t size, char* name) {
+	gltf_t gltf;
+	if (!read_glb_chunks(&gltf, data, size)) {
+		printf("%s is not a valid glTF binary\n", name);
+		return false;
+	}
+	json_document_t* json = &gltf.json;
+	int mesh_token = get_json_item(json, get_json_member(json, 0, "meshes"), 0);
+	int primitives_token = get_json_member(json, mesh_token, "primitives");
+
+	// size everything up front so the arrays are allocated once, the primitives
+	// and texture coordinates only live until the mesh is filled
+	int primitives_count = get_json_length(json, primitives_token);
+	arena_t scratch;
+	init_arena(&scratch, ARRAY_HEADER_SIZE + sizeof(gltf_primitive_t) * primitives_count);
+	gltf_primitive_t* primitives = array_make(&scratch, primitives_count, sizeof(gltf_primitive_t));
+	int max_primitive_vertices_count = 0;
+	int vertices_count = 0;
+	int faces_count = 0;
+	int first_material = -1;
+	bool is_valid = true;
+	for (int i = 0; i < primitives_count && is_valid; i++) {
+		int primitive_token = get_json_item(json, primitives_token, i);
+		if (get_gltf_int(json, primitive_token, "mode", GLTF_MODE_TRIANGLES) != GLTF_MODE_TRIANGLES) {
+			printf("%s: skipping a primitive that is not a triangle list\n", name);
+			continue;
+		}
+		gltf_primitive_t primitive;
+		is_valid = get_gltf_primitive(&gltf, primitive_token, &primitive) &&
+			primitive.positions.count <= INT32_MAX - vertices_count;
+		if (is_valid) {
+			array_push(primitives, primitive);
+			vertices_count += primitive.positions.count;
+			max_primitive_vertices_count = MAX(max_primitive_vertices_count, primitive.positions.count);
+			faces_count += (primitive.has_indices ? primitive.indices.count : primitive.positions.count) / 3;
+			if (first_material == -1) {
+				first_material = get_gltf_int(json, primitive_token, "material", -1);
+			}
+		}
+	}
+	if (!is_valid || array_length(primitives) == 0) {
+		printf("%s has no readable triangles\n", name);
+		free_arena(&scratch);
+		free_json(json);
+		return false;
+	}
+
+	vec3_t* vertices = array_hold(NULL, vertices_count, sizeof(vec3_t));
+	vec3_t* normals = array_hold(NULL, vertices_count, sizeof(vec3_t));
+	face_t* faces = array_hold(NULL, faces_count, sizeof(face_t));
+	memset(normals, 0, sizeof(vec3_t) * vertices_count);
+	tex2_t* texcoords = arena_alloc(&scratch, sizeof(tex2_t) * max_primitive_vertices_count);
+	int first_vertex = 0;
+	int face_index = 0;
+	for (int i = 0; i < array_length(primitives) && is_valid; i++) {
+		gltf_primitive_t* primitive = &primitives[i];
+		int count = primitive->positions.count;
+		read_gltf_floats(&primitive->positions, &vertices[first_vertex].x);
+		if (primitive->has_normals) {
+			read_gltf_floats(&primitive->normals, &normals[first_vertex].x);
+		}
+		if (primitive->has_texcoords) {
+			read_gltf_floats(&primitive->texcoords, &texcoords[0].u);
+			// glTF puts the origin at the top left, the pipeline expects OBJ's bottom left
+			for (int j = 0; j < count; j++) {
+				texcoords[j].v = 1.0f - texcoords[j].v;
+			}
+		} else {
+			memset(texcoords, 0, sizeof(tex2_t) * count);
+		}
+		int corners_count = primitive->has_indices ? primitive->indices.count : count;
+		for (int j = 0; j < corners_count && is_valid; j += 3) {
+			uint32_t a = read_gltf_index(primitive, j);
+			uint32_t b = read_gltf_index(primitive, j + 1);
+			uint32_t c = read_gltf_index(primitive, j + 2);
+			is_valid = a < (uint32_t)count && b < (uint32_t)count && c < (uint32_t)count;
+			if (is_valid) {
+				faces[face_index++] = (face_t){
+					.a = first_vertex + a,
+					.b = first_vertex + b,
+					.c = first_vertex + c,
+					.a_uv = texcoords[a],
+					.b_uv = texcoords[b],
+					.c_uv = texcoords[c],
+					.color = MESH_DEBUG_COLOR
+				};
+			}
+		}
+		first_vertex += count;
+	}
+	free_arena(&scratch);
+	if (!is_valid) {
+		printf("%s has indices out of range\n", name);
+		array_free(vertices);
+		array_free(normals);
+		array_free(faces);
+		free_json(json);
+		return false;
+	}
+
+	mesh->vertices = vertices;
+	mesh->normals = normals;
+	mesh->faces = faces;
+	mesh->vertices_count = vertices_count;
+	texture_2d_t* texture = first_material != -1 ? load_gltf_texture(&gltf, first_material, name) : NULL;
+	if (texture != NULL) {
+		mesh->texture = texture;
+	}
+	free_json(json);
+	return true;
+}
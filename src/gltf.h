@@ -0,0 +1,24 @@
+#ifndef GLTF_H
+#define GLTF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mesh.h"
+
+#define GLB_MAGIC 0x46546c67
+#define GLB_VERSION 2
+#define GLB_CHUNK_JSON 0x4e4f534a
+#define GLB_CHUNK_BIN 0x004e4942
+
+// Reads the triangle primitives of the first mesh in a binary glTF into the
+// vertices, normals and faces of a mesh. Attributes come straight out of the
+// BIN chunk: tightly packed float arrays are copied as one block, anything
+// else element by element. Indices are optional, so are normals (left zero)
+// and TEXCOORD_0. Node transforms, skins and morph targets are not applied.
+//
+// When the first primitive's material has a base color texture embedded as a
+// PNG it is decoded into mesh->texture, which is left untouched otherwise.
+bool parse_glb_data(mesh_t* mesh, const uint8_t* data, size_t size, char* name);
+
+#endif
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "array.h"
+#include "json.h"
+
+// Deep enough for any glTF, shallow enough to keep malicious input off the stack limit
+#define JSON_MAX_DEPTH 64
+#define JSON_MAX_NUMBER_LENGTH 63
+
+typedef struct {
+	const char* text;
+	int size;
+	int position;
+	json_token_t* tokens;
+} json_parser_t;
+
+static void skip_json_spaces(json_parser_t* parser) {
+	while (parser->position < parser->size) {
+		char c = parser->text[parser->position];
+		if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+			return;
+		}
+		parser->position++;
+	}
+}
+
+static int push_json_token(json_parser_t* parser, int type, int start, int end) {
+	json_token_t token = {
+		.type = type,
+		.start = start,
+		.end = end
+	};
+	array_push(parser->tokens, token);
+	return array_length(parser->tokens) - 1;
+}
+
+static bool parse_json_string(json_parser_t* parser) {
+	int start = ++parser->position;
+	while (parser->position < parser->size) {
+		char c = parser->text[parser->position];
+		if (c == '"') {
+			push_json_token(parser, JSON_STRING, start, parser->position++);
+			return true;
+		}
+		// the escaped character can not end the string
+		parser->position += c == '\\' ? 2 : 1;
+	}
+	return false;
+}
+
+static bool parse_json_literal(json_parser_t* parser, const char* literal, int type) {
+	int length = strlen(literal);
+	if (parser->size - parser->position < length || memcmp(parser->text + parser->position, literal, length) != 0) {
+		return false;
+	}
+	push_json_token(parser, type, parser->position, parser->position + length);
+	parser->position += length;
+	return true;
+}
+
+static bool parse_json_number(json_parser_t* parser) {
+	int start = parser->position;
+	// strtod() has the final say once the number is looked up
+	while (parser->position < parser->size) {
+		char c = parser->text[parser->position];
+		if (!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')) {
+			break;
+		}
+		parser->position++;
+	}
+	int length = parser->position - start;
+	if (length == 0 || length > JSON_MAX_NUMBER_LENGTH) {
+		return false;
+	}
+	push_json_token(parser, JSON_NUMBER, start, parser->position);
+	return true;
+}
+
+static bool parse_json_value(json_parser_t* parser, int depth) {
+	skip_json_spaces(parser);
+	if (parser->position >= parser->size || depth > JSON_MAX_DEPTH) {
+		return false;
+	}
+	char c = parser->text[parser->position];
+	if (c == '"') {
+		return parse_json_string(parser);
+	} else if (c == 't' || c == 'f') {
+		return parse_json_literal(parser, c == 't' ? "true" : "false", JSON_BOOL);
+	} else if (c == 'n') {
+		return parse_json_literal(parser, "null", JSON_NULL);
+	} else if (c != '[' && c != '{') {
+		return parse_json_number(parser);
+	}
+
+	bool is_object = c == '{';
+	char closing = is_object ? '}' : ']';
+	int token = push_json_token(parser, is_object ? JSON_OBJECT : JSON_ARRAY, parser->position, 0);
+	int count = 0;
+	parser->position++;
+	skip_json_spaces(parser);
+	if (parser->position < parser->size && parser->text[parser->position] == closing) {
+		parser->position++;
+	} else {
+		while (true) {
+			if (is_object) {
+				skip_json_spaces(parser);
+				if (parser->position >= parser->size || parser->text[parser->position] != '"' || !parse_json_string(parser)) {
+					return false;
+				}
+				skip_json_spaces(parser);
+				if (parser->position >= parser->size || parser->text[parser->position] != ':') {
+					return false;
+				}
+				parser->position++;
+			}
+			if (!parse_json_value(parser, depth + 1)) {
+				return false;
+			}
+			count++;
+			skip_json_spaces(parser);
+			if (parser->position >= parser->size) {
+				return false;
+			}
+			char separator = parser->text[parser->position++];
+			if (separator == closing) {
+				break;
+			} else if (separator != ',') {
+				return false;
+			}
+		}
+	}
+	// the array may have moved while the children were pushed
+	parser->tokens[token].end = parser->position;
+	parser->tokens[token].count = count;
+	return true;
+}
+
+bool parse_json(json_document_t* document, const char* text, size_t size) {
+	json_parser_t parser = {
+		.text = text,
+		.size = (int)size,
+		.tokens = NULL
+	};
+	bool is_valid = size <= INT32_MAX && parse_json_value(&parser, 0);
+	skip_json_spaces(&parser);
+	is_valid = is_valid && parser.position == parser.size;
+	if (!is_valid) {
+		printf("JSON parse error at byte %d\n", parser.position);
+		array_free(parser.tokens);
+		return false;
+	}
+	// children were pushed after their parent, so the next sibling is found by
+	// walking back from the end
+	int tokens_count = array_length(parser.tokens);
+	for (int i = tokens_count - 1; i >= 0; i--) {
+		json_token_t* token = &parser.tokens[i];
+		token->next = i + 1;
+		int children_count = token->type == JSON_OBJECT ? token->count * 2 : token->type == JSON_ARRAY ? token->count : 0;
+		for (int j = 0; j < children_count; j++) {
+			token->next = parser.tokens[token->next].next;
+		}
+	}
+	document->text = text;
+	document->tokens = parser.tokens;
+	return true;
+}
+
+void free_json(json_document_t* document) {
+	array_free(document->tokens);
+	document->tokens = NULL;
+}
+
+static bool is_json_type(json_document_t* document, int token, int type) {
+	return token >= 0 && token < array_length(document->tokens) && document->tokens[token].type == type;
+}
+
+int get_json_member(json_document_t* document, int object, const char* key) {
+	if (!is_json_type(document, object, JSON_OBJECT)) {
+		return -1;
+	}
+	int member = object + 1;
+	for (int i = 0; i < document->tokens[object].count; i++) {
+		int value = member + 1;
+		if (is_json_string(document, member, key)) {
+			return value;
+		}
+		member = document->tokens[value].next;
+	}
+	return -1;
+}
+
+int get_json_item(json_document_t* document, int array, int index) {
+	if (!is_json_type(document, array, JSON_ARRAY) || index < 0 || index >= document->tokens[array].count) {
+		return -1;
+	}
+	int item = array + 1;
+	for (int i = 0; i < index; i++) {
+		item = document->tokens[item].next;
+	}
+	return item;
+}
+
+int get_json_length(json_document_t* document, int array) {
+	return is_json_type(document, array, JSON_ARRAY) ? document->tokens[array].count : 0;
+}
+
+double get_json_number(json_document_t* document, int token, double fallback) {
+	if (!is_json_type(document, token, JSON_NUMBER)) {
+		return fallback;
+	}
+	// the text is not terminated, numbers are short enough to copy out
+	char number[JSON_MAX_NUMBER_LENGTH + 1];
+	int length = document->tokens[token].end - document->tokens[token].start;
+	memcpy(number, document->text + document->tokens[token].start, length);
+	number[length] = '\0';
+	char* end;
+	double value = strtod(number, &end);
+	return end == number + length ? value : fallback;
+}
+
+bool get_json_bool(json_document_t* document, int token, bool fallback) {
+	if (!is_json_type(document, token, JSON_BOOL)) {
+		return fallback;
+	}
+	return document->text[document->tokens[token].start] == 't';
+}
+
+bool is_json_string(json_document_t* document, int token, const char* value) {
+	if (!is_json_type(document, token, JSON_STRING)) {
+		return false;
+	}
+	int length = document->tokens[token].end - document->tokens[token].start;
+	return (int)strlen(value) == length && memcmp(document->text + document->tokens[token].start, value, length) == 0;
+}
@@ -0,0 +1,49 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum json_type {
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT
+};
+
+// One value of the document. Children follow their parent in document order,
+// object members as a key string token followed by the value
+typedef struct {
+	int type;
+	// byte range in the text, without the quotes for strings
+	int start;
+	int end;
+	// items of an array, members of an object
+	int count;
+	// index of the token after this value and all of its children
+	int next;
+} json_token_t;
+
+// Tokens point into the text, which has to outlive the document. Strings are
+// not unescaped
+typedef struct {
+	const char* text;
+	json_token_t* tokens;
+} json_document_t;
+
+// The root is token 0. False for malformed text
+bool parse_json(json_document_t* document, const char* text, size_t size);
+void free_json(json_document_t* document);
+
+// Lookups take and return token indices, -1 when the value is missing or of
+// another type, so they can be chained without checks in between
+int get_json_member(json_document_t* document, int object, const char* key);
+int get_json_item(json_document_t* document, int array, int index);
+int get_json_length(json_document_t* document, int array);
+double get_json_number(json_document_t* document, int token, double fallback);
+bool get_json_bool(json_document_t* document, int token, bool fallback);
+bool is_json_string(json_document_t* document, int token, const char* value);
+
+#endif
@@ -0,0 +1,314 @@
+// strdup() is POSIX, not part of -std=c17
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <SDL2/SDL.h>
+#include "array.h"
+#include "utils.h"
+#include "loader.h"
+
+enum load_job_type {
+	LOAD_JOB_TEXTURE,
+	LOAD_JOB_MESH
+};
+
+typedef struct load_job {
+	int type;
+	char* filename;
+	// owned by the main thread while the job is in flight, workers never read them
+	texture_2d_t*** texture_targets;
+	mesh_t** mesh_targets;
+	// read once when requested, the setting may change while the job is queued
+	bool is_quantized;
+	// written by the worker
+	texture_2d_t* texture;
+	mesh_t parsed_mesh;
+	struct load_job* next;
+} load_job_t;
+
+// jobs handed to process_loaded_assets() but not applied yet, for dedupe
+static load_job_t** jobs_in_flight = NULL;
+
+// keeps the placeholder resident for as long as the loader runs
+static texture_2d_t* placeholder_texture = NULL;
+
+#ifndef __EMSCRIPTEN__
+static SDL_Thread* workers[LOADER_MAX_THREADS];
+static int workers_count = 0;
+
+// FIFO of jobs waiting for a worker; a NULL job tells a worker to exit
+static load_job_t* pending_head = NULL;
+static load_job_t* pending_tail = NULL;
+static SDL_mutex* pending_mutex = NULL;
+static SDL_sem* pending_sem = NULL;
+#endif
+
+static load_job_t* finished_jobs = NULL;
+static SDL_mutex* finished_mutex = NULL;
+
+static void run_load_job(load_job_t* job) {
+	switch (job->type) {
+		case LOAD_JOB_TEXTURE:
+			job->texture = load_texture(job->filename);
+			break;
+		case LOAD_JOB_MESH:
+			load_mesh_data(&job->parsed_mesh, job->filename);
+			if (job->is_quantized) {
+				quantize_mesh(&job->parsed_mesh);
+			}
+			break;
+	}
+}
+
+static void finish_load_job(load_job_t* job) {
+	SDL_LockMutex(finished_mutex);
+	job->next = finished_jobs;
+	finished_jobs = job;
+	SDL_UnlockMutex(finished_mutex);
+}
+
+#ifndef __EMSCRIPTEN__
+static void push_pending_job(load_job_t* job) {
+	SDL_LockMutex(pending_mutex);
+	if (job != NULL) {
+		job->next = NULL;
+		if (pending_tail != NULL) {
+			pending_tail->next = job;
+		} else {
+			pending_head = job;
+		}
+		pending_tail = job;
+	}
+	SDL_UnlockMutex(pending_mutex);
+	SDL_SemPost(pending_sem);
+}
+
+static load_job_t* pop_pending_job(void) {
+	SDL_SemWait(pending_sem);
+	SDL_LockMutex(pending_mutex);
+	load_job_t* job = pending_head;
+	if (job != NULL) {
+		pending_head = job->next;
+		if (pending_head == NULL) {
+			pending_tail = NULL;
+		}
+	}
+	SDL_UnlockMutex(pending_mutex);
+	return job;
+}
+
+static int loader_worker_main(void* data) {
+	for (;;) {
+		load_job_t* job = pop_pending_job();
+		if (job == NULL) {
+			// woken up by free_asset_loader() with nothing left to do
+			return 0;
+		}
+		run_load_job(job);
+		finish_load_job(job);
+	}
+}
+#endif
+
+static void submit_load_job(load_job_t* job) {
+	array_push(jobs_in_flight, job);
+#ifdef __EMSCRIPTEN__
+	run_load_job(job);
+	finish_load_job(job);
+#else
+	push_pending_job(job);
+#endif
+}
+
+static load_job_t* make_load_job(int type, char* filename) {
+	load_job_t* job = calloc(1, sizeof(load_job_t));
+	job->type = type;
+	job->filename = strdup(filename);
+	return job;
+}
+
+void init_asset_loader(void) {
+	finished_mutex = SDL_CreateMutex();
+	placeholder_texture = acquire_placeholder_texture();
+#ifndef __EMSCRIPTEN__
+	pending_mutex = SDL_CreateMutex();
+	pending_sem = SDL_CreateSemaphore(0);
+	// leave one core to the main thread
+	workers_count = CLAMP(1, LOADER_MAX_THREADS, SDL_GetCPUCount() - 1);
+	for (int i = 0; i < workers_count; i++) {
+		workers[i] = SDL_CreateThread(loader_worker_main, "AssetLoader", NULL);
+	}
+#endif
+}
+
+void load_texture_async(char* png_filename, texture_2d_t** target) {
+	texture_2d_t* texture = acquire_cached_texture(png_filename);
+	if (texture != NULL) {
+		*target = texture;
+		return;
+	}
+	*target = acquire_placeholder_texture();
+	for (int i = 0; i < array_length(jobs_in_flight); i++) {
+		load_job_t* job = jobs_in_flight[i];
+		if (job->type == LOAD_JOB_TEXTURE && strcmp(job->filename, png_filename) == 0) {
+			array_push(job->texture_targets, target);
+			return;
+		}
+	}
+	load_job_t* job = make_load_job(LOAD_JOB_TEXTURE, png_filename);
+	array_push(job->texture_targets, target);
+	submit_load_job(job);
+}
+
+void load_mesh_data_async(mesh_t* mesh, char* mesh_filename) {
+	bool is_quantized = is_mesh_quantization_enabled();
+	for (int i = 0; i < array_length(jobs_in_flight); i++) {
+		load_job_t* job = jobs_in_flight[i];
+		if (job->type == LOAD_JOB_MESH && job->is_quantized == is_quantized && strcmp(job->filename, mesh_filename) == 0) {
+			array_push(job->mesh_targets, mesh);
+			return;
+		}
+	}
+	load_job_t* job = make_load_job(LOAD_JOB_MESH, mesh_filename);
+	array_push(job->mesh_targets, mesh);
+	job->is_quantized = is_quantized;
+	submit_load_job(job);
+}
+
+void cancel_mesh_loads(mesh_t* mesh) {
+	for (int i = 0; i < array_length(jobs_in_flight); i++) {
+		load_job_t* job = jobs_in_flight[i];
+		for (int j = array_length(job->mesh_targets) - 1; j >= 0; j--) {
+			if (job->mesh_targets[j] == mesh) {
+				job->mesh_targets[j] = job->mesh_targets[array_length(job->mesh_targets) - 1];
+				array_pop(job->mesh_targets);
+			}
+		}
+		for (int j = array_length(job->texture_targets) - 1; j >= 0; j--) {
+			if (job->texture_targets[j] == &mesh->texture) {
+				job->texture_targets[j] = job->texture_targets[array_length(job->texture_targets) - 1];
+				array_pop(job->texture_targets);
+			}
+		}
+	}
+}
+
+void load_cube_texture_async(texture_cube_t* cube_texture, char* textures_paths[6]) {
+	cube_texture->width = 0;
+	cube_texture->height = 0;
+	for (int i = 0; i < 6; i++) {
+		load_texture_async(textures_paths[i], &cube_texture->face_textures[i]);
+	}
+}
+
+static void apply_load_job(load_job_t* job) {
+	switch (job->type) {
+		case LOAD_JOB_TEXTURE:
+			if (job->texture == NULL) {
+				printf("Could not load texture %s\n", job->filename);
+				break;
+			}
+			insert_cached_texture(job->filename, job->texture);
+			for (int i = 0; i < array_length(job->texture_targets); i++) {
+				texture_2d_t** target = job->texture_targets[i];
+				release_texture(*target);
+				// the first target takes the reference insert_cached_texture() left us
+				*target = i == 0 ? job->texture : acquire_cached_texture(job->filename);
+			}
+			// every target was cancelled, the cache keeps the texture unreferenced
+			if (array_length(job->texture_targets) == 0) {
+				release_texture(job->texture);
+			}
+			break;
+		case LOAD_JOB_MESH: {
+			if (job->parsed_mesh.texture != NULL) {
+				job->parsed_mesh.texture = cache_embedded_texture(job->filename, job->parsed_mesh.texture);
+			}
+			// every target was cancelled
+			if (array_length(job->mesh_targets) == 0) {
+				dispose_mesh(&job->parsed_mesh);
+				break;
+			}
+			char* texture_name = get_embedded_texture_name(job->filename);
+			for (int i = 0; i < array_length(job->mesh_targets); i++) {
+				mesh_t* mesh = job->mesh_targets[i];
+				if (i == 0) {
+					// the first target takes the parsed arrays, the others get copies
+					mesh->vertices = job->parsed_mesh.vertices;
+					mesh->normals = job->parsed_mesh.normals;
+					mesh->faces = job->parsed_mesh.faces;
+					mesh->mapping = job->parsed_mesh.mapping;
+					mesh->mapping_size = job->parsed_mesh.mapping_size;
+					mesh->quantized_vertices = job->parsed_mesh.quantized_vertices;
+					mesh->quantized_faces = job->parsed_mesh.quantized_faces;
+					mesh->dequantize_matrix = job->parsed_mesh.dequantize_matrix;
+					mesh->vertices_count = job->parsed_mesh.vertices_count;
+				} else {
+					copy_mesh_geometry(mesh, &job->parsed_mesh);
+				}
+				if (job->parsed_mesh.texture != NULL && mesh->texture == placeholder_texture) {
+					release_texture(mesh->texture);
+					mesh->texture = acquire_cached_texture(texture_name);
+				}
+			}
+			// the reference cache_embedded_texture() left us
+			release_texture(job->parsed_mesh.texture);
+			free(texture_name);
+			break;
+		}
+	}
+}
+
+int process_loaded_assets(void) {
+	SDL_LockMutex(finished_mutex);
+	load_job_t* job = finished_jobs;
+	finished_jobs = NULL;
+	SDL_UnlockMutex(finished_mutex);
+
+	while (job != NULL) {
+		load_job_t* next = job->next;
+		apply_load_job(job);
+		for (int i = 0; i < array_length(jobs_in_flight); i++) {
+			if (jobs_in_flight[i] == job) {
+				jobs_in_flight[i] = jobs_in_flight[array_length(jobs_in_flight) - 1];
+				array_pop(jobs_in_flight);
+				break;
+			}
+		}
+		array_free(job->texture_targets);
+		array_free(job->mesh_targets);
+		free(job->filename);
+		free(job);
+		job = next;
+	}
+	return array_length(jobs_in_flight);
+}
+
+void free_asset_loader(void) {
+#ifndef __EMSCRIPTEN__
+	// workers drain the queue in order, so each one reaches an exit request only
+	// once every real job has been taken
+	for (int i = 0; i < workers_count; i++) {
+		push_pending_job(NULL);
+	}
+	for (int i = 0; i < workers_count; i++) {
+		SDL_WaitThread(workers[i], NULL);
+	}
+	workers_count = 0;
+	SDL_DestroyMutex(pending_mutex);
+	SDL_DestroySemaphore(pending_sem);
+	pending_mutex = NULL;
+	pending_sem = NULL;
+#endif
+	process_loaded_assets();
+	assert(array_length(jobs_in_flight) == 0);
+	array_free(jobs_in_flight);
+	jobs_in_flight = NULL;
+	SDL_DestroyMutex(finished_mutex);
+	finished_mutex = NULL;
+	release_texture(placeholder_texture);
+	placeholder_texture = NULL;
+}
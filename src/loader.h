@@ -0,0 +1,41 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdbool.h>
+#include "mesh.h"
+#include "texture.h"
+
+#define LOADER_MAX_THREADS 8
+
+// The asset loader decodes PNGs and parses meshes on a pool of worker threads.
+// Requests return right away: texture slots point at a 1x1 placeholder and meshes
+// have no faces, so they are simply not drawn, until process_loaded_assets()
+// swaps the results in on the main thread. Requests for a file that is already
+// in flight share one job; every mesh after the first gets its own copy of the
+// parsed arrays.
+//
+// Without thread support (emscripten) jobs run synchronously when requested and
+// are still handed over by process_loaded_assets().
+//
+// With the simulation thread the swap happens there, so meshes and texture slots
+// the render thread reads have to be tracked by the scene snapshots and read
+// through them.
+
+void init_asset_loader(void);
+// Waits for the outstanding jobs and applies them before stopping the workers
+void free_asset_loader(void);
+
+// *target gets a texture reference from the cache, the placeholder until loaded
+void load_texture_async(char* png_filename, texture_2d_t** target);
+// An embedded glTF texture replaces mesh->texture only while that is the placeholder
+void load_mesh_data_async(mesh_t* mesh, char* mesh_filename);
+// Drops the mesh data and texture loads still pending for the mesh, so they do
+// not land in its slot after it is disposed
+void cancel_mesh_loads(mesh_t* mesh);
+// Faces show the placeholder until loaded, read sizes from face_textures
+void load_cube_texture_async(texture_cube_t* cube_texture, char* textures_paths[6]);
+
+// Main thread only. Returns the number of jobs still in flight
+int process_loaded_assets(void);
+
+#endif
@@ -15,6 +15,9 @@
 #include "triangle.h"
 #include "clipping.h"
 #include "geometry.h"
+#include "pipeline.h"
+#include "snapshot.h"
+#include "loader.h"
 
 #ifdef GEOMETRY_EXAMPLE
 #include "examples/geometry-demo.h"
@@ -44,10 +47,62 @@
 #include "examples/tunnel-demo.h"
 #endif
 
+// Build with SIMULATION_THREAD=1 to run input and update on the main thread
+// while a separate render thread draws the latest published scene snapshot
+#if defined(SIMULATION_THREAD) && !defined(__EMSCRIPTEN__)
+	#define USE_SIMULATION_THREAD true
+#else
+	#define USE_SIMULATION_THREAD false
+#endif
+
 bool is_running = false;
-int previous_frame_time = 0;
 int delta_time = 0;
 
+// Natively the scene is always drawn on the render thread, so the main thread
+// that owns the SDL renderer can present the previous frame meanwhile. Without
+// the simulation thread it draws one frame at a time, started by the main thread
+static SDL_Thread* render_thread = NULL;
+static SDL_atomic_t render_thread_running;
+static SDL_atomic_t render_thread_stopped;
+static SDL_sem* render_start_sem = NULL;
+static SDL_sem* render_done_sem = NULL;
+
+static uint64_t start_counter = 0;
+static uint64_t previous_frame_counter = 0;
+static uint64_t next_frame_counter = 0;
+static uint64_t counter_frequency = 0;
+static uint64_t frame_target_counter = 0;
+
+static int get_elapsed_time(void) {
+	return (int)((SDL_GetPerformanceCounter() - start_counter) * 1000 / counter_frequency);
+}
+
+void setup_frame_timing(void) {
+	counter_frequency = SDL_GetPerformanceFrequency();
+	frame_target_counter = counter_frequency / FPS;
+	start_counter = SDL_GetPerformanceCounter();
+	previous_frame_counter = start_counter;
+	next_frame_counter = start_counter + frame_target_counter;
+}
+
+// Sleep away most of the remaining frame time and spin the last millisecond,
+// so frames start on a fixed high resolution schedule instead of SDL_GetTicks granularity.
+void wait_for_next_frame(void) {
+	uint64_t now = SDL_GetPerformanceCounter();
+	if (now >= next_frame_counter) {
+		// we fell behind, restart the schedule from here instead of trying to catch up
+		next_frame_counter = now + frame_target_counter;
+		return;
+	}
+	uint64_t remaining_ms = (next_frame_counter - now) * 1000 / counter_frequency;
+	if (remaining_ms > 1) {
+		SDL_Delay((uint32_t)(remaining_ms - 1));
+	}
+	while (SDL_GetPerformanceCounter() < next_frame_counter) {
+	}
+	next_frame_counter += frame_target_counter;
+}
+
 void setup(void) {
 	srand(time(NULL));
 	#ifdef GEOMETRY_EXAMPLE
@@ -105,14 +160,15 @@ void process_input(void) {
 }
 
 void update(void) {
-	int now = SDL_GetTicks();
-	int time_to_wait = FRAME_TARGET_TIME - (now - previous_frame_time);
-	if (time_to_wait > 0 && time_to_wait < FRAME_TARGET_TIME) {
-		SDL_Delay(time_to_wait);
-	}
+	wait_for_next_frame();
 
-	delta_time = CLAMP(0, 500, (SDL_GetTicks() - previous_frame_time));
-	previous_frame_time = SDL_GetTicks();
+	uint64_t frame_counter = SDL_GetPerformanceCounter();
+	delta_time = CLAMP(0, 500, (int)((frame_counter - previous_frame_counter) * 1000 / counter_frequency));
+	previous_frame_counter = frame_counter;
+	int now = get_elapsed_time();
+
+	// hand over whatever the loader threads finished since the last frame
+	process_loaded_assets();
 
 	#ifdef GEOMETRY_EXAMPLE
 		geometry_example_update(delta_time, now);
@@ -135,37 +191,45 @@ void update(void) {
 	#ifdef TUNNEL_EXAMPLE
 		tunnel_demo_update(delta_time, now);
 	#endif
+
+	publish_scene_snapshot(delta_time, now);
 }
 
 void render(void) {
-	int now = SDL_GetTicks();
+	acquire_scene_snapshot();
+	int frame_delta_time = snapshot_get_delta_time();
+	int now = snapshot_get_elapsed_time();
 	clear_color(0xFF111111);
 	clear_depth();
+	pipeline_set_viewport(0, 0, get_viewport_width(), get_viewport_height());
+	pipeline_disable_scissor();
 	#ifdef GEOMETRY_EXAMPLE
-		geometry_example_render(delta_time, now);
+		geometry_example_render(frame_delta_time, now);
 	#endif
 	#ifdef SHADOWMAP_EXAMPLE
-		shadow_map_example_render(delta_time, now);
+		shadow_map_example_render(frame_delta_time, now);
 	#endif
 	#ifdef PHYSICS2D_EXAMPLE
-		physics2D_example_render(delta_time, now);
+		physics2D_example_render(frame_delta_time, now);
 	#endif
 	#ifdef DEPTHBUFFER_EXAMPLE
-		depth_buffer_example_render(delta_time, now);
+		depth_buffer_example_render(frame_delta_time, now);
 	#endif
 	#ifdef ENVIRONMENTMAPPING_EXAMPLE
-		environment_mapping_example_render(delta_time, now);
+		environment_mapping_example_render(frame_delta_time, now);
 	#endif
 	#ifdef PLASMA_EXAMPLE
-		plasma_demo_render(delta_time, now);
+		plasma_demo_render(frame_delta_time, now);
 	#endif
 	#ifdef TUNNEL_EXAMPLE
-		tunnel_demo_render(delta_time, now);
+		tunnel_demo_render(frame_delta_time, now);
 	#endif
 	render_color_buffer();
 }
 
 void free_resources(void) {
+	free_asset_loader();
+
 	#ifdef GEOMETRY_EXAMPLE
 		geometry_example_free_resources();
 	#endif
@@ -188,13 +252,78 @@ void free_resources(void) {
 		tunnel_demo_free_resources();
 	#endif
 	
+	free_scene_snapshots();
+	free_render_target_pool();
+	free_texture_cache();
 	destroy_window();
 }
 
+static int render_thread_main(void* data) {
+	while (SDL_AtomicGet(&render_thread_running)) {
+		if (USE_SIMULATION_THREAD) {
+			wait_for_scene_snapshot();
+		} else {
+			SDL_SemWait(render_start_sem);
+		}
+		if (SDL_AtomicGet(&render_thread_running)) {
+			render();
+		}
+		if (!USE_SIMULATION_THREAD) {
+			SDL_SemPost(render_done_sem);
+		}
+	}
+	SDL_AtomicSet(&render_thread_stopped, 1);
+	return 0;
+}
+
+void start_render_thread(void) {
+	// hand the render thread the state setup() left behind
+	publish_scene_snapshot(0, 0);
+	render_start_sem = SDL_CreateSemaphore(0);
+	render_done_sem = SDL_CreateSemaphore(0);
+	SDL_AtomicSet(&render_thread_running, 1);
+	SDL_AtomicSet(&render_thread_stopped, 0);
+	render_thread = SDL_CreateThread(render_thread_main, "render", NULL);
+	if (!render_thread) {
+		SDL_Log("Error creating render thread, rendering on the main thread");
+	}
+}
+
+void stop_render_thread(void) {
+	if (render_thread != NULL) {
+		SDL_AtomicSet(&render_thread_running, 0);
+		// wake the render thread up in case it is waiting for a frame
+		if (USE_SIMULATION_THREAD) {
+			publish_scene_snapshot(delta_time, get_elapsed_time());
+		} else {
+			SDL_SemPost(render_start_sem);
+		}
+		// it may also be waiting for a screen buffer to draw into
+		while (!SDL_AtomicGet(&render_thread_stopped)) {
+			present_color_buffers();
+			SDL_Delay(1);
+		}
+		SDL_WaitThread(render_thread, NULL);
+		render_thread = NULL;
+	}
+	SDL_DestroySemaphore(render_start_sem);
+	SDL_DestroySemaphore(render_done_sem);
+}
+
 void onFrame(void) {
 	process_input();
 	update();
-	render();
+	if (render_thread == NULL) {
+		render();
+		present_color_buffers();
+	} else if (USE_SIMULATION_THREAD) {
+		present_color_buffers();
+	} else {
+		// the render thread draws this frame while the last one is presented
+		SDL_SemPost(render_start_sem);
+		present_color_buffers();
+		SDL_SemWait(render_done_sem);
+	}
 }
 
 #ifdef __EMSCRIPTEN__
@@ -208,9 +337,17 @@ int main(int argc, char **argv) {
 		set_window_scale(0.5);
 	#endif
 
+	init_scene_snapshots(USE_SIMULATION_THREAD);
+
 	is_running = initialize_window();
 
+	init_asset_loader();
 	setup();
+	setup_frame_timing();
+
+	#ifndef __EMSCRIPTEN__
+		start_render_thread();
+	#endif
 
 	#ifdef __EMSCRIPTEN__
 		on_demo_ready();
@@ -225,6 +362,7 @@ int main(int argc, char **argv) {
 		}
 	#endif
 
+	stop_render_thread();
 	free_resources();
 
 	return 0;
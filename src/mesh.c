@@ -1,16 +1,85 @@
-#include <assert.h>
+// stat() and mkstemp() are POSIX, not part of -std=c17
+#define _XOPEN_SOURCE 700
+
 #include "stdio.h"
 #include <stdlib.h>
 #include <string.h>
+#include <float.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "utils.h"
 #include "mesh.h"
 #include "array.h"
 #include "geometry.h"
+#include "loader.h"
+#include "obj.h"
+#include "gltf.h"
+
+// Meshes per pool block, blocks are never moved so mesh pointers stay put
+#define MESH_BLOCK_SIZE 256
+
+typedef struct {
+	uint32_t generation;
+	// position in live_meshes, -1 while the slot is free
+	int live_index;
+} mesh_slot_t;
+
+static mesh_t** mesh_blocks = NULL;
+static mesh_slot_t* mesh_slots = NULL;
+// slots of disposed meshes, reused last in first out while still warm
+static int* free_mesh_slots = NULL;
+static mesh_t** live_meshes = NULL;
+static bool is_quantization_enabled = false;
+
+static mesh_t* get_slot_mesh(int slot) {
+	return &mesh_blocks[slot / MESH_BLOCK_SIZE][slot % MESH_BLOCK_SIZE];
+}
+
+static mesh_t* make_pool_mesh(void) {
+	int slot;
+	if (array_length(free_mesh_slots) > 0) {
+		slot = free_mesh_slots[array_length(free_mesh_slots) - 1];
+		array_pop(free_mesh_slots);
+	} else {
+		slot = array_length(mesh_slots);
+		if (slot % MESH_BLOCK_SIZE == 0) {
+			mesh_t* block = malloc(sizeof(mesh_t) * MESH_BLOCK_SIZE);
+			array_push(mesh_blocks, block);
+		}
+		mesh_slot_t new_slot = { .generation = 1 };
+		array_push(mesh_slots, new_slot);
+	}
+	mesh_t* mesh = get_slot_mesh(slot);
+	memset(mesh, 0, sizeof(mesh_t));
+	mesh->handle = (mesh_handle_t){ slot, mesh_slots[slot].generation };
+	mesh_slots[slot].live_index = array_length(live_meshes);
+	array_push(live_meshes, mesh);
+	return mesh;
+}
+
+static bool is_live_handle(mesh_handle_t handle) {
+	return handle.generation != 0 &&
+		handle.index >= 0 &&
+		handle.index < array_length(mesh_slots) &&
+		mesh_slots[handle.index].generation == handle.generation;
+}
 
-#define MAX_NUM_MESHES 20
+static bool is_pool_mesh(mesh_t* mesh) {
+	return is_live_handle(mesh->handle) && get_slot_mesh(mesh->handle.index) == mesh;
+}
 
-static mesh_t meshes[MAX_NUM_MESHES];
-static int mesh_count = 0;
+static void free_pool_mesh(mesh_t* mesh) {
+	mesh_slot_t* slot = &mesh_slots[mesh->handle.index];
+	mesh_t* last = live_meshes[array_length(live_meshes) - 1];
+	live_meshes[slot->live_index] = last;
+	mesh_slots[last->handle.index].live_index = slot->live_index;
+	array_pop(live_meshes);
+	// skip 0 on wrap around, it marks meshes outside the pool
+	slot->generation = slot->generation + 1 != 0 ? slot->generation + 1 : 1;
+	slot->live_index = -1;
+	array_push(free_mesh_slots, mesh->handle.index);
+}
 
 mesh_t* make_plane(
 	float width,
@@ -18,15 +87,10 @@ mesh_t* make_plane(
 	int width_segments,
 	int height_segments
 ) {
-	printf("Create mesh %d\n", mesh_count);
-	assert(mesh_count < MAX_NUM_MESHES);
-	mesh_t *mesh = &meshes[mesh_count];
+	mesh_t* mesh = make_pool_mesh();
 
 	make_plane_geometry(mesh, width, height, width_segments, height_segments);
 	init_mesh_common_properties(mesh);
-	mesh->idx = mesh_count;
-
-	mesh_count++;
 
 	return mesh;
 }
@@ -40,9 +104,7 @@ mesh_t* make_sphere(
 	float theta_start,
 	float theta_length
 ) {
-	printf("Create mesh %d\n", mesh_count);
-	assert(mesh_count < MAX_NUM_MESHES);
-	mesh_t *mesh = &meshes[mesh_count];
+	mesh_t* mesh = make_pool_mesh();
     
 	make_sphere_geometry(
 		mesh,
@@ -56,8 +118,6 @@ mesh_t* make_sphere(
 	);
 	init_mesh_common_properties(mesh);
 
-	mesh_count++;
-
 	return mesh;
 }
 
@@ -69,9 +129,7 @@ mesh_t* make_box(
 	int height_segments,
 	int depth_segments
 ) {
-	printf("Create mesh %d\n", mesh_count);
-	assert(mesh_count < MAX_NUM_MESHES);
-	mesh_t *mesh = &meshes[mesh_count];
+	mesh_t* mesh = make_pool_mesh();
 
 	make_box_geometry(
 		mesh,
@@ -84,8 +142,6 @@ mesh_t* make_box(
 	);
 	init_mesh_common_properties(mesh);
 
-	mesh_count++;
-
 	return mesh;
 }
 
@@ -97,9 +153,7 @@ mesh_t* make_ring(
 	float theta_start,
 	float theta_length
 ) {
-	printf("Create mesh %d\n", mesh_count);
-	assert(mesh_count < MAX_NUM_MESHES);
-	mesh_t *mesh = &meshes[mesh_count];
+	mesh_t* mesh = make_pool_mesh();
 
 	make_ring_geometry(
 		mesh,
@@ -112,8 +166,6 @@ mesh_t* make_ring(
 	);
 	init_mesh_common_properties(mesh);
 
-	mesh_count++;
-
 	return mesh;
 }
 
@@ -124,9 +176,7 @@ mesh_t* make_torus(
 	int tubular_segments,
 	float arc
 ) {
-	printf("Create mesh %d\n", mesh_count);
-	assert(mesh_count < MAX_NUM_MESHES);
-	mesh_t *mesh = &meshes[mesh_count];
+	mesh_t* mesh = make_pool_mesh();
 
 	make_torus_geometry(
 		mesh,
@@ -138,7 +188,6 @@ mesh_t* make_torus(
 	);
 	init_mesh_common_properties(mesh);
 
-	mesh_count++;
 	return mesh;
 }
 
@@ -167,113 +216,702 @@ void mesh_update_world_matrix(mesh_t *mesh) {
 }
 
 mesh_t* load_mesh(
-	char* obj_filename,
+	char* mesh_filename,
 	char* png_filename,
 	vec3_t scale,
 	vec3_t translation,
 	vec3_t rotation
 ) {
-	printf("Create mesh %d\n", mesh_count);
-	assert(mesh_count < MAX_NUM_MESHES);
-	mesh_t *mesh = &meshes[mesh_count];
-	load_mesh_obj_data(mesh, obj_filename);
-	load_mesh_png_data(mesh, png_filename);
+	mesh_t* mesh = make_pool_mesh();
+	load_mesh_data(mesh, mesh_filename);
+	if (mesh->texture != NULL) {
+		mesh->texture = cache_embedded_texture(mesh_filename, mesh->texture);
+	}
+	if (is_quantization_enabled) {
+		quantize_mesh(mesh);
+	}
+	if (png_filename != NULL) {
+		load_mesh_png_data(mesh, png_filename);
+	}
 	init_mesh_common_properties(mesh);
 
-	mesh_count++;
-
 	return mesh;
 }
 
 int get_meshes_count(void) {
-	return mesh_count;
+	return array_length(live_meshes);
 }
 
 mesh_t* get_mesh(int index) {
-	return &meshes[index];
+	return live_meshes[index];
+}
+
+mesh_t* get_mesh_by_handle(mesh_handle_t handle) {
+	return is_live_handle(handle) ? get_slot_mesh(handle.index) : NULL;
+}
+
+static void free_mesh_arrays(mesh_t* mesh) {
+	if (mesh->mapping != NULL) {
+		unmap_file(mesh->mapping, mesh->mapping_size);
+		mesh->mapping = NULL;
+	} else if (!release_cached_geometry(mesh)) {
+		array_free(mesh->vertices);
+		array_free(mesh->normals);
+		array_free(mesh->faces);
+	}
+	mesh->vertices = NULL;
+	mesh->normals = NULL;
+	mesh->faces = NULL;
+}
+
+static void* copy_array(void* array, int item_size) {
+	if (array == NULL) {
+		return NULL;
+	}
+	int count = array_length(array);
+	void* copy = array_hold(NULL, count, item_size);
+	memcpy(copy, array, (size_t)item_size * count);
+	return copy;
+}
+
+void detach_mesh_geometry(mesh_t* mesh) {
+	if (!is_cached_geometry(mesh)) {
+		return;
+	}
+	vec3_t* vertices = copy_array(mesh->vertices, sizeof(vec3_t));
+	vec3_t* normals = copy_array(mesh->normals, sizeof(vec3_t));
+	face_t* faces = copy_array(mesh->faces, sizeof(face_t));
+	release_cached_geometry(mesh);
+	mesh->vertices = vertices;
+	mesh->normals = normals;
+	mesh->faces = faces;
+}
+
+void copy_mesh_geometry(mesh_t* mesh, mesh_t* source) {
+	mesh->vertices = copy_array(source->vertices, sizeof(vec3_t));
+	mesh->normals = copy_array(source->normals, sizeof(vec3_t));
+	mesh->faces = copy_array(source->faces, sizeof(face_t));
+	mesh->mapping = NULL;
+	mesh->mapping_size = 0;
+	mesh->quantized_vertices = copy_array(source->quantized_vertices, sizeof(quantized_vertex_t));
+	mesh->quantized_faces = copy_array(source->quantized_faces, sizeof(quantized_face_t));
+	mesh->dequantize_matrix = source->dequantize_matrix;
+	mesh->vertices_count = source->vertices_count;
 }
 
 void dispose_mesh(mesh_t* mesh) {
-	array_free(mesh->vertices);
-	array_free(mesh->faces);
-	upng_free(mesh->texture);
+	free_mesh_arrays(mesh);
+	array_free(mesh->quantized_vertices);
+	array_free(mesh->quantized_faces);
+	release_texture(mesh->texture);
+	if (is_pool_mesh(mesh)) {
+		cancel_mesh_loads(mesh);
+		free_pool_mesh(mesh);
+	}
 }
 
 void dispose_meshes(void) {
-	for (int i = 0; i < mesh_count; i++) {
-		mesh_t* mesh = &meshes[i];
-		dispose_mesh(mesh);
+	while (array_length(live_meshes) > 0) {
+		dispose_mesh(live_meshes[array_length(live_meshes) - 1]);
+	}
+	for (int i = 0; i < array_length(mesh_blocks); i++) {
+		free(mesh_blocks[i]);
 	}
+	array_free(mesh_blocks);
+	array_free(mesh_slots);
+	array_free(free_mesh_slots);
+	array_free(live_meshes);
+	mesh_blocks = NULL;
+	mesh_slots = NULL;
+	free_mesh_slots = NULL;
+	live_meshes = NULL;
 }
 
-void load_mesh_obj_data(mesh_t* mesh, char* obj_filename) {
-	FILE* file;
-	file = fopen(obj_filename, "r");
+// Width of a welding hash cell in tolerances
+#define WELD_CELL_SCALE 16
+
+static inline bool is_zero_vec3(vec3_t v) {
+	return v.x == 0 && v.y == 0 && v.z == 0;
+}
+
+static inline vec3_t normalize_or_zero(vec3_t v) {
+	float length = vec3_length(v);
+	return length > 0 ? vec3_div(v, length) : v;
+}
+
+static inline int get_face_corner(face_t* face, int corner) {
+	return corner == 0 ? face->a : corner == 1 ? face->b : face->c;
+}
+
+static inline void set_face_corner(face_t* face, int corner, int index) {
+	if (corner == 0) {
+		face->a = index;
+	} else if (corner == 1) {
+		face->b = index;
+	} else {
+		face->c = index;
+	}
+}
 
-	char line[255];
+static inline int64_t get_weld_cell(float value, float inv_cell_size) {
+	float cell = floorf(value * inv_cell_size);
+	// far away and NaN coordinates share the outermost cells, matches are still compared exactly
+	return isfinite(cell) ? (int64_t)CLAMP(-1e18f, 1e18f, cell) : 0;
+}
 
-	tex2_t* texcoords = NULL;
-	int vertices_count = 0;
+static inline uint32_t hash_weld_cell(int64_t x, int64_t y, int64_t z) {
+	uint64_t hash = (uint64_t)x * 0x9e3779b97f4a7c15 ^ (uint64_t)y * 0xc2b2ae3d27d4eb4f ^ (uint64_t)z * 0x165667b19e3779f9;
+	// fold the well mixed high bits down, the caller masks the low ones
+	return (uint32_t)(hash >> 32 ^ hash);
+}
+
+int weld_mesh_vertices(mesh_t* mesh, float tolerance, float normal_tolerance) {
+	int vertices_count = array_length(mesh->vertices);
+	if (vertices_count == 0) {
+		return 0;
+	}
+	// cells several tolerances wide, so most vertices are far enough from the
+	// cell walls that their own cell is the only one to look into
+	float cell_size = MAX(tolerance, FLT_MIN) * WELD_CELL_SCALE;
+	float inv_cell_size = 1.0f / cell_size;
+	int buckets_count = 1;
+	while (buckets_count < vertices_count * 2) {
+		buckets_count *= 2;
+	}
+	arena_t scratch;
+	init_arena(&scratch, sizeof(int) * ((size_t)buckets_count + (size_t)vertices_count * 2) + ARENA_ALIGNMENT * 3);
+	int* buckets = arena_alloc(&scratch, sizeof(int) * buckets_count);
+	int* next_in_bucket = arena_alloc(&scratch, sizeof(int) * vertices_count);
+	int* remap = arena_alloc(&scratch, sizeof(int) * vertices_count);
+	memset(buckets, -1, sizeof(int) * buckets_count);
+
+	// representatives are moved to the front as they are found, so the new
+	// index of a kept vertex never exceeds its old one
+	int kept_count = 0;
+	for (int i = 0; i < vertices_count; i++) {
+		vec3_t position = mesh->vertices[i];
+		vec3_t normal = mesh->normals[i];
+		float coordinates[3] = { position.x, position.y, position.z };
+		int64_t cells[3];
+		int first_neighbors[3];
+		int last_neighbors[3];
+		for (int axis = 0; axis < 3; axis++) {
+			cells[axis] = get_weld_cell(coordinates[axis], inv_cell_size);
+			float offset = coordinates[axis] - cells[axis] * cell_size;
+			first_neighbors[axis] = offset < tolerance ? -1 : 0;
+			last_neighbors[axis] = offset > cell_size - tolerance ? 1 : 0;
+		}
+		int match = -1;
+		for (int z = first_neighbors[2]; z <= last_neighbors[2] && match == -1; z++)
+		for (int y = first_neighbors[1]; y <= last_neighbors[1] && match == -1; y++)
+		for (int x = first_neighbors[0]; x <= last_neighbors[0] && match == -1; x++) {
+			uint32_t bucket = hash_weld_cell(cells[0] + x, cells[1] + y, cells[2] + z) & (buckets_count - 1);
+			for (int k = buckets[bucket]; k != -1 && match == -1; k = next_in_bucket[k]) {
+				vec3_t other = mesh->vertices[k];
+				bool is_close = fabsf(other.x - position.x) <= tolerance &&
+					fabsf(other.y - position.y) <= tolerance &&
+					fabsf(other.z - position.z) <= tolerance;
+				// vertices without a normal only weld with each other
+				vec3_t other_normal = mesh->normals[k];
+				bool is_same_normal = is_zero_vec3(normal) || is_zero_vec3(other_normal) ?
+					is_zero_vec3(normal) && is_zero_vec3(other_normal) :
+					vec3_dot(normalize_or_zero(normal), normalize_or_zero(other_normal)) >= 1.0f - normal_tolerance;
+				match = is_close && is_same_normal ? k : -1;
+			}
+		}
+		if (match != -1) {
+			remap[i] = match;
+			continue;
+		}
+		mesh->vertices[kept_count] = position;
+		mesh->normals[kept_count] = normal;
+		remap[i] = kept_count;
+		uint32_t bucket = hash_weld_cell(cells[0], cells[1], cells[2]) & (buckets_count - 1);
+		next_in_bucket[kept_count] = buckets[bucket];
+		buckets[bucket] = kept_count;
+		kept_count++;
+	}
 
-	while (fgets(line, 255, file)) {
-		// Vertex information
-		if (strncmp(line, "v ", 2) == 0) {
-			vec3_t vertex;
-			sscanf(line, "v %f %f %f", &vertex.x, &vertex.y, &vertex.z);
-			array_push(mesh->vertices, vertex);
-			vertices_count++;
+	// faces that collapsed onto an edge or a point cover no pixels
+	int faces_count = array_length(mesh->faces);
+	int kept_faces_count = 0;
+	for (int i = 0; i < faces_count; i++) {
+		face_t face = mesh->faces[i];
+		face.a = remap[face.a];
+		face.b = remap[face.b];
+		face.c = remap[face.c];
+		if (face.a != face.b && face.b != face.c && face.a != face.c) {
+			mesh->faces[kept_faces_count++] = face;
 		}
+	}
+	free_arena(&scratch);
+
+	// shrink the arrays to their new length
+	vec3_t* vertices = array_hold(NULL, kept_count, sizeof(vec3_t));
+	vec3_t* normals = array_hold(NULL, kept_count, sizeof(vec3_t));
+	face_t* faces = array_hold(NULL, kept_faces_count, sizeof(face_t));
+	memcpy(vertices, mesh->vertices, sizeof(vec3_t) * kept_count);
+	memcpy(normals, mesh->normals, sizeof(vec3_t) * kept_count);
+	memcpy(faces, mesh->faces, sizeof(face_t) * kept_faces_count);
+	array_free(mesh->vertices);
+	array_free(mesh->normals);
+	array_free(mesh->faces);
+	mesh->vertices = vertices;
+	mesh->normals = normals;
+	mesh->faces = faces;
+	mesh->vertices_count = kept_count;
+	return vertices_count - kept_count;
+}
 
-		// Texture coordinate information
-		if (strncmp(line, "vt ", 3) == 0) {
-			tex2_t texcoord;
-			sscanf(line, "vt %f %f", &texcoord.u, &texcoord.v);
-			array_push(texcoords, texcoord);
+void generate_mesh_normals(mesh_t* mesh, float crease_angle) {
+	int vertices_count = array_length(mesh->vertices);
+	int faces_count = array_length(mesh->faces);
+	float min_dot = cosf(crease_angle);
+
+	// unit face normals, what every corner adds to its vertex normal (the face
+	// normal weighted by the corner angle, so the tessellation does not skew
+	// the result) and the corners of every vertex in one flat list
+	size_t all_corners_count = (size_t)faces_count * 3;
+	arena_t scratch;
+	init_arena(&scratch,
+		sizeof(vec3_t) * ((size_t)faces_count + all_corners_count) +
+		sizeof(int) * (all_corners_count + (size_t)vertices_count * 2 + 1) +
+		ARENA_ALIGNMENT * 5
+	);
+	vec3_t* face_normals = arena_alloc(&scratch, sizeof(vec3_t) * faces_count);
+	vec3_t* corner_normals = arena_alloc(&scratch, sizeof(vec3_t) * all_corners_count);
+	int* corners_offsets = arena_alloc(&scratch, sizeof(int) * (vertices_count + 1));
+	int* corners = arena_alloc(&scratch, sizeof(int) * all_corners_count);
+	memset(corners_offsets, 0, sizeof(int) * (vertices_count + 1));
+	for (int i = 0; i < faces_count; i++) {
+		face_t* face = &mesh->faces[i];
+		vec3_t positions[3] = { mesh->vertices[face->a], mesh->vertices[face->b], mesh->vertices[face->c] };
+		face_normals[i] = normalize_or_zero(vec3_cross(vec3_sub(positions[1], positions[0]), vec3_sub(positions[2], positions[0])));
+		for (int j = 0; j < 3; j++) {
+			vec3_t to_next = normalize_or_zero(vec3_sub(positions[(j + 1) % 3], positions[j]));
+			vec3_t to_previous = normalize_or_zero(vec3_sub(positions[(j + 2) % 3], positions[j]));
+			float cosine = to_next.x * to_previous.x + to_next.y * to_previous.y + to_next.z * to_previous.z;
+			corner_normals[i * 3 + j] = vec3_mul(face_normals[i], acosf(CLAMP(-1.0f, 1.0f, cosine)));
+			corners_offsets[get_face_corner(face, j) + 1]++;
 		}
+	}
+	for (int i = 0; i < vertices_count; i++) {
+		corners_offsets[i + 1] += corners_offsets[i];
+	}
+	int* corners_filled = arena_alloc(&scratch, sizeof(int) * vertices_count);
+	memset(corners_filled, 0, sizeof(int) * vertices_count);
+	for (int i = 0; i < faces_count * 3; i++) {
+		int vertex = get_face_corner(&mesh->faces[i / 3], i % 3);
+		corners[corners_offsets[vertex] + corners_filled[vertex]++] = i;
+	}
 
-		// Normal
-		if (strncmp(line, "vn ", 3) == 0) {
-			vec3_t normal;
-			sscanf(line, "vn %f %f %f", &normal.x, &normal.y, &normal.z);
-			array_push(mesh->normals, normal);
+	vec3_t* normals = array_hold(NULL, vertices_count, sizeof(vec3_t));
+	memset(normals, 0, sizeof(vec3_t) * vertices_count);
+	for (int vertex = 0; vertex < vertices_count; vertex++) {
+		int* vertex_corners = &corners[corners_offsets[vertex]];
+		int corners_count = corners_offsets[vertex + 1] - corners_offsets[vertex];
+		// the first normal found for this vertex keeps its index, others get a copy
+		int first_split = array_length(normals);
+		for (int i = 0; i < corners_count; i++) {
+			int corner = vertex_corners[i];
+			vec3_t face_normal = face_normals[corner / 3];
+			// summed in the same order for every corner, so corners smoothing over
+			// the same faces end up with bit identical normals and share a vertex
+			vec3_t normal = { 0, 0, 0 };
+			for (int j = 0; j < corners_count; j++) {
+				vec3_t other_normal = face_normals[vertex_corners[j] / 3];
+				float cosine = face_normal.x * other_normal.x + face_normal.y * other_normal.y + face_normal.z * other_normal.z;
+				if (j == i || cosine >= min_dot) {
+					normal = vec3_add(normal, corner_normals[vertex_corners[j]]);
+				}
+			}
+			normal = normalize_or_zero(normal);
+
+			int target = vertex;
+			if (i > 0 && memcmp(&normals[vertex], &normal, sizeof(vec3_t)) != 0) {
+				target = -1;
+				for (int j = first_split; j < array_length(normals) && target == -1; j++) {
+					target = memcmp(&normals[j], &normal, sizeof(vec3_t)) == 0 ? j : -1;
+				}
+				if (target == -1) {
+					vec3_t position = mesh->vertices[vertex];
+					array_push(mesh->vertices, position);
+					array_push(normals, normal);
+					target = array_length(normals) - 1;
+				}
+			}
+			normals[target] = normal;
+			set_face_corner(&mesh->faces[corner / 3], corner % 3, target);
 		}
+	}
+	free_arena(&scratch);
+
+	array_free(mesh->normals);
+	mesh->normals = normals;
+	mesh->vertices_count = array_length(mesh->vertices);
+}
+
+void set_mesh_quantization(bool is_enabled) {
+	is_quantization_enabled = is_enabled;
+}
+
+bool is_mesh_quantization_enabled(void) {
+	return is_quantization_enabled;
+}
+
+static uint16_t float_to_half(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = bits >> 16 & 0x8000;
+	uint32_t magnitude = bits & 0x7fffffff;
+	if (magnitude > 0x7f800000) {
+		return sign | 0x7e00;
+	}
+	// 65520 and up round past the largest half
+	if (magnitude >= 0x477ff000) {
+		return sign | 0x7c00;
+	}
+	// below 2^-14 the half is subnormal, in steps of 2^-24
+	if (magnitude < 0x38800000) {
+		float absolute = fabsf(value);
+		return sign | (uint16_t)lrintf(absolute * 0x1p24f);
+	}
+	// rebias the exponent and round the mantissa to nearest even, a carry
+	// moves on into the exponent
+	uint32_t rounded = magnitude + 0xfff + (magnitude >> 13 & 1);
+	return sign | (uint16_t)((rounded - 0x38000000) >> 13);
+}
+
+static void encode_octahedral_normal(vec3_t normal, int16_t encoded[2]) {
+	float length = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+	float x = length > 0 ? normal.x / length : 0;
+	float y = length > 0 ? normal.y / length : 0;
+	// the lower hemisphere folds out into the corners of the square
+	if (normal.z < 0) {
+		float folded_x = (1.0f - fabsf(y)) * (x >= 0 ? 1.0f : -1.0f);
+		float folded_y = (1.0f - fabsf(x)) * (y >= 0 ? 1.0f : -1.0f);
+		x = folded_x;
+		y = folded_y;
+	}
+	encoded[0] = (int16_t)lrintf(CLAMP(-1.0f, 1.0f, x) * 32767.0f);
+	encoded[1] = (int16_t)lrintf(CLAMP(-1.0f, 1.0f, y) * 32767.0f);
+}
+
+static uint16_t quantize_coordinate(float value, float min, float inv_extent) {
+	return (uint16_t)lrintf(CLAMP(0.0f, 65535.0f, (value - min) * inv_extent));
+}
+
+void quantize_mesh(mesh_t* mesh) {
+	if (mesh->quantized_vertices != NULL) {
+		return;
+	}
+	int vertices_count = array_length(mesh->vertices);
+	int faces_count = array_length(mesh->faces);
+	vec3_t bounds_min = { FLT_MAX, FLT_MAX, FLT_MAX };
+	vec3_t bounds_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int i = 0; i < vertices_count; i++) {
+		vec3_t vertex = mesh->vertices[i];
+		bounds_min = (vec3_t){ MIN(bounds_min.x, vertex.x), MIN(bounds_min.y, vertex.y), MIN(bounds_min.z, vertex.z) };
+		bounds_max = (vec3_t){ MAX(bounds_max.x, vertex.x), MAX(bounds_max.y, vertex.y), MAX(bounds_max.z, vertex.z) };
+	}
+	if (vertices_count == 0) {
+		bounds_min = bounds_max = (vec3_t){ 0, 0, 0 };
+	}
+	vec3_t extent = vec3_sub(bounds_max, bounds_min);
+	// flat axes keep every vertex at the minimum
+	vec3_t inv_extent = {
+		extent.x > 0 ? 65535.0f / extent.x : 0,
+		extent.y > 0 ? 65535.0f / extent.y : 0,
+		extent.z > 0 ? 65535.0f / extent.z : 0
+	};
+
+	quantized_vertex_t* vertices = array_hold(NULL, vertices_count, sizeof(quantized_vertex_t));
+	for (int i = 0; i < vertices_count; i++) {
+		vec3_t vertex = mesh->vertices[i];
+		vertices[i].position[0] = quantize_coordinate(vertex.x, bounds_min.x, inv_extent.x);
+		vertices[i].position[1] = quantize_coordinate(vertex.y, bounds_min.y, inv_extent.y);
+		vertices[i].position[2] = quantize_coordinate(vertex.z, bounds_min.z, inv_extent.z);
+		encode_octahedral_normal(mesh->normals[i], vertices[i].normal);
+	}
+	quantized_face_t* faces = array_hold(NULL, faces_count, sizeof(quantized_face_t));
+	for (int i = 0; i < faces_count; i++) {
+		face_t face = mesh->faces[i];
+		faces[i] = (quantized_face_t){
+			.a = face.a,
+			.b = face.b,
+			.c = face.c,
+			.uvs = {
+				float_to_half(face.a_uv.u), float_to_half(face.a_uv.v),
+				float_to_half(face.b_uv.u), float_to_half(face.b_uv.v),
+				float_to_half(face.c_uv.u), float_to_half(face.c_uv.v)
+			},
+			.color = face.color
+		};
+	}
+
+	free_mesh_arrays(mesh);
+	mesh->quantized_vertices = vertices;
+	mesh->quantized_faces = faces;
+	mesh->dequantize_matrix = mat4_mul_mat4(
+		mat4_make_translation(bounds_min.x, bounds_min.y, bounds_min.z),
+		mat4_make_scale(extent.x / 65535.0f, extent.y / 65535.0f, extent.z / 65535.0f)
+	);
+}
+
+static void process_loaded_mesh(mesh_t* mesh) {
+	bool has_normals = false;
+	for (int i = 0; i < array_length(mesh->normals) && !has_normals; i++) {
+		has_normals = !is_zero_vec3(mesh->normals[i]);
+	}
+	weld_mesh_vertices(mesh, MESH_WELD_TOLERANCE, MESH_WELD_NORMAL_TOLERANCE);
+	if (!has_normals) {
+		generate_mesh_normals(mesh, MESH_CREASE_ANGLE);
+	}
+}
+
+_Static_assert(sizeof(mesh_file_header_t) % ARENA_ALIGNMENT == 0, "mesh file header must keep the arrays aligned");
+
+// The items are padded so the next array header stays aligned
+static size_t get_mesh_file_array_size(size_t items_size) {
+	return ARRAY_HEADER_SIZE + ((items_size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1));
+}
+
+static size_t get_mesh_file_size(uint32_t vertices_count, uint32_t faces_count) {
+	return sizeof(mesh_file_header_t) +
+		get_mesh_file_array_size(sizeof(vec3_t) * vertices_count) * 2 +
+		get_mesh_file_array_size(sizeof(face_t) * faces_count);
+}
+
+static bool is_mesh_file_source(mesh_file_source_t* source, char* obj_filename) {
+	struct stat obj_stat;
+	if (stat(obj_filename, &obj_stat) != 0 || (uint64_t)obj_stat.st_size != source->size) {
+		return false;
+	}
+	if (obj_stat.st_mtime == source->mtime) {
+		return true;
+	}
+	// touched without being edited, by a checkout for example
+	size_t size = 0;
+	void* data = map_file(obj_filename, &size);
+	bool is_same = data != NULL && hash_data(data, size) == source->hash;
+	unmap_file(data, size);
+	return is_same;
+}
+
+bool load_mesh_file(mesh_t* mesh, char* filename, char* obj_filename) {
+	size_t mapping_size = 0;
+	void* mapping = map_file(filename, &mapping_size);
+	if (mapping == NULL) {
+		return false;
+	}
+	mesh_file_header_t* header = mapping;
+	bool is_valid = mapping_size >= sizeof(mesh_file_header_t) &&
+		memcmp(header->magic, MESH_FILE_MAGIC, sizeof(header->magic)) == 0 &&
+		header->version == MESH_FILE_VERSION &&
+		header->vertices_count <= INT32_MAX &&
+		header->faces_count <= INT32_MAX &&
+		mapping_size == get_mesh_file_size(header->vertices_count, header->faces_count);
+	if (!is_valid) {
+		printf("Mesh file %s is invalid or from another version\n", filename);
+	}
+	if (!is_valid || !is_mesh_file_source(&header->source, obj_filename)) {
+		unmap_file(mapping, mapping_size);
+		return false;
+	}
+
+	// zero copy, the arrays live in the mapped pages
+	uint8_t* arrays = (uint8_t*)mapping + sizeof(mesh_file_header_t);
+	mesh->vertices = array_wrap(arrays, header->vertices_count);
+	arrays += get_mesh_file_array_size(sizeof(vec3_t) * header->vertices_count);
+	mesh->normals = array_wrap(arrays, header->vertices_count);
+	arrays += get_mesh_file_array_size(sizeof(vec3_t) * header->vertices_count);
+	mesh->faces = array_wrap(arrays, header->faces_count);
+	mesh->vertices_count = header->vertices_count;
+	mesh->mapping = mapping;
+	mesh->mapping_size = mapping_size;
+	return true;
+}
 
-		// Face information
-		if (strncmp(line, "f ", 2) == 0) {
-			int vertex_indices[3];
-			int uv_indices[3];
-			int normal_indices[3];
-			sscanf(
-					line,
-					"f %d/%d/%d %d/%d/%d %d/%d/%d",
-					&vertex_indices[0], &uv_indices[0], &normal_indices[0],
-					&vertex_indices[1], &uv_indices[1], &normal_indices[1],
-					&vertex_indices[2], &uv_indices[2], &normal_indices[2]
-			);
-
-			face_t face;
-
-			face.a = vertex_indices[0] - 1;
-			face.b = vertex_indices[1] - 1;
-			face.c = vertex_indices[2] - 1;
-			face.a_uv = texcoords[uv_indices[0] - 1];
-			face.b_uv = texcoords[uv_indices[1] - 1];
-			face.c_uv = texcoords[uv_indices[2] - 1];
-			face.color = MESH_DEBUG_COLOR;
-
-			// printf("%i %i %i\n", face.a, face.b, face.c);
-
-			array_push(mesh->faces, face);
+static bool write_mesh_file_array(FILE* file, void* items, size_t items_size) {
+	// the array header is filled in by array_wrap() on load
+	uint8_t zeros[ARRAY_HEADER_SIZE] = { 0 };
+	size_t padding = get_mesh_file_array_size(items_size) - ARRAY_HEADER_SIZE - items_size;
+	return fwrite(zeros, ARRAY_HEADER_SIZE, 1, file) == 1 &&
+		fwrite(items, 1, items_size, file) == items_size &&
+		fwrite(zeros, 1, padding, file) == padding;
+}
+
+bool save_mesh_file(mesh_t* mesh, char* filename, mesh_file_source_t* source) {
+	// written aside and renamed over, so a reader never maps half a file. Every
+	// writer gets its own temporary, two loads of one OBJ may save at once
+	size_t length = strlen(filename);
+	char* temp_filename = malloc(length + sizeof(".XXXXXX"));
+	memcpy(temp_filename, filename, length);
+	memcpy(temp_filename + length, ".XXXXXX", sizeof(".XXXXXX"));
+	int fd = mkstemp(temp_filename);
+	// mkstemp() leaves the file private to the owner, fopen() would not have
+	FILE* file = fd != -1 && fchmod(fd, 0644) == 0 ? fdopen(fd, "wb") : NULL;
+	if (file == NULL) {
+		printf("Could not open %s for writing\n", temp_filename);
+		if (fd != -1) {
+			close(fd);
+			remove(temp_filename);
 		}
+		free(temp_filename);
+		return false;
+	}
+	mesh_file_header_t header = {
+		.version = MESH_FILE_VERSION,
+		.vertices_count = array_length(mesh->vertices),
+		.faces_count = array_length(mesh->faces),
+		.source = *source,
+		.bounds_min = { FLT_MAX, FLT_MAX, FLT_MAX },
+		.bounds_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX }
+	};
+	memcpy(header.magic, MESH_FILE_MAGIC, sizeof(header.magic));
+	for (uint32_t i = 0; i < header.vertices_count; i++) {
+		vec3_t* vertex = &mesh->vertices[i];
+		header.bounds_min = (vec3_t){ MIN(header.bounds_min.x, vertex->x), MIN(header.bounds_min.y, vertex->y), MIN(header.bounds_min.z, vertex->z) };
+		header.bounds_max = (vec3_t){ MAX(header.bounds_max.x, vertex->x), MAX(header.bounds_max.y, vertex->y), MAX(header.bounds_max.z, vertex->z) };
+	}
+	bool is_written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		write_mesh_file_array(file, mesh->vertices, sizeof(vec3_t) * header.vertices_count) &&
+		write_mesh_file_array(file, mesh->normals, sizeof(vec3_t) * header.vertices_count) &&
+		write_mesh_file_array(file, mesh->faces, sizeof(face_t) * header.faces_count);
+	is_written = fclose(file) == 0 && is_written && rename(temp_filename, filename) == 0;
+	if (!is_written) {
+		printf("Could not write %s\n", filename);
+		remove(temp_filename);
+	}
+	free(temp_filename);
+	return is_written;
+}
+
+char* get_mesh_file_name(char* obj_filename) {
+	return replace_file_extension(obj_filename, MESH_FILE_EXTENSION);
+}
+
+void load_mesh_obj_data(mesh_t* mesh, char* obj_filename) {
+	char* filename = get_mesh_file_name(obj_filename);
+	if (load_mesh_file(mesh, filename, obj_filename)) {
+		free(filename);
+		return;
+	}
+	// stat before mapping, an edit while parsing then leaves the file stale
+	struct stat obj_stat;
+	size_t size = 0;
+	char* data = stat(obj_filename, &obj_stat) == 0 ? map_file(obj_filename, &size) : NULL;
+	if (data == NULL) {
+		printf("Could not open %s\n", obj_filename);
+		free(filename);
+		return;
+	}
+	bool is_parsed = size >= OBJ_PARALLEL_MIN_SIZE ?
+		parse_obj_data_parallel(mesh, data, size, 0) :
+		parse_obj_data(mesh, data, size);
+	if (is_parsed) {
+		process_loaded_mesh(mesh);
+	} else {
+		printf("Could not load %s\n", obj_filename);
 	}
+#ifndef __EMSCRIPTEN__
+	// the preloaded file system is gone by the next launch
+	if (is_parsed) {
+		mesh_file_source_t source = {
+			.mtime = obj_stat.st_mtime,
+			.size = size,
+			.hash = hash_data(data, size)
+		};
+		save_mesh_file(mesh, filename, &source);
+	}
+#endif
+	unmap_file(data, size);
+	free(filename);
+}
 
-	mesh->vertices_count = vertices_count;
+void load_mesh_glb_data(mesh_t* mesh, char* glb_filename) {
+	size_t size = 0;
+	uint8_t* data = map_file(glb_filename, &size);
+	if (data == NULL) {
+		printf("Could not open %s\n", glb_filename);
+		return;
+	}
+	// attributes and the embedded texture are copied out, the file is not kept
+	if (parse_glb_data(mesh, data, size, glb_filename)) {
+		process_loaded_mesh(mesh);
+	} else {
+		printf("Could not load %s\n", glb_filename);
+	}
+	unmap_file(data, size);
+}
 
-	array_free(texcoords);
+void load_mesh_data(mesh_t* mesh, char* mesh_filename) {
+	char* dot = strrchr(mesh_filename, '.');
+	if (dot != NULL && strcmp(dot, ".glb") == 0) {
+		load_mesh_glb_data(mesh, mesh_filename);
+	} else {
+		load_mesh_obj_data(mesh, mesh_filename);
+	}
 }
 
 void load_mesh_png_data(mesh_t* mesh, char* png_filename) {
-	mesh->texture = load_png_data(png_filename);
+	// replaces a texture embedded in the mesh file
+	release_texture(mesh->texture);
+	mesh->texture = acquire_texture(png_filename);
+}
+
+char* get_embedded_texture_name(char* mesh_filename) {
+	size_t length = strlen(mesh_filename);
+	char* name = malloc(length + sizeof(MESH_EMBEDDED_TEXTURE_SUFFIX));
+	memcpy(name, mesh_filename, length);
+	memcpy(name + length, MESH_EMBEDDED_TEXTURE_SUFFIX, sizeof(MESH_EMBEDDED_TEXTURE_SUFFIX));
+	return name;
+}
+
+texture_2d_t* cache_embedded_texture(char* mesh_filename, texture_2d_t* texture) {
+	char* name = get_embedded_texture_name(mesh_filename);
+	texture_2d_t* cached = acquire_cached_texture(name);
+	if (cached != NULL) {
+		// decoded again by a second load, nothing has seen this copy yet
+		free_texture(texture);
+		texture = cached;
+	} else {
+		insert_cached_texture(name, texture);
+	}
+	free(name);
+	return texture;
+}
+
+mesh_t* load_mesh_async(
+	char* mesh_filename,
+	char* png_filename,
+	vec3_t scale,
+	vec3_t translation,
+	vec3_t rotation
+) {
+	mesh_t* mesh = make_pool_mesh();
+	// no faces until the loader hands the parsed data over, so nothing gets drawn
+	mesh->vertices = NULL;
+	mesh->normals = NULL;
+	mesh->faces = NULL;
+	mesh->mapping = NULL;
+	mesh->quantized_vertices = NULL;
+	mesh->quantized_faces = NULL;
+	mesh->vertices_count = 0;
+	load_mesh_data_async(mesh, mesh_filename);
+	if (png_filename != NULL) {
+		load_mesh_png_data_async(mesh, png_filename);
+	} else {
+		// until the embedded texture arrives with the mesh
+		mesh->texture = acquire_placeholder_texture();
+	}
+	init_mesh_common_properties(mesh);
+
+	return mesh;
+}
+
+void load_mesh_png_data_async(mesh_t* mesh, char* png_filename) {
+	load_texture_async(png_filename, &mesh->texture);
 }
 
 void init_mesh_common_properties(mesh_t* mesh) {
@@ -1,6 +1,9 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
 #include "vector.h"
 #include "matrix.h"
 #include "quaternion.h"
@@ -8,11 +11,58 @@
 #include "upng.h"
 #include "texture.h"
 
+#define MESH_FILE_EXTENSION ".mesh"
+#define MESH_FILE_MAGIC "RMSH"
+#define MESH_FILE_VERSION 3
+// Cache name of the texture embedded in a mesh file, appended to its path
+#define MESH_EMBEDDED_TEXTURE_SUFFIX "#0"
+
+// Loaded meshes weld vertices closer than this on every axis whose normals are
+// within MESH_WELD_NORMAL_TOLERANCE (1 - cosine, about 0.8 degrees)
+#define MESH_WELD_TOLERANCE 1e-5f
+#define MESH_WELD_NORMAL_TOLERANCE 1e-4f
+// Meshes loaded without normals get smooth ones, split where faces meet at a
+// sharper angle than this (60 degrees)
+#define MESH_CREASE_ANGLE 1.0471976f
+
+// 10 bytes instead of the 24 of a vec3_t position and normal. The position is
+// quantized to 16 bits per axis inside the mesh bounds, the normal octahedral
+// encoded in 2 x 16 bits
+typedef struct {
+	uint16_t position[3];
+	int16_t normal[2];
+} quantized_vertex_t;
+
+// face_t with half float UVs, 28 bytes instead of 40
+typedef struct {
+	int a;
+	int b;
+	int c;
+	uint16_t uvs[6];
+	uint32_t color;
+} quantized_face_t;
+
+// Names a mesh in the pool. A handle outlives its mesh safely: once the mesh
+// is disposed the slot's generation moves on and lookups return NULL.
+// Generation 0 is never handed out, meshes outside the pool carry it
+typedef struct {
+	int index;
+	uint32_t generation;
+} mesh_handle_t;
+
 typedef struct {
 	vec3_t* vertices;
 	vec3_t* normals;
 	face_t* faces;
 	texture_2d_t* texture;
+	// set when the arrays point into a mapped mesh file instead of the heap
+	void* mapping;
+	size_t mapping_size;
+	// take the place of vertices, normals and faces once quantize_mesh() ran
+	quantized_vertex_t* quantized_vertices;
+	quantized_face_t* quantized_faces;
+	// takes quantized positions back to model space
+	mat4_t dequantize_matrix;
 
 	vec3_t rotation;
 	vec3_t scale;
@@ -26,22 +76,124 @@ typedef struct {
 	
 	quat_t quaternion;
 
-	int idx;
+	mesh_handle_t handle;
 	int vertices_count;
 } mesh_t;
 
+// The OBJ a mesh file was built from. A file whose source changed size, or
+// changed time and contents, is stale
+typedef struct {
+	int64_t mtime;
+	uint64_t size;
+	uint64_t hash;
+} mesh_file_source_t;
+
+// A mesh file is this header followed by the vertices, normals and faces, each
+// with room for an array header in front so they are used in place and padded
+// to keep the next one aligned
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t vertices_count;
+	uint32_t faces_count;
+	mesh_file_source_t source;
+	vec3_t bounds_min;
+	vec3_t bounds_max;
+} mesh_file_header_t;
+
+// mesh_filename is an OBJ or a binary glTF (.glb). png_filename may be NULL
+// for a .glb with an embedded texture, it takes precedence otherwise
 mesh_t* load_mesh(
-	char* obj_filename,
+	char* mesh_filename,
 	char* png_filename,
 	vec3_t scale,
 	vec3_t translation,
 	vec3_t rotation
 );
+// Picks the OBJ or glTF loader by extension
+void load_mesh_data(mesh_t* mesh, char* mesh_filename);
+void load_mesh_glb_data(mesh_t* mesh, char* glb_filename);
+// Maps the mesh file next to the OBJ when it is up to date, otherwise parses
+// the OBJ and writes a new mesh file for the next launch
 void load_mesh_obj_data(mesh_t* mesh, char* obj_filename);
+// Maps a mesh file written by save_mesh_file(), false when it is invalid or
+// stale for obj_filename
+bool load_mesh_file(mesh_t* mesh, char* filename, char* obj_filename);
+bool save_mesh_file(mesh_t* mesh, char* filename, mesh_file_source_t* source);
+// "dir/name.obj" -> "dir/name.mesh", to be freed by the caller
+char* get_mesh_file_name(char* obj_filename);
 void load_mesh_png_data(mesh_t* mesh, char* png_filename);
+// "dir/name.glb" -> "dir/name.glb#0", to be freed by the caller
+char* get_embedded_texture_name(char* mesh_filename);
+// Main thread only. Hands the texture a mesh file embedded to the cache, so it is
+// shared and released like any other. Returns the caller's reference, to the
+// resident copy when the file was loaded before
+texture_2d_t* cache_embedded_texture(char* mesh_filename, texture_2d_t* texture);
+
+// Same as above but through the asset loader threads, see loader.h
+mesh_t* load_mesh_async(
+	char* mesh_filename,
+	char* png_filename,
+	vec3_t scale,
+	vec3_t translation,
+	vec3_t rotation
+);
+void load_mesh_png_data_async(mesh_t* mesh, char* png_filename);
 
 void mesh_update_world_matrix(mesh_t *mesh);
 
+// Merges vertices within tolerance of each other and with matching normals
+// (1 - cosine within normal_tolerance, vertices without a normal only merge
+// with each other) using a spatial hash. Faces that collapse are dropped.
+// Returns the number of vertices removed
+int weld_mesh_vertices(mesh_t* mesh, float tolerance, float normal_tolerance);
+// Replaces the normals with corner angle weighted averages of the adjacent
+// face normals. Faces meeting at more than crease_angle (radians) do not
+// smooth into each other, vertices on such creases are duplicated
+void generate_mesh_normals(mesh_t* mesh, float crease_angle);
+
+// Meshes loaded from files after this call are quantized, see quantize_mesh()
+void set_mesh_quantization(bool is_enabled);
+bool is_mesh_quantization_enabled(void);
+// Moves the vertices, normals and faces into the compact quantized arrays and
+// frees the float ones. Positions keep about 1/65535 of the bounds, normals
+// about 0.03 degrees, UVs 11 significant bits. Zero normals come back as +z.
+// Meshes whose vertices get animated on the CPU have to stay unquantized
+void quantize_mesh(mesh_t* mesh);
+
+static inline float half_to_float(uint16_t half) {
+	// shifting the exponent and mantissa into place and scaling by 2^(127 - 15)
+	// rebiases the exponent, subnormal halves included
+	uint32_t bits = (uint32_t)(half & 0x7fff) << 13;
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	value *= 0x1p112f;
+	memcpy(&bits, &value, sizeof(bits));
+	// infinity and NaN keep the largest exponent
+	if (value >= 65536.0f) {
+		bits |= 0xffu << 23;
+	}
+	bits |= (uint32_t)(half & 0x8000) << 16;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static inline vec3_t decode_octahedral_normal(const int16_t encoded[2]) {
+	vec3_t normal = { encoded[0] / 32767.0f, encoded[1] / 32767.0f, 0 };
+	normal.z = 1.0f - fabsf(normal.x) - fabsf(normal.y);
+	// unfold the lower hemisphere from the corners of the square
+	float fold = normal.z < 0 ? -normal.z : 0;
+	normal.x += normal.x >= 0 ? -fold : fold;
+	normal.y += normal.y >= 0 ? -fold : fold;
+	float length = sqrtf(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+	normal.x /= length;
+	normal.y /= length;
+	normal.z /= length;
+	return normal;
+}
+
+// Generated meshes made with the same parameters share their vertices,
+// normals and faces, see geometry.h
 mesh_t* make_plane(
 	float width,
 	float height,
@@ -82,9 +234,22 @@ mesh_t* make_torus(
 	float arc
 );
 void init_mesh_common_properties(mesh_t* mesh);
+// Gives a mesh sharing generated geometry its own copy to modify
+void detach_mesh_geometry(mesh_t* mesh);
+// Gives mesh heap copies of the geometry source holds, quantized arrays included
+void copy_mesh_geometry(mesh_t* mesh, mesh_t* source);
 
+// Meshes live in a pool that grows in blocks, so a mesh_t* stays valid until
+// the mesh is disposed. Live meshes are also kept in one dense list for
+// iterating: index 0 to get_meshes_count() - 1, in no particular order, and
+// disposing a mesh moves the last one into its place
 int get_meshes_count(void);
 mesh_t* get_mesh(int index);
+// NULL once the mesh is disposed
+mesh_t* get_mesh_by_handle(mesh_handle_t handle);
+// Frees the mesh data. Pool meshes also give their slot back for reuse and
+// drop their pending async loads. Meshes tracked by the scene snapshots have
+// to live until dispose_meshes()
 void dispose_mesh(mesh_t* mesh);
 void dispose_meshes(void);
 
@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+#include "arena.h"
+#include "array.h"
+#include "utils.h"
+#include "obj.h"
+
+// Mantissas up to 19 digits fit an uint64_t, any further digits only shift the
+// exponent. Up to 10^22 powers of ten are exact in a double
+#define OBJ_MAX_MANTISSA_DIGITS 19
+#define OBJ_MAX_EXACT_POWER 22
+
+#define OBJ_MAX_THREADS 16
+
+// what a walk over a chunk of text does with each line
+enum obj_pass {
+	OBJ_PASS_COUNT = 0x1,
+	OBJ_PASS_ATTRIBUTES = 0x2,
+	OBJ_PASS_FACES = 0x4
+};
+
+typedef struct {
+	int positions_count;
+	int texcoords_count;
+	int normals_count;
+	int triangles_count;
+	int lines_count;
+} obj_counts_t;
+
+typedef struct {
+	int position;
+	int texcoord;
+	int normal;
+} obj_corner_t;
+
+// Every array is sized from the counting pass, chunks write their elements
+// straight into them at the offsets of the chunks before them. What only lives
+// for the parse comes from one scratch arena
+typedef struct {
+	obj_counts_t totals;
+	vec3_t* positions;
+	vec3_t* normals;
+	face_t* faces;
+	arena_t scratch;
+	tex2_t* texcoords;
+	vec3_t* file_normals;
+	// parallel faces pass only: the file normal of every triangle corner, -1 for
+	// none, applied afterwards in file order so the last reference still wins
+	int* corner_normals;
+} obj_arrays_t;
+
+typedef struct {
+	const char* start;
+	const char* end;
+	int passes;
+	obj_arrays_t* arrays;
+	obj_counts_t counts;
+	obj_counts_t offsets;
+	// line number of the first malformed line, 0 when there is none
+	int error_line;
+} obj_chunk_t;
+
+static const double powers_of_ten[OBJ_MAX_EXACT_POWER + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool is_obj_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool is_obj_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static inline const char* skip_obj_spaces(const char* p, const char* end) {
+	while (p < end && is_obj_space(*p)) {
+		p++;
+	}
+	return p;
+}
+
+static inline const char* find_obj_line_end(const char* p, const char* end) {
+	const char* newline = memchr(p, '\n', end - p);
+	return newline != NULL ? newline : end;
+}
+
+// Decimal and scientific notation without going through strtod(). The result is
+// rounded twice, to double and then to float, which is exact for anything an
+// exporter writes with up to 15 significant digits. NULL when no number starts at p
+static const char* parse_obj_float(const char* p, const char* end, float* value) {
+	bool is_negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		is_negative = *p == '-';
+		p++;
+	}
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool has_digits = false;
+	for (; p < end && is_obj_digit(*p); p++) {
+		has_digits = true;
+		if (digits < OBJ_MAX_MANTISSA_DIGITS) {
+			mantissa = mantissa * 10 + (*p - '0');
+			// leading zeros are not significant
+			digits += mantissa != 0;
+		} else {
+			exponent++;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && is_obj_digit(*p); p++) {
+			has_digits = true;
+			if (digits < OBJ_MAX_MANTISSA_DIGITS) {
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	if (!has_digits) {
+		return NULL;
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char* exponent_start = p++;
+		bool is_exponent_negative = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			is_exponent_negative = *p == '-';
+			p++;
+		}
+		if (p < end && is_obj_digit(*p)) {
+			int written_exponent = 0;
+			for (; p < end && is_obj_digit(*p); p++) {
+				written_exponent = MIN(written_exponent * 10 + (*p - '0'), 1000);
+			}
+			exponent += is_exponent_negative ? -written_exponent : written_exponent;
+		} else {
+			// "1e" is the number 1 followed by garbage
+			p = exponent_start;
+		}
+	}
+	double result = (double)mantissa;
+	if (exponent < 0 && exponent >= -OBJ_MAX_EXACT_POWER) {
+		result /= powers_of_ten[-exponent];
+	} else if (exponent > 0 && exponent <= OBJ_MAX_EXACT_POWER) {
+		result *= powers_of_ten[exponent];
+	} else if (exponent != 0 && mantissa != 0) {
+		result *= pow(10.0, exponent);
+	}
+	*value = (float)(is_negative ? -result : result);
+	return p;
+}
+
+static const char* parse_obj_int(const char* p, const char* end, int* value) {
+	bool is_negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		is_negative = *p == '-';
+		p++;
+	}
+	if (p == end || !is_obj_digit(*p)) {
+		return NULL;
+	}
+	int64_t result = 0;
+	for (; p < end && is_obj_digit(*p); p++) {
+		result = MIN(result * 10 + (*p - '0'), INT32_MAX);
+	}
+	*value = (int)(is_negative ? -result : result);
+	return p;
+}
+
+// OBJ indices start at 1, negative ones count back from the last element so far.
+// -1 when out of range
+static inline int resolve_obj_index(int index, int parsed_count, int total_count) {
+	int resolved = index > 0 ? index - 1 : parsed_count + index;
+	return index != 0 && resolved >= 0 && resolved < total_count ? resolved : -1;
+}
+
+static void count_obj_chunk(obj_chunk_t* chunk) {
+	obj_counts_t* counts = &chunk->counts;
+	memset(counts, 0, sizeof(obj_counts_t));
+	const char* end = chunk->end;
+	for (const char* line = chunk->start; line < end; counts->lines_count++) {
+		const char* p = skip_obj_spaces(line, end);
+		const char* line_end = find_obj_line_end(p, end);
+		if (line_end - p >= 2 && p[0] == 'v') {
+			counts->positions_count += is_obj_space(p[1]);
+			counts->texcoords_count += p[1] == 't';
+			counts->normals_count += p[1] == 'n';
+		} else if (line_end - p >= 2 && p[0] == 'f' && is_obj_space(p[1])) {
+			// a polygon with n corners fans into n - 2 triangles
+			int corners_count = 0;
+			for (p++; p < line_end && *p != '#'; p++) {
+				corners_count += is_obj_space(p[-1]) && !is_obj_space(p[0]);
+			}
+			counts->triangles_count += MAX(0, corners_count - 2);
+		}
+		line = line_end + 1;
+	}
+}
+
+static const char* parse_obj_vector(const char* p, const char* end, vec3_t* value) {
+	p = parse_obj_float(skip_obj_spaces(p + 2, end), end, &value->x);
+	p = p != NULL ? parse_obj_float(skip_obj_spaces(p, end), end, &value->y) : NULL;
+	return p != NULL ? parse_obj_float(skip_obj_spaces(p, end), end, &value->z) : NULL;
+}
+
+static const char* parse_obj_texcoord(const char* p, const char* end, tex2_t* value) {
+	p = parse_obj_float(skip_obj_spaces(p + 2, end), end, &value->u);
+	// v is optional for 1D texture coordinates
+	const char* v_start = p != NULL ? skip_obj_spaces(p, end) : NULL;
+	if (v_start != NULL && v_start < end && *v_start != '\n') {
+		p = parse_obj_float(v_start, end, &value->v);
+	}
+	return p;
+}
+
+// Fans one "f" line into triangles. parsed holds the global counts up to this
+// line, negative indices are relative to them
+static bool parse_obj_face(const char* p, const char* line_end, obj_arrays_t* arrays, obj_counts_t* parsed) {
+	obj_counts_t* totals = &arrays->totals;
+	obj_corner_t first = { 0 };
+	obj_corner_t previous = { 0 };
+	int corners_count = 0;
+	bool is_valid = true;
+	p = skip_obj_spaces(p + 1, line_end);
+	// a trailing comment ends the corners
+	while (p < line_end && *p != '#' && is_valid) {
+		obj_corner_t corner = { .position = -1, .texcoord = -1, .normal = -1 };
+		int index;
+		p = parse_obj_int(p, line_end, &index);
+		if (p != NULL) {
+			corner.position = resolve_obj_index(index, parsed->positions_count, totals->positions_count);
+		}
+		if (p != NULL && p < line_end && *p == '/') {
+			p++;
+			// v//vn skips the texture coordinate
+			if (p < line_end && *p != '/') {
+				p = parse_obj_int(p, line_end, &index);
+				corner.texcoord = p != NULL ? resolve_obj_index(index, parsed->texcoords_count, totals->texcoords_count) : -1;
+				is_valid = corner.texcoord != -1;
+			}
+			if (p != NULL && p < line_end && *p == '/') {
+				p = parse_obj_int(p + 1, line_end, &index);
+				corner.normal = p != NULL ? resolve_obj_index(index, parsed->normals_count, totals->normals_count) : -1;
+				is_valid = is_valid && corner.normal != -1;
+			}
+		}
+		is_valid = is_valid && p != NULL && corner.position != -1 && (p == line_end || is_obj_space(*p) || *p == '#');
+		if (!is_valid) {
+			break;
+		}
+		p = skip_obj_spaces(p, line_end);
+		if (corner.normal != -1 && arrays->corner_normals == NULL) {
+			arrays->normals[corner.position] = arrays->file_normals[corner.normal];
+		}
+		if (corners_count >= 2) {
+			tex2_t* texcoords = arrays->texcoords;
+			face_t face = {
+				.a = first.position,
+				.b = previous.position,
+				.c = corner.position,
+				.a_uv = first.texcoord != -1 ? texcoords[first.texcoord] : (tex2_t){ 0, 0 },
+				.b_uv = previous.texcoord != -1 ? texcoords[previous.texcoord] : (tex2_t){ 0, 0 },
+				.c_uv = corner.texcoord != -1 ? texcoords[corner.texcoord] : (tex2_t){ 0, 0 },
+				.color = MESH_DEBUG_COLOR
+			};
+			if (arrays->corner_normals != NULL) {
+				int* corner_normals = &arrays->corner_normals[parsed->triangles_count * 3];
+				corner_normals[0] = first.normal;
+				corner_normals[1] = previous.normal;
+				corner_normals[2] = corner.normal;
+			}
+			arrays->faces[parsed->triangles_count++] = face;
+		} else if (corners_count == 0) {
+			first = corner;
+		}
+		previous = corner;
+		corners_count++;
+	}
+	return is_valid && corners_count >= 3;
+}
+
+static void parse_obj_chunk(obj_chunk_t* chunk) {
+	if (chunk->passes & OBJ_PASS_COUNT) {
+		count_obj_chunk(chunk);
+		return;
+	}
+	obj_arrays_t* arrays = chunk->arrays;
+	bool parse_attributes = chunk->passes & OBJ_PASS_ATTRIBUTES;
+	bool parse_faces = chunk->passes & OBJ_PASS_FACES;
+	const char* end = chunk->end;
+	obj_counts_t parsed = chunk->offsets;
+	int line_number = chunk->offsets.lines_count;
+	bool is_valid = true;
+	for (const char* line = chunk->start; line < end && is_valid; line = find_obj_line_end(line, end) + 1) {
+		line_number++;
+		const char* p = skip_obj_spaces(line, end);
+		if (end - p < 2 || !(p[0] == 'v' || p[0] == 'f')) {
+			// comments, groups, materials and everything else we do not use
+			continue;
+		}
+
+		if (p[0] == 'v' && (is_obj_space(p[1]) || p[1] == 'n')) {
+			bool is_normal = p[1] == 'n';
+			int* count = is_normal ? &parsed.normals_count : &parsed.positions_count;
+			if (parse_attributes) {
+				vec3_t* values = is_normal ? arrays->file_normals : arrays->positions;
+				is_valid = parse_obj_vector(p, end, &values[*count]) != NULL;
+			}
+			*count += 1;
+		} else if (p[0] == 'v' && p[1] == 't') {
+			if (parse_attributes) {
+				arrays->texcoords[parsed.texcoords_count] = (tex2_t){ 0, 0 };
+				is_valid = parse_obj_texcoord(p, end, &arrays->texcoords[parsed.texcoords_count]) != NULL;
+			}
+			parsed.texcoords_count++;
+		} else if (p[0] == 'f' && is_obj_space(p[1]) && parse_faces) {
+			is_valid = parse_obj_face(p, find_obj_line_end(p, end), arrays, &parsed);
+		}
+	}
+	chunk->error_line = is_valid ? 0 : line_number;
+}
+
+static void alloc_obj_arrays(obj_arrays_t* arrays, obj_counts_t* totals, bool has_corner_normals) {
+	arrays->totals = *totals;
+	arrays->positions = array_hold(NULL, totals->positions_count, sizeof(vec3_t));
+	arrays->normals = array_hold(NULL, totals->positions_count, sizeof(vec3_t));
+	arrays->faces = array_hold(NULL, totals->triangles_count, sizeof(face_t));
+	// sized from the counts, so the scratch is a single block
+	size_t texcoords_size = sizeof(tex2_t) * (size_t)totals->texcoords_count;
+	size_t file_normals_size = sizeof(vec3_t) * (size_t)totals->normals_count;
+	size_t corner_normals_size = has_corner_normals ? sizeof(int) * 3 * (size_t)totals->triangles_count : 0;
+	init_arena(&arrays->scratch, texcoords_size + file_normals_size + corner_normals_size + ARENA_ALIGNMENT * 3);
+	arrays->texcoords = arena_alloc(&arrays->scratch, texcoords_size);
+	arrays->file_normals = arena_alloc(&arrays->scratch, file_normals_size);
+	arrays->corner_normals = has_corner_normals ? arena_alloc(&arrays->scratch, corner_normals_size) : NULL;
+	memset(arrays->normals, 0, sizeof(vec3_t) * totals->positions_count);
+}
+
+static bool finish_obj_arrays(mesh_t* mesh, obj_arrays_t* arrays, int error_line) {
+	free_arena(&arrays->scratch);
+	if (error_line != 0) {
+		printf("OBJ parse error on line %d\n", error_line);
+		array_free(arrays->positions);
+		array_free(arrays->normals);
+		array_free(arrays->faces);
+		return false;
+	}
+	mesh->vertices = arrays->positions;
+	mesh->normals = arrays->normals;
+	mesh->faces = arrays->faces;
+	mesh->vertices_count = arrays->totals.positions_count;
+	return true;
+}
+
+bool parse_obj_data(mesh_t* mesh, const char* data, size_t size) {
+	obj_chunk_t chunk = {
+		.start = data,
+		.end = data + size,
+		.passes = OBJ_PASS_COUNT
+	};
+	count_obj_chunk(&chunk);
+	obj_arrays_t arrays;
+	alloc_obj_arrays(&arrays, &chunk.counts, false);
+	chunk.arrays = &arrays;
+	chunk.passes = OBJ_PASS_ATTRIBUTES | OBJ_PASS_FACES;
+	parse_obj_chunk(&chunk);
+	return finish_obj_arrays(mesh, &arrays, chunk.error_line);
+}
+
+static int obj_chunk_thread_main(void* data) {
+	parse_obj_chunk(data);
+	return 0;
+}
+
+// Runs one pass over every chunk, the calling thread taking the first one.
+// Chunks run inline when a thread cannot be created
+static void run_obj_pass(obj_chunk_t* chunks, int chunks_count, int passes) {
+	SDL_Thread* threads[OBJ_MAX_THREADS] = { NULL };
+	for (int i = 0; i < chunks_count; i++) {
+		chunks[i].passes = passes;
+	}
+	for (int i = 1; i < chunks_count; i++) {
+		threads[i] = SDL_CreateThread(obj_chunk_thread_main, "ObjParser", &chunks[i]);
+		if (threads[i] == NULL) {
+			parse_obj_chunk(&chunks[i]);
+		}
+	}
+	parse_obj_chunk(&chunks[0]);
+	for (int i = 1; i < chunks_count; i++) {
+		if (threads[i] != NULL) {
+			SDL_WaitThread(threads[i], NULL);
+		}
+	}
+}
+
+bool parse_obj_data_parallel(mesh_t* mesh, const char* data, size_t size, int threads_count) {
+#ifdef __EMSCRIPTEN__
+	threads_count = 1;
+#endif
+	if (threads_count <= 0) {
+		threads_count = SDL_GetCPUCount();
+	}
+	int chunks_count = CLAMP(1, OBJ_MAX_THREADS, threads_count);
+	if (chunks_count == 1) {
+		return parse_obj_data(mesh, data, size);
+	}
+
+	// even splits moved forward past the end of the line they land in, a chunk
+	// is left empty when the previous one already ran past its split
+	const char* end = data + size;
+	obj_chunk_t chunks[OBJ_MAX_THREADS] = { 0 };
+	const char* chunk_start = data;
+	for (int i = 0; i < chunks_count; i++) {
+		const char* split = i + 1 < chunks_count ? data + size / chunks_count * (i + 1) : end;
+		const char* chunk_end = split > chunk_start ? MIN(find_obj_line_end(split, end) + 1, end) : chunk_start;
+		chunks[i].start = chunk_start;
+		chunks[i].end = chunk_end;
+		chunk_start = chunk_end;
+	}
+
+	run_obj_pass(chunks, chunks_count, OBJ_PASS_COUNT);
+	obj_counts_t totals = { 0 };
+	for (int i = 0; i < chunks_count; i++) {
+		obj_counts_t* counts = &chunks[i].counts;
+		chunks[i].offsets = totals;
+		totals.positions_count += counts->positions_count;
+		totals.texcoords_count += counts->texcoords_count;
+		totals.normals_count += counts->normals_count;
+		totals.triangles_count += counts->triangles_count;
+		totals.lines_count += counts->lines_count;
+	}
+
+	obj_arrays_t arrays;
+	alloc_obj_arrays(&arrays, &totals, totals.normals_count > 0);
+	for (int i = 0; i < chunks_count; i++) {
+		chunks[i].arrays = &arrays;
+	}
+	// faces copy their texture coordinates, which may live in any earlier chunk
+	run_obj_pass(chunks, chunks_count, OBJ_PASS_ATTRIBUTES);
+	int error_line = 0;
+	for (int i = 0; i < chunks_count && error_line == 0; i++) {
+		error_line = chunks[i].error_line;
+	}
+	if (error_line == 0) {
+		run_obj_pass(chunks, chunks_count, OBJ_PASS_FACES);
+		for (int i = 0; i < chunks_count && error_line == 0; i++) {
+			error_line = chunks[i].error_line;
+		}
+	}
+
+	if (error_line == 0 && arrays.corner_normals != NULL) {
+		for (int i = 0; i < totals.triangles_count; i++) {
+			face_t* face = &arrays.faces[i];
+			int* corner_normals = &arrays.corner_normals[i * 3];
+			int vertices[3] = { face->a, face->b, face->c };
+			for (int j = 0; j < 3; j++) {
+				if (corner_normals[j] != -1) {
+					arrays.normals[vertices[j]] = arrays.file_normals[corner_normals[j]];
+				}
+			}
+		}
+	}
+	return finish_obj_arrays(mesh, &arrays, error_line);
+}
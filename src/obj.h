@@ -0,0 +1,27 @@
+#ifndef OBJ_H
+#define OBJ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "mesh.h"
+
+// Parses Wavefront OBJ text into the vertices, normals and faces of a mesh.
+// Faces may use the v, v/vt, v//vn and v/vt/vn forms with positive or negative
+// (relative) indices, polygons are fanned into triangles. Normals end up per
+// vertex, the one a face last referenced, zero for vertices without any.
+//
+// The text is walked twice: once to count every element so the arrays are
+// allocated at their exact size, once to fill them.
+bool parse_obj_data(mesh_t* mesh, const char* data, size_t size);
+
+// Files at least this big are worth splitting across threads
+#define OBJ_PARALLEL_MIN_SIZE (16 << 20)
+
+// Same result as parse_obj_data(), with the text split at line boundaries into
+// one chunk per thread. Every pass runs on all chunks at once: counting, then
+// with the prefix summed counts as each chunk's offsets, the attributes and
+// finally the faces, written straight into the mesh arrays. 0 threads uses one
+// per CPU
+bool parse_obj_data_parallel(mesh_t* mesh, const char* data, size_t size, int threads_count);
+
+#endif
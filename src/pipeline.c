@@ -5,9 +5,78 @@
 #include "display.h"
 #include "utils.h"
 #include "light.h"
+#include "snapshot.h"
 
 static vertex_t varying_world_vertices[3];
 
+static pipeline_rect_t viewport = { 0, 0, 0, 0 };
+static pipeline_rect_t scissor = { 0, 0, 0, 0 };
+static bool is_scissor_enabled = false;
+
+// Pixels inside [clip_min, clip_max) are written without further bounds checks
+static int clip_min_x = 0;
+static int clip_min_y = 0;
+static int clip_max_x = 0;
+static int clip_max_y = 0;
+
+static void update_clip_rect(void) {
+	clip_min_x = viewport.x;
+	clip_min_y = viewport.y;
+	clip_max_x = viewport.x + viewport.width;
+	clip_max_y = viewport.y + viewport.height;
+	if (is_scissor_enabled) {
+		clip_min_x = MAX(clip_min_x, scissor.x);
+		clip_min_y = MAX(clip_min_y, scissor.y);
+		clip_max_x = MIN(clip_max_x, scissor.x + scissor.width);
+		clip_max_y = MIN(clip_max_y, scissor.y + scissor.height);
+	}
+}
+
+void pipeline_set_viewport(int x, int y, int width, int height) {
+	viewport.x = x;
+	viewport.y = y;
+	viewport.width = width;
+	viewport.height = height;
+	update_clip_rect();
+}
+
+pipeline_rect_t pipeline_get_viewport(void) {
+	return viewport;
+}
+
+void pipeline_set_scissor(int x, int y, int width, int height) {
+	scissor.x = x;
+	scissor.y = y;
+	scissor.width = width;
+	scissor.height = height;
+	is_scissor_enabled = true;
+	update_clip_rect();
+}
+
+void pipeline_disable_scissor(void) {
+	is_scissor_enabled = false;
+	update_clip_rect();
+}
+
+static inline bool is_inside_clip_rect(int x, int y) {
+	return x >= clip_min_x && x < clip_max_x && y >= clip_min_y && y < clip_max_y;
+}
+
+static inline void write_fragment(fragment_shader_result_t* fs_out, int x, int y, float depth) {
+	if (fs_out->depth_buffer == NULL) {
+		if (fs_out->color_buffer != NULL) {
+			update_color_buffer_at_unchecked(fs_out->color_buffer, x, y, fs_out->color);
+		}
+	} else {
+		if (depth < get_depth_buffer_at_unchecked(fs_out->depth_buffer, x, y)) {
+			if (fs_out->color_buffer != NULL) {
+				update_color_buffer_at_unchecked(fs_out->color_buffer, x, y, fs_out->color);
+			}
+			update_depth_buffer_at_unchecked(fs_out->depth_buffer, x, y, fs_out->depth);
+		}
+	}
+}
+
 void render_triangle(
 	triangle_t* triangle_to_render,
 	int camera_type,
@@ -117,6 +186,25 @@ void render_triangle(
 	tex2_t b_uv = { u1, v1 };
 	tex2_t c_uv = { u2, v2 };
 
+	// Screen space gradients of u/w, v/w and 1/w are constant across the triangle.
+	// Fragments turn them into UV derivatives for picking a mip level
+	float uw_dx = 0, uw_dy = 0;
+	float vw_dx = 0, vw_dy = 0;
+	float rw_dx = 0, rw_dy = 0;
+	float area = (float)((x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0));
+	if (area != 0) {
+		float inv_area = 1.0f / area;
+		float uw0 = u0 / w0, uw1 = u1 / w1, uw2 = u2 / w2;
+		float vw0 = v0 / w0, vw1 = v1 / w1, vw2 = v2 / w2;
+		float rw0 = 1 / w0, rw1 = 1 / w1, rw2 = 1 / w2;
+		uw_dx = ((uw1 - uw0) * (y2 - y0) - (uw2 - uw0) * (y1 - y0)) * inv_area;
+		uw_dy = ((uw2 - uw0) * (x1 - x0) - (uw1 - uw0) * (x2 - x0)) * inv_area;
+		vw_dx = ((vw1 - vw0) * (y2 - y0) - (vw2 - vw0) * (y1 - y0)) * inv_area;
+		vw_dy = ((vw2 - vw0) * (x1 - x0) - (vw1 - vw0) * (x2 - x0)) * inv_area;
+		rw_dx = ((rw1 - rw0) * (y2 - y0) - (rw2 - rw0) * (y1 - y0)) * inv_area;
+		rw_dy = ((rw2 - rw0) * (x1 - x0) - (rw1 - rw0) * (x2 - x0)) * inv_area;
+	}
+
 	float inv_slope1 = 0;
 	float inv_slope2 = 0;
 
@@ -128,7 +216,9 @@ void render_triangle(
 	}
 
 	if (y1 - y0 != 0) {
-		for (int y = y0; y <= y1; y++) {
+		int y_first = MAX(y0, clip_min_y);
+		int y_last = MIN(y1, clip_max_y - 1);
+		for (int y = y_first; y <= y_last; y++) {
 			int x_start = (y - y1) * inv_slope1 + x1;
 			int x_end = (y - y0) * inv_slope2 + x0;
 
@@ -136,6 +226,8 @@ void render_triangle(
 			if (x_end < x_start) {
 				int_swap(&x_start, &x_end);
 			}
+			x_start = MAX(x_start, clip_min_x);
+			x_end = MIN(x_end, clip_max_x);
 
 			for (int x = x_start; x < x_end; x++) {
 				vec2_t p = { x, y };
@@ -168,6 +260,13 @@ void render_triangle(
 				interpolated_normal_y /= interpolated_reciprocal_w;
 				interpolated_normal_z /= interpolated_reciprocal_w;
 
+				// d(u)/dx = (d(u/w)/dx - u * d(1/w)/dx) * w
+				float w = 1 / interpolated_reciprocal_w;
+				float du_dx = (uw_dx - interpolated_u * rw_dx) * w;
+				float dv_dx = (vw_dx - interpolated_v * rw_dx) * w;
+				float du_dy = (uw_dy - interpolated_u * rw_dy) * w;
+				float dv_dy = (vw_dy - interpolated_v * rw_dy) * w;
+
 				interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
 
 				fragment_shader_triangle_inputs fs_inputs = {
@@ -175,6 +274,10 @@ void render_triangle(
 					.y = y,
 					.u = interpolated_u,
 					.v = interpolated_v,
+					.du_dx = du_dx,
+					.dv_dx = dv_dx,
+					.du_dy = du_dy,
+					.dv_dy = dv_dy,
 					.interpolated_w = interpolated_reciprocal_w,
 					.interpolated_world_space_pos_x = interpolated_x,
 					.interpolated_world_space_pos_y = interpolated_y,
@@ -190,19 +293,8 @@ void render_triangle(
 					mesh,
 					&fs_inputs
 				);
-				
-				if (fs_out.depth_buffer == NULL) {
-					if (fs_out.color_buffer != NULL) {
-						update_color_buffer_at(fs_out.color_buffer, x, y, fs_out.color);
-					}
-				} else {
-					if (interpolated_reciprocal_w < get_depth_buffer_at(fs_out.depth_buffer, x, y)) {
-						if (fs_out.color_buffer != NULL) {
-							update_color_buffer_at(fs_out.color_buffer, x, y, fs_out.color);
-						}
-						update_depth_buffer_at(fs_out.depth_buffer, x, y, fs_out.depth);
-					}
-				}
+
+				write_fragment(&fs_out, x, y, interpolated_reciprocal_w);
 			}
 		}
 	}
@@ -218,15 +310,18 @@ void render_triangle(
 	}
 
 	if (y2 - y1 != 0) {
-		for (int y = y1; y <= y2; y++) {
+		int y_first = MAX(y1, clip_min_y);
+		int y_last = MIN(y2, clip_max_y - 1);
+		for (int y = y_first; y <= y_last; y++) {
 			int x_start = (y - y1) * inv_slope1 + x1;
 			int x_end = (y - y0) * inv_slope2 + x0;
 
-
 			// Swap if x_start is to the right of x_end
 			if (x_end < x_start) {
 				int_swap(&x_start, &x_end);
 			}
+			x_start = MAX(x_start, clip_min_x);
+			x_end = MIN(x_end, clip_max_x);
 
 			for (int x = x_start; x < x_end; x++) {
 				vec2_t p = { x, y };
@@ -260,6 +355,13 @@ void render_triangle(
 				interpolated_normal_y /= interpolated_reciprocal_w;
 				interpolated_normal_z /= interpolated_reciprocal_w;
 
+				// d(u)/dx = (d(u/w)/dx - u * d(1/w)/dx) * w
+				float w = 1 / interpolated_reciprocal_w;
+				float du_dx = (uw_dx - interpolated_u * rw_dx) * w;
+				float dv_dx = (vw_dx - interpolated_v * rw_dx) * w;
+				float du_dy = (uw_dy - interpolated_u * rw_dy) * w;
+				float dv_dy = (vw_dy - interpolated_v * rw_dy) * w;
+
 				interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
 
 				fragment_shader_triangle_inputs fs_inputs = {
@@ -267,6 +369,10 @@ void render_triangle(
 					.y = y,
 					.u = interpolated_u,
 					.v = interpolated_v,
+					.du_dx = du_dx,
+					.dv_dx = dv_dx,
+					.du_dy = du_dy,
+					.dv_dy = dv_dy,
 					.interpolated_w = interpolated_reciprocal_w,
 					.interpolated_world_space_pos_x = interpolated_x,
 					.interpolated_world_space_pos_y = interpolated_y,
@@ -283,18 +389,7 @@ void render_triangle(
 					&fs_inputs
 				);
 
-				if (fs_out.depth_buffer == NULL) {
-					if (fs_out.color_buffer != NULL) {
-						update_color_buffer_at(fs_out.color_buffer, x, y, fs_out.color);
-					}
-				} else {
-					if (interpolated_reciprocal_w < get_depth_buffer_at(fs_out.depth_buffer, x, y)) {
-						if (fs_out.color_buffer != NULL) {
-							update_color_buffer_at(fs_out.color_buffer, x, y, fs_out.color);
-						}
-						update_depth_buffer_at(fs_out.depth_buffer, x, y, fs_out.depth);
-					}
-				}
+				write_fragment(&fs_out, x, y, interpolated_reciprocal_w);
 			}
 		}
 	}
@@ -340,23 +435,25 @@ void render_line(
 		}
 
 
-		fragment_shader_line_inputs fs_inputs = {
-			.x = current_x,
-			.y = current_y
-		};
+		if (is_inside_clip_rect(current_x, current_y)) {
+			fragment_shader_line_inputs fs_inputs = {
+				.x = current_x,
+				.y = current_y
+			};
 
-		fragment_shader_result_t fs_out = fs_shader(
-			camera_type,
-			camera,
-			mesh,
-			&fs_inputs
-		);
+			fragment_shader_result_t fs_out = fs_shader(
+				camera_type,
+				camera,
+				mesh,
+				&fs_inputs
+			);
 
-		if (fs_out.color_buffer != NULL) {
-			update_color_buffer_at(fs_out.color_buffer, current_x, current_y, fs_out.color);
-		}
-		if (fs_out.depth_buffer != NULL) {
-			update_depth_buffer_at(fs_out.depth_buffer, current_x, current_y, fs_out.depth);
+			if (fs_out.color_buffer != NULL) {
+				update_color_buffer_at_unchecked(fs_out.color_buffer, current_x, current_y, fs_out.color);
+			}
+			if (fs_out.depth_buffer != NULL) {
+				update_depth_buffer_at_unchecked(fs_out.depth_buffer, current_x, current_y, fs_out.depth);
+			}
 		}
 
 		error2 += derror2; 
@@ -375,10 +472,12 @@ void draw_rect(
 	mesh_t* mesh,
 	fragment_shader_callback fs_shader
 ) {
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			int current_x = x + i - width / 2;
-			int current_y = y + j - height / 2;
+	int x_first = MAX(x - width / 2, clip_min_x);
+	int x_last = MIN(x - width / 2 + width, clip_max_x);
+	int y_first = MAX(y - height / 2, clip_min_y);
+	int y_last = MIN(y - height / 2 + height, clip_max_y);
+	for (int current_x = x_first; current_x < x_last; current_x++) {
+		for (int current_y = y_first; current_y < y_last; current_y++) {
 
 			fragment_shader_point_inputs fs_inputs = {
 				.x = current_x,
@@ -393,10 +492,10 @@ void draw_rect(
 			);
 
 			if (fs_out.color_buffer != NULL) {
-				update_color_buffer_at(fs_out.color_buffer, current_x, current_y, fs_out.color);
+				update_color_buffer_at_unchecked(fs_out.color_buffer, current_x, current_y, fs_out.color);
 			}
 			if (fs_out.depth_buffer != NULL) {
-				update_depth_buffer_at(fs_out.depth_buffer, current_x, current_y, fs_out.depth);
+				update_depth_buffer_at_unchecked(fs_out.depth_buffer, current_x, current_y, fs_out.depth);
 			}
 		}
 	}
@@ -487,6 +586,28 @@ void render_triangle_as_line(
 	);
 }
 
+// Expands a quantized face to what the float path reads. Positions stay in the
+// quantized space, mesh->dequantize_matrix takes them to model space
+static inline face_t fetch_quantized_face(mesh_t* mesh, int index, vec3_t positions[3], vec3_t normals[3]) {
+	quantized_face_t quantized_face = mesh->quantized_faces[index];
+	int corners[3] = { quantized_face.a, quantized_face.b, quantized_face.c };
+	for (int j = 0; j < 3; j++) {
+		quantized_vertex_t* vertex = &mesh->quantized_vertices[corners[j]];
+		positions[j] = (vec3_t){ vertex->position[0], vertex->position[1], vertex->position[2] };
+		normals[j] = decode_octahedral_normal(vertex->normal);
+	}
+	uint16_t* uvs = quantized_face.uvs;
+	return (face_t){
+		.a = quantized_face.a,
+		.b = quantized_face.b,
+		.c = quantized_face.c,
+		.a_uv = { half_to_float(uvs[0]), half_to_float(uvs[1]) },
+		.b_uv = { half_to_float(uvs[2]), half_to_float(uvs[3]) },
+		.c_uv = { half_to_float(uvs[4]), half_to_float(uvs[5]) },
+		.color = quantized_face.color
+	};
+}
+
 void pipeline_draw(
 	int camera_type,
 	void* camera,
@@ -496,8 +617,20 @@ void pipeline_draw(
 	vertex_shader_callback vs_shader,
 	fragment_shader_callback fs_shader
 ) {
+	// when simulation runs on its own thread, draw its latest published state
+	mesh = snapshot_get_mesh(mesh);
+	camera = snapshot_get_data(camera);
+
 	mesh_update_world_matrix(mesh);
-	int num_faces = array_length(mesh->faces);
+	bool is_quantized = mesh->quantized_faces != NULL;
+	int num_faces = is_quantized ? array_length(mesh->quantized_faces) : array_length(mesh->faces);
+	// dequantizing positions costs nothing on top of the world transform
+	mat4_t model_matrix = is_quantized ?
+		mat4_mul_mat4(mesh->world_matrix, mesh->dequantize_matrix) :
+		mesh->world_matrix;
+
+	float half_viewport_width = viewport.width / 2;
+	float half_viewport_height = viewport.height / 2;
 
 	perspective_camera_t* persp_camera = NULL;
 	orthographic_camera_t* ortho_camera = NULL;
@@ -510,24 +643,30 @@ void pipeline_draw(
 	}
 
 	for (int i = 0; i < num_faces; i++) {
-		face_t face = mesh->faces[i];
+		face_t face;
 		vec3_t face_vertices[3];
 		vec3_t face_normals[3];
 		vec4_t transformed_vertices[3];
-		
-		face_vertices[0] = mesh->vertices[face.a];
-		face_vertices[1] = mesh->vertices[face.b];
-		face_vertices[2] = mesh->vertices[face.c];
 
-		face_normals[0] = mesh->normals[face.a];
-		face_normals[1] = mesh->normals[face.b];
-		face_normals[2] = mesh->normals[face.c];
+		if (is_quantized) {
+			face = fetch_quantized_face(mesh, i, face_vertices, face_normals);
+		} else {
+			face = mesh->faces[i];
+
+			face_vertices[0] = mesh->vertices[face.a];
+			face_vertices[1] = mesh->vertices[face.b];
+			face_vertices[2] = mesh->vertices[face.c];
+
+			face_normals[0] = mesh->normals[face.a];
+			face_normals[1] = mesh->normals[face.b];
+			face_normals[2] = mesh->normals[face.c];
+		}
 
 		for (int j = 0; j < 3; j++) {
 			vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
 			// vec4_t transformed_normal = vec4_from_vec3(face_normals[j]);
 
-			vec4_t world_space_vertex = mat4_mul_vec4(mesh->world_matrix, transformed_vertex);
+			vec4_t world_space_vertex = mat4_mul_vec4(model_matrix, transformed_vertex);
 			// vec4_t world_space_normal = mat4_mul_vec4(mesh->normal_matrix, transformed_normal);
 			transformed_vertices[j] = world_space_vertex;
 			varying_world_vertices[j].position = world_space_vertex;
@@ -609,8 +748,16 @@ void pipeline_draw(
 						triangle_to_render.vertices[j].position
 					);
 				}
+
+				// viewport transform from NDC to pixels, flipping y so it grows downwards
+				vec4_t* position = &triangle_to_render.vertices[j].position;
+				position->x = viewport.x + (position->x + 1) * half_viewport_width;
+				position->y = viewport.y + (1 - position->y) * half_viewport_height;
+
 				// run vertex shader for each vertice
-				(*vs_shader)(camera_type, camera, mesh, &triangle_to_render.vertices[j]);
+				if (vs_shader != NULL) {
+					(*vs_shader)(camera_type, camera, mesh, &triangle_to_render.vertices[j]);
+				}
 			}
 
 			if (render_mode == RENDER_TRIANGLE) {
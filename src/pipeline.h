@@ -16,6 +16,13 @@ enum render_mode {
 	RENDER_TRIANGLE
 };
 
+typedef struct {
+	int x;
+	int y;
+	int width;
+	int height;
+} pipeline_rect_t;
+
 typedef void (*vertex_shader_callback)(
 	int camera_type,
 	void* camera,
@@ -35,6 +42,11 @@ typedef struct {
 	int y;
 	float u;
 	float v;
+	// screen space derivatives of u and v, for texture level of detail
+	float du_dx;
+	float dv_dx;
+	float du_dy;
+	float dv_dy;
 	float interpolated_w;
 	float interpolated_world_space_pos_x;
 	float interpolated_world_space_pos_y;
@@ -61,6 +73,15 @@ typedef fragment_shader_result_t (*fragment_shader_callback)(
 	void* shader_inputs
 );
 
+// The viewport maps NDC to pixels before the vertex shader callback runs. Fragments
+// are only generated inside the viewport intersected with the scissor rectangle,
+// both of which must lie inside the framebuffers the fragment shaders write to.
+void pipeline_set_viewport(int x, int y, int width, int height);
+pipeline_rect_t pipeline_get_viewport(void);
+void pipeline_set_scissor(int x, int y, int width, int height);
+void pipeline_disable_scissor(void);
+
+// vs_shader may be NULL when the viewport transform is all a draw needs
 void pipeline_draw(
 	int camera_type,
 	void* camera,
@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "array.h"
+#include "snapshot.h"
+
+// The shared state packs the index of the most recently published slot in the
+// low bits and a flag telling the reader it has not picked that slot up yet
+#define SNAPSHOT_SLOT_MASK 0x3
+#define SNAPSHOT_FRESH_BIT 0x4
+
+typedef struct {
+	mesh_t* source;
+	bool track_vertices;
+	mesh_t copies[SNAPSHOT_SLOTS_COUNT];
+} snapshot_mesh_entry_t;
+
+typedef struct {
+	void* source;
+	size_t size;
+	void* copies[SNAPSHOT_SLOTS_COUNT];
+} snapshot_data_entry_t;
+
+typedef struct {
+	texture_2d_t* texture;
+	// the first snapshot published without the texture
+	int serial;
+} retired_texture_t;
+
+static bool is_enabled = false;
+
+static snapshot_mesh_entry_t* mesh_entries = NULL;
+static snapshot_data_entry_t* data_entries = NULL;
+
+static int delta_times[SNAPSHOT_SLOTS_COUNT];
+static int elapsed_times[SNAPSHOT_SLOTS_COUNT];
+static int slot_serials[SNAPSHOT_SLOTS_COUNT];
+
+// owned by the simulation thread
+static int publish_serial = 0;
+static retired_texture_t* retired_textures = NULL;
+// serial of the snapshot the render thread is drawing
+static SDL_atomic_t acquired_serial;
+
+// owned by the simulation thread
+static int back_slot = 0;
+// owned by the render thread
+static int front_slot = 2;
+// the middle slot changes hands through this atomic only
+static SDL_atomic_t shared_state;
+static SDL_sem* publish_sem = NULL;
+
+// Older snapshots may still point at a texture the simulation dropped, so it
+// lives on until the render thread has moved to a snapshot taken without it
+static void retire_snapshot_texture(texture_2d_t* texture) {
+	retired_texture_t retired = {
+		.texture = texture,
+		.serial = publish_serial + 1
+	};
+	array_push(retired_textures, retired);
+}
+
+static void free_retired_textures(bool all) {
+	int serial = SDL_AtomicGet(&acquired_serial);
+	for (int i = array_length(retired_textures) - 1; i >= 0; i--) {
+		if (all || serial - retired_textures[i].serial >= 0) {
+			free_texture(retired_textures[i].texture);
+			retired_textures[i] = retired_textures[array_length(retired_textures) - 1];
+			array_pop(retired_textures);
+		}
+	}
+}
+
+void init_scene_snapshots(bool enabled) {
+	is_enabled = enabled;
+	back_slot = 0;
+	front_slot = 2;
+	publish_serial = 0;
+	memset(slot_serials, 0, sizeof(slot_serials));
+	SDL_AtomicSet(&acquired_serial, 0);
+	SDL_AtomicSet(&shared_state, 1);
+	if (is_enabled) {
+		publish_sem = SDL_CreateSemaphore(0);
+		set_texture_retire_callback(retire_snapshot_texture);
+	}
+}
+
+bool scene_snapshots_enabled(void) {
+	return is_enabled;
+}
+
+void snapshot_track_mesh(mesh_t* mesh, bool track_vertices) {
+	if (!is_enabled) {
+		return;
+	}
+	snapshot_mesh_entry_t entry = {
+		.source = mesh,
+		.track_vertices = track_vertices
+	};
+	int vertices_count = array_length(mesh->vertices);
+	for (int i = 0; i < SNAPSHOT_SLOTS_COUNT; i++) {
+		entry.copies[i] = *mesh;
+		if (track_vertices) {
+			entry.copies[i].vertices = array_hold(NULL, vertices_count, sizeof(vec3_t));
+			memcpy(entry.copies[i].vertices, mesh->vertices, sizeof(vec3_t) * vertices_count);
+		}
+	}
+	array_push(mesh_entries, entry);
+}
+
+void snapshot_track_data(void* data, size_t size) {
+	if (!is_enabled) {
+		return;
+	}
+	snapshot_data_entry_t entry = {
+		.source = data,
+		.size = size
+	};
+	for (int i = 0; i < SNAPSHOT_SLOTS_COUNT; i++) {
+		entry.copies[i] = malloc(size);
+		memcpy(entry.copies[i], data, size);
+	}
+	array_push(data_entries, entry);
+}
+
+void publish_scene_snapshot(int delta_time, int elapsed_time) {
+	delta_times[back_slot] = delta_time;
+	elapsed_times[back_slot] = elapsed_time;
+
+	if (!is_enabled) {
+		return;
+	}
+
+	for (int i = 0; i < array_length(mesh_entries); i++) {
+		snapshot_mesh_entry_t* entry = &mesh_entries[i];
+		mesh_t* copy = &entry->copies[back_slot];
+		vec3_t* vertices = copy->vertices;
+		*copy = *entry->source;
+		if (entry->track_vertices) {
+			copy->vertices = vertices;
+			memcpy(vertices, entry->source->vertices, sizeof(vec3_t) * array_length(vertices));
+		}
+	}
+
+	for (int i = 0; i < array_length(data_entries); i++) {
+		snapshot_data_entry_t* entry = &data_entries[i];
+		memcpy(entry->copies[back_slot], entry->source, entry->size);
+	}
+	slot_serials[back_slot] = ++publish_serial;
+
+	// make the writes above visible before handing the slot over, then take
+	// whatever slot the reader is not holding as the next back slot
+	SDL_MemoryBarrierRelease();
+	int previous_state = SDL_AtomicSet(&shared_state, back_slot | SNAPSHOT_FRESH_BIT);
+	back_slot = previous_state & SNAPSHOT_SLOT_MASK;
+
+	SDL_SemPost(publish_sem);
+
+	free_retired_textures(false);
+}
+
+void wait_for_scene_snapshot(void) {
+	if (!is_enabled) {
+		return;
+	}
+	SDL_SemWait(publish_sem);
+	// collapse publishes that happened while we were busy into one wake up
+	while (SDL_SemTryWait(publish_sem) == 0) {
+	}
+}
+
+bool acquire_scene_snapshot(void) {
+	if (!is_enabled) {
+		return true;
+	}
+	if ((SDL_AtomicGet(&shared_state) & SNAPSHOT_FRESH_BIT) == 0) {
+		return false;
+	}
+	int previous_state = SDL_AtomicSet(&shared_state, front_slot);
+	front_slot = previous_state & SNAPSHOT_SLOT_MASK;
+	SDL_MemoryBarrierAcquire();
+	// from here on older snapshots are never read again
+	SDL_AtomicSet(&acquired_serial, slot_serials[front_slot]);
+	return true;
+}
+
+mesh_t* snapshot_get_mesh(mesh_t* mesh) {
+	if (!is_enabled) {
+		return mesh;
+	}
+	for (int i = 0; i < array_length(mesh_entries); i++) {
+		if (mesh_entries[i].source == mesh) {
+			return &mesh_entries[i].copies[front_slot];
+		}
+	}
+	return mesh;
+}
+
+void* snapshot_get_data(void* data) {
+	if (!is_enabled) {
+		return data;
+	}
+	for (int i = 0; i < array_length(data_entries); i++) {
+		if (data_entries[i].source == data) {
+			return data_entries[i].copies[front_slot];
+		}
+	}
+	return data;
+}
+
+int snapshot_get_delta_time(void) {
+	return is_enabled ? delta_times[front_slot] : delta_times[back_slot];
+}
+
+int snapshot_get_elapsed_time(void) {
+	return is_enabled ? elapsed_times[front_slot] : elapsed_times[back_slot];
+}
+
+void free_scene_snapshots(void) {
+	// the render thread is gone by now
+	set_texture_retire_callback(NULL);
+	free_retired_textures(true);
+	array_free(retired_textures);
+	retired_textures = NULL;
+	for (int i = 0; i < array_length(mesh_entries); i++) {
+		if (mesh_entries[i].track_vertices) {
+			for (int j = 0; j < SNAPSHOT_SLOTS_COUNT; j++) {
+				array_free(mesh_entries[i].copies[j].vertices);
+			}
+		}
+	}
+	for (int i = 0; i < array_length(data_entries); i++) {
+		for (int j = 0; j < SNAPSHOT_SLOTS_COUNT; j++) {
+			free(data_entries[i].copies[j]);
+		}
+	}
+	array_free(mesh_entries);
+	array_free(data_entries);
+	mesh_entries = NULL;
+	data_entries = NULL;
+	if (publish_sem != NULL) {
+		SDL_DestroySemaphore(publish_sem);
+		publish_sem = NULL;
+	}
+}
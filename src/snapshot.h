@@ -0,0 +1,39 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "mesh.h"
+
+#define SNAPSHOT_SLOTS_COUNT 3
+
+// Scene snapshots let the simulation and the render thread run side by side.
+// The simulation thread mutates the tracked meshes and data as usual and calls
+// publish_scene_snapshot() at the end of each update. The render thread calls
+// acquire_scene_snapshot() before drawing and reads the tracked state through
+// snapshot_get_mesh() / snapshot_get_data(), which point into the latest complete
+// snapshot. Snapshots live in a lock-free triple buffer, so neither side ever waits
+// on the other.
+//
+// When snapshots are disabled the getters return the tracked objects themselves,
+// so the same demo code runs unchanged on a single thread.
+
+void init_scene_snapshots(bool enabled);
+bool scene_snapshots_enabled(void);
+
+// Tracking must happen during setup, before the render thread is started
+void snapshot_track_mesh(mesh_t* mesh, bool track_vertices);
+void snapshot_track_data(void* data, size_t size);
+
+void publish_scene_snapshot(int delta_time, int elapsed_time);
+void wait_for_scene_snapshot(void);
+bool acquire_scene_snapshot(void);
+
+mesh_t* snapshot_get_mesh(mesh_t* mesh);
+void* snapshot_get_data(void* data);
+int snapshot_get_delta_time(void);
+int snapshot_get_elapsed_time(void);
+
+void free_scene_snapshots(void);
+
+#endif
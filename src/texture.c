@@ -1,32 +1,773 @@
+// realpath(), strdup() and stat() are POSIX, not part of -std=c17
+#define _XOPEN_SOURCE 700
+
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "math.h"
 #include "array.h"
 #include "upng.h"
 #include "utils.h"
 #include "texture.h"
 
+// Offset of texel (x, y) inside a tiled level: tiles are stored row by row and
+// the 16 texels of a tile row by row inside it
+static inline int get_tiled_texel_offset(texture_level_t* level, int x, int y) {
+	int tile = (y >> TEXTURE_TILE_SHIFT) * level->tiles_per_row + (x >> TEXTURE_TILE_SHIFT);
+	int texel = ((y & (TEXTURE_TILE_SIZE - 1)) << TEXTURE_TILE_SHIFT) | (x & (TEXTURE_TILE_SIZE - 1));
+	return (tile << (TEXTURE_TILE_SHIFT * 2)) | texel;
+}
+
+// 5 and 6 bit channels widen by repeating their top bits
+static inline uint32_t expand_565_color(uint16_t color) {
+	uint32_t r = (color >> 11) & 0x1f;
+	uint32_t g = (color >> 5) & 0x3f;
+	uint32_t b = color & 0x1f;
+	r = (r << 3) | (r >> 2);
+	g = (g << 2) | (g >> 4);
+	b = (b << 3) | (b >> 2);
+	return 0xff000000 | (b << 16) | (g << 8) | r;
+}
+
+static inline uint32_t interpolate_block_color(uint32_t c0, uint32_t c1, int w0, int w1) {
+	uint32_t result = 0;
+	for (int i = 0; i < sizeof(result); i++) {
+		uint32_t channel = (GET_BYTE(c0, i) * w0 + GET_BYTE(c1, i) * w1) / (w0 + w1);
+		result |= channel << (8 * i);
+	}
+	return result;
+}
+
+static void get_block_color_palette(uint16_t c0, uint16_t c1, bool is_bc1, uint32_t palette[4]) {
+	palette[0] = expand_565_color(c0);
+	palette[1] = expand_565_color(c1);
+	// BC1 switches to three colors and transparent black when c0 <= c1
+	if (c0 > c1 || !is_bc1) {
+		palette[2] = interpolate_block_color(palette[0], palette[1], 2, 1);
+		palette[3] = interpolate_block_color(palette[0], palette[1], 1, 2);
+	} else {
+		palette[2] = interpolate_block_color(palette[0], palette[1], 1, 1);
+		palette[3] = 0;
+	}
+}
+
+static void get_block_alpha_palette(uint32_t a0, uint32_t a1, uint32_t palette[8]) {
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1) {
+		for (int i = 1; i < 7; i++) {
+			palette[i + 1] = (a0 * (7 - i) + a1 * i) / 7;
+		}
+	} else {
+		for (int i = 1; i < 5; i++) {
+			palette[i + 1] = (a0 * (5 - i) + a1 * i) / 5;
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+static void decode_color_block(const uint8_t* block, bool is_bc1, uint32_t texels[16]) {
+	uint32_t palette[4];
+	get_block_color_palette(block[0] | (block[1] << 8), block[2] | (block[3] << 8), is_bc1, palette);
+	uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t)block[7] << 24);
+	for (int i = 0; i < 16; i++) {
+		texels[i] = palette[(indices >> (i * 2)) & 0x3];
+	}
+}
+
+static void decode_alpha_block(const uint8_t* block, uint32_t texels[16]) {
+	uint32_t palette[8];
+	get_block_alpha_palette(block[0], block[1], palette);
+	uint64_t indices = 0;
+	for (int i = 0; i < 6; i++) {
+		indices |= (uint64_t)block[2 + i] << (8 * i);
+	}
+	for (int i = 0; i < 16; i++) {
+		texels[i] = (texels[i] & 0x00ffffff) | (palette[(indices >> (i * 3)) & 0x7] << 24);
+	}
+}
+
+static void decode_texture_block(int format, const uint8_t* block, uint32_t texels[16]) {
+	if (format == TEXTURE_FORMAT_BC1) {
+		decode_color_block(block, true, texels);
+		return;
+	}
+	decode_color_block(block + 8, false, texels);
+	decode_alpha_block(block, texels);
+}
+
+static inline int get_texture_block_size(int format) {
+	return format == TEXTURE_FORMAT_BC1 ? TEXTURE_BC1_BLOCK_SIZE : TEXTURE_BC3_BLOCK_SIZE;
+}
+
+typedef struct {
+	const uint8_t* block;
+	uint32_t texels[TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE];
+} decoded_block_t;
+
+// Blocks stay decoded per thread, so the four taps of a bilinear footprint and
+// the next pixels of a span mostly hit an already decoded block. Freeing a
+// compressed texture bumps the epoch, which makes every thread drop its cache
+// before a block at a reused address could match
+static _Thread_local decoded_block_t block_cache[TEXTURE_BLOCK_CACHE_WINDOW * TEXTURE_BLOCK_CACHE_WINDOW];
+static _Thread_local unsigned block_cache_epoch = 0;
+static atomic_uint texture_blocks_epoch = 1;
+
+static uint32_t get_compressed_level_texel(texture_level_t* level, int x, int y) {
+	unsigned epoch = atomic_load_explicit(&texture_blocks_epoch, memory_order_relaxed);
+	if (epoch != block_cache_epoch) {
+		memset(block_cache, 0, sizeof(block_cache));
+		block_cache_epoch = epoch;
+	}
+	int block_x = x >> TEXTURE_TILE_SHIFT;
+	int block_y = y >> TEXTURE_TILE_SHIFT;
+	const uint8_t* block = (const uint8_t*)level->texels +
+		(block_y * level->tiles_per_row + block_x) * get_texture_block_size(level->format);
+	// blocks of one window never share a slot
+	int slot = (block_x & (TEXTURE_BLOCK_CACHE_WINDOW - 1)) |
+		((block_y & (TEXTURE_BLOCK_CACHE_WINDOW - 1)) * TEXTURE_BLOCK_CACHE_WINDOW);
+	decoded_block_t* entry = &block_cache[slot];
+	if (entry->block != block) {
+		decode_texture_block(level->format, block, entry->texels);
+		entry->block = block;
+	}
+	return entry->texels[((y & (TEXTURE_TILE_SIZE - 1)) << TEXTURE_TILE_SHIFT) | (x & (TEXTURE_TILE_SIZE - 1))];
+}
+
+static inline uint32_t get_level_texel(texture_level_t* level, int x, int y) {
+	if (level->format != TEXTURE_FORMAT_RGBA8) {
+		return get_compressed_level_texel(level, x, y);
+	}
+	return level->texels[get_tiled_texel_offset(level, x, y)];
+}
+
+static texture_2d_t* decode_png(upng_t* png_image, char* name) {
+	if (png_image == NULL) {
+		return NULL;
+	}
+	// every png format comes out as the canonical RGBA8 layout
+	upng_decode_rgba8(png_image);
+	if (upng_get_error(png_image) != UPNG_EOK) {
+		printf("Texture %s could not be decoded (error %d)\n", name, upng_get_error(png_image));
+		upng_free(png_image);
+		return NULL;
+	}
+	texture_2d_t* texture = make_texture(
+		(uint32_t*)upng_get_buffer(png_image),
+		upng_get_width(png_image),
+		upng_get_height(png_image)
+	);
+	upng_free(png_image);
+	return texture;
+}
+
 texture_2d_t* load_png_data(char* png_filename) {
-	texture_2d_t* png_image = upng_new_from_file(png_filename);
-	if (png_image != NULL) {
-		upng_decode(png_image);
-		if (upng_get_error(png_image) == UPNG_EOK) {
-			return png_image;
+	return decode_png(upng_new_from_file(png_filename), png_filename);
+}
+
+texture_2d_t* load_png_bytes(const uint8_t* data, size_t size, char* name) {
+	return decode_png(upng_new_from_bytes(data, size), name);
+}
+
+// Averages 2x2 texel blocks of src into dst. Odd sized levels repeat their
+// last row / column so every dst texel still reads a full block
+static void downsample_texture_level(texture_level_t* src, texture_level_t* dst) {
+	for (int y = 0; y < dst->height; y++) {
+		uint32_t* row0 = src->texels + MIN(y * 2, src->height - 1) * src->width;
+		uint32_t* row1 = src->texels + MIN(y * 2 + 1, src->height - 1) * src->width;
+		uint32_t* out = dst->texels + y * dst->width;
+		int x = 0;
+#ifdef __SSE2__
+		// two destination texels per iteration while four full source texels are
+		// available. Channels are widened to 16 bits so the sums cannot overflow
+		if (src->width >= 2) {
+			__m128i zero = _mm_setzero_si128();
+			__m128i round = _mm_set1_epi16(2);
+			for (; x + 1 < dst->width && x * 2 + 3 < src->width; x += 2) {
+				__m128i a = _mm_loadu_si128((__m128i*)(row0 + x * 2));
+				__m128i b = _mm_loadu_si128((__m128i*)(row1 + x * 2));
+				__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+				__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+				// lo holds texels 0 and 1, hi texels 2 and 3: fold the horizontal pairs
+				__m128i sum_lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+				__m128i sum_hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+				__m128i sum = _mm_unpacklo_epi64(sum_lo, sum_hi);
+				sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+				_mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(sum, zero));
+			}
+		}
+#endif
+		for (; x < dst->width; x++) {
+			int x0 = MIN(x * 2, src->width - 1);
+			int x1 = MIN(x * 2 + 1, src->width - 1);
+			uint32_t t00 = row0[x0];
+			uint32_t t01 = row0[x1];
+			uint32_t t10 = row1[x0];
+			uint32_t t11 = row1[x1];
+			uint32_t result = 0;
+			for (int i = 0; i < sizeof(result); i++) {
+				uint32_t sum = GET_BYTE(t00, i) + GET_BYTE(t01, i) + GET_BYTE(t10, i) + GET_BYTE(t11, i);
+				result |= ((sum + 2) >> 2) << (8 * i);
+			}
+			out[x] = result;
+		}
+	}
+}
+
+// Copies a linear level into its tiled layout. Texels of partial tiles past the
+// level edge repeat the last row / column
+static void tile_texture_level(texture_level_t* src, texture_level_t* dst) {
+	int tiles_per_column = (dst->height + TEXTURE_TILE_SIZE - 1) >> TEXTURE_TILE_SHIFT;
+	uint32_t* out = dst->texels;
+	for (int tile_y = 0; tile_y < tiles_per_column; tile_y++) {
+		for (int tile_x = 0; tile_x < dst->tiles_per_row; tile_x++) {
+			for (int y = 0; y < TEXTURE_TILE_SIZE; y++) {
+				int src_y = MIN((tile_y << TEXTURE_TILE_SHIFT) + y, src->height - 1);
+				uint32_t* row = src->texels + src_y * src->width;
+				for (int x = 0; x < TEXTURE_TILE_SIZE; x++) {
+					int src_x = MIN((tile_x << TEXTURE_TILE_SHIFT) + x, src->width - 1);
+					*out++ = row[src_x];
+				}
+			}
+		}
+	}
+}
+
+// Bytes of a level in its tiled layout, one tile or one block per 4x4 texels
+static inline size_t get_level_size(texture_level_t* level) {
+	int tiles_per_column = (level->height + TEXTURE_TILE_SIZE - 1) >> TEXTURE_TILE_SHIFT;
+	size_t tile_size = level->format == TEXTURE_FORMAT_RGBA8 ?
+		sizeof(uint32_t) * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE :
+		get_texture_block_size(level->format);
+	return (size_t)level->tiles_per_row * tiles_per_column * tile_size;
+}
+
+// Lays out the full mip chain of a width x height texture and sets texels_size
+// to the bytes it takes, the level texels are left for the caller to point
+static void init_texture_levels(texture_2d_t* texture, int width, int height, int format) {
+	texture->width = width;
+	texture->height = height;
+	texture->format = format;
+	texture->levels_count = 0;
+	texture->texels_size = 0;
+	texture->mapping = NULL;
+	texture->mapping_size = 0;
+	for (;;) {
+		texture_level_t* level = &texture->levels[texture->levels_count++];
+		level->width = width;
+		level->height = height;
+		level->format = format;
+		level->is_pow2 = IS_POW2(width) && IS_POW2(height);
+		level->width_mask = width - 1;
+		level->height_mask = height - 1;
+		level->tiles_per_row = (width + TEXTURE_TILE_SIZE - 1) >> TEXTURE_TILE_SHIFT;
+		texture->texels_size += get_level_size(level);
+		if ((width == 1 && height == 1) || texture->levels_count == TEXTURE_MAX_LEVELS) {
+			break;
+		}
+		width = MAX(1, width / 2);
+		height = MAX(1, height / 2);
+	}
+}
+
+static void alloc_texture_levels(texture_2d_t* texture) {
+	// aligned_alloc() wants a multiple of the alignment, which only blocks can miss
+	size_t size = (texture->texels_size + TEXTURE_ALIGNMENT - 1) & ~(size_t)(TEXTURE_ALIGNMENT - 1);
+	texture->texels = aligned_alloc(TEXTURE_ALIGNMENT, size);
+	assert(texture->texels != NULL);
+}
+
+// Points the levels into texture->texels, one after another
+static void assign_texture_level_texels(texture_2d_t* texture) {
+	uint8_t* texels = (uint8_t*)texture->texels;
+	for (int i = 0; i < texture->levels_count; i++) {
+		texture->levels[i].texels = (uint32_t*)texels;
+		texels += get_level_size(&texture->levels[i]);
+	}
+}
+
+// Swizzles linear levels into one cache line aligned allocation
+static void tile_texture_levels(texture_2d_t* texture, texture_level_t* linear_levels) {
+	alloc_texture_levels(texture);
+	assign_texture_level_texels(texture);
+	for (int i = 0; i < texture->levels_count; i++) {
+		tile_texture_level(&linear_levels[i], &texture->levels[i]);
+	}
+}
+
+texture_2d_t* make_texture(uint32_t* pixels, int width, int height) {
+	texture_2d_t* texture = malloc(sizeof(texture_2d_t));
+	init_texture_levels(texture, width, height, TEXTURE_FORMAT_RGBA8);
+
+	// build the mip chain linearly first, the box filter walks plain rows
+	texture_level_t linear_levels[TEXTURE_MAX_LEVELS];
+	int mip_texels_count = 0;
+	for (int i = 0; i < texture->levels_count; i++) {
+		linear_levels[i].width = texture->levels[i].width;
+		linear_levels[i].height = texture->levels[i].height;
+		if (i > 0) {
+			mip_texels_count += linear_levels[i].width * linear_levels[i].height;
+		}
+	}
+	linear_levels[0].texels = pixels;
+	uint32_t* mip_texels = malloc(sizeof(uint32_t) * MAX(1, mip_texels_count));
+	uint32_t* texels = mip_texels;
+	for (int i = 1; i < texture->levels_count; i++) {
+		linear_levels[i].texels = texels;
+		texels += linear_levels[i].width * linear_levels[i].height;
+		downsample_texture_level(&linear_levels[i - 1], &linear_levels[i]);
+	}
+
+	// then swizzle them
+	tile_texture_levels(texture, linear_levels);
+
+	free(mip_texels);
+	return texture;
+}
+
+static void free_texture_texels(texture_2d_t* texture) {
+	if (texture->format != TEXTURE_FORMAT_RGBA8) {
+		atomic_fetch_add(&texture_blocks_epoch, 1);
+	}
+	if (texture->mapping != NULL) {
+		unmap_file(texture->mapping, texture->mapping_size);
+	} else {
+		free(texture->texels);
+	}
+}
+
+void free_texture(texture_2d_t* texture) {
+	if (texture == NULL) {
+		return;
+	}
+	free_texture_texels(texture);
+	free(texture);
+}
+
+// Bounding box endpoints inset by 1/16 of the box and the nearest palette entry
+// per texel, the usual real time encoder. Cheap and good enough for diffuse maps
+static void encode_color_block(const uint32_t texels[16], uint8_t* block) {
+	int min[3] = { 255, 255, 255 };
+	int max[3] = { 0, 0, 0 };
+	int sum[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 3; c++) {
+			int channel = GET_BYTE(texels[i], c);
+			min[c] = MIN(min[c], channel);
+			max[c] = MAX(max[c], channel);
+			sum[c] += channel;
+		}
+	}
+	int e0[3];
+	int e1[3];
+	int widest = 0;
+	for (int c = 0; c < 3; c++) {
+		int inset = (max[c] - min[c]) >> 4;
+		e0[c] = max[c] - inset;
+		e1[c] = min[c] + inset;
+		if (max[c] - min[c] > max[widest] - min[widest]) {
+			widest = c;
+		}
+	}
+	// the box diagonal runs from min to max on every channel, flip the channels
+	// that fall while the widest one rises so the line follows the colors
+	for (int c = 0; c < 3; c++) {
+		int covariance = 0;
+		for (int i = 0; i < 16; i++) {
+			covariance += (GET_BYTE(texels[i], widest) * 16 - sum[widest]) * (GET_BYTE(texels[i], c) * 16 - sum[c]);
+		}
+		if (covariance < 0) {
+			int_swap(&e0[c], &e1[c]);
 		}
 	}
+	uint16_t c0 = ((e0[0] >> 3) << 11) | ((e0[1] >> 2) << 5) | (e0[2] >> 3);
+	uint16_t c1 = ((e1[0] >> 3) << 11) | ((e1[1] >> 2) << 5) | (e1[2] >> 3);
+	// c0 > c1 selects the four color mode
+	if (c0 < c1) {
+		uint16_t swap = c0;
+		c0 = c1;
+		c1 = swap;
+	}
+	uint32_t indices = 0;
+	if (c0 != c1) {
+		uint32_t palette[4];
+		get_block_color_palette(c0, c1, true, palette);
+		for (int i = 0; i < 16; i++) {
+			int best_index = 0;
+			int best_distance = INT32_MAX;
+			for (int j = 0; j < 4; j++) {
+				int distance = 0;
+				for (int c = 0; c < 3; c++) {
+					int delta = (int)GET_BYTE(texels[i], c) - (int)GET_BYTE(palette[j], c);
+					distance += delta * delta;
+				}
+				if (distance < best_distance) {
+					best_distance = distance;
+					best_index = j;
+				}
+			}
+			indices |= (uint32_t)best_index << (i * 2);
+		}
+	}
+	block[0] = c0 & 0xff;
+	block[1] = c0 >> 8;
+	block[2] = c1 & 0xff;
+	block[3] = c1 >> 8;
+	for (int i = 0; i < 4; i++) {
+		block[4 + i] = GET_BYTE(indices, i);
+	}
+}
+
+static void encode_alpha_block(const uint32_t texels[16], uint8_t* block) {
+	uint32_t min = 255;
+	uint32_t max = 0;
+	for (int i = 0; i < 16; i++) {
+		min = MIN(min, texels[i] >> 24);
+		max = MAX(max, texels[i] >> 24);
+	}
+	uint64_t indices = 0;
+	if (max > min) {
+		uint32_t palette[8];
+		get_block_alpha_palette(max, min, palette);
+		for (int i = 0; i < 16; i++) {
+			int alpha = texels[i] >> 24;
+			int best_index = 0;
+			for (int j = 1; j < 8; j++) {
+				if (abs(alpha - (int)palette[j]) < abs(alpha - (int)palette[best_index])) {
+					best_index = j;
+				}
+			}
+			indices |= (uint64_t)best_index << (i * 3);
+		}
+	}
+	block[0] = max;
+	block[1] = min;
+	for (int i = 0; i < 6; i++) {
+		block[2 + i] = (indices >> (8 * i)) & 0xff;
+	}
+}
+
+void compress_texture(texture_2d_t* texture) {
+	if (texture->format != TEXTURE_FORMAT_RGBA8) {
+		return;
+	}
+	bool is_opaque = true;
+	for (size_t i = 0; i < texture->texels_size / sizeof(uint32_t) && is_opaque; i++) {
+		is_opaque = (texture->texels[i] >> 24) == 0xff;
+	}
+	texture_2d_t compressed;
+	init_texture_levels(&compressed, texture->width, texture->height, is_opaque ? TEXTURE_FORMAT_BC1 : TEXTURE_FORMAT_BC3);
+	alloc_texture_levels(&compressed);
+	assign_texture_level_texels(&compressed);
+
+	int block_size = get_texture_block_size(compressed.format);
+	for (int i = 0; i < texture->levels_count; i++) {
+		// a tile holds exactly the 16 texels of a block in block order
+		size_t blocks_count = get_level_size(&compressed.levels[i]) / block_size;
+		uint32_t* tile = texture->levels[i].texels;
+		uint8_t* block = (uint8_t*)compressed.levels[i].texels;
+		for (size_t j = 0; j < blocks_count; j++) {
+			if (compressed.format == TEXTURE_FORMAT_BC1) {
+				encode_color_block(tile, block);
+			} else {
+				encode_alpha_block(tile, block);
+				encode_color_block(tile, block + 8);
+			}
+			tile += TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+			block += block_size;
+		}
+	}
+
+	free_texture_texels(texture);
+	*texture = compressed;
+}
+
+_Static_assert(sizeof(texture_file_header_t) == TEXTURE_ALIGNMENT, "texture file header must keep tiles aligned");
+
+texture_2d_t* load_texture_file(char* filename) {
+	size_t mapping_size = 0;
+	void* mapping = map_file(filename, &mapping_size);
+	if (mapping == NULL) {
+		return NULL;
+	}
+	if (mapping_size < sizeof(texture_file_header_t)) {
+		unmap_file(mapping, mapping_size);
+		return NULL;
+	}
+
+	texture_file_header_t* header = mapping;
+	texture_2d_t* texture = malloc(sizeof(texture_2d_t));
+	bool is_valid = memcmp(header->magic, TEXTURE_FILE_MAGIC, sizeof(header->magic)) == 0 &&
+		header->version == TEXTURE_FILE_VERSION &&
+		header->width > 0 && header->width <= INT16_MAX &&
+		header->height > 0 && header->height <= INT16_MAX &&
+		header->format <= TEXTURE_FORMAT_BC3;
+	if (is_valid) {
+		init_texture_levels(texture, header->width, header->height, header->format);
+		size_t linear_size = 0;
+		for (int i = 0; i < texture->levels_count; i++) {
+			linear_size += sizeof(uint32_t) * texture->levels[i].width * texture->levels[i].height;
+		}
+		size_t texels_size = header->flags & TEXTURE_FILE_TILED ? texture->texels_size : linear_size;
+		is_valid = (header->format == TEXTURE_FORMAT_RGBA8 || header->flags & TEXTURE_FILE_TILED) &&
+			header->levels_count == texture->levels_count &&
+			header->texels_size == texels_size &&
+			mapping_size >= sizeof(texture_file_header_t) + texels_size;
+	}
+	if (!is_valid) {
+		printf("Texture file %s is invalid or from another version\n", filename);
+		free(texture);
+		unmap_file(mapping, mapping_size);
+		return NULL;
+	}
+
+	uint32_t* file_texels = (uint32_t*)((uint8_t*)mapping + sizeof(texture_file_header_t));
+	if (header->flags & TEXTURE_FILE_TILED) {
+		// zero copy, the pages are only faulted in as the sampler touches them
+		texture->texels = file_texels;
+		texture->mapping = mapping;
+		texture->mapping_size = mapping_size;
+		assign_texture_level_texels(texture);
+		return texture;
+	}
+
+	texture_level_t linear_levels[TEXTURE_MAX_LEVELS];
+	for (int i = 0; i < texture->levels_count; i++) {
+		linear_levels[i].width = texture->levels[i].width;
+		linear_levels[i].height = texture->levels[i].height;
+		linear_levels[i].texels = file_texels;
+		file_texels += linear_levels[i].width * linear_levels[i].height;
+	}
+	tile_texture_levels(texture, linear_levels);
+	unmap_file(mapping, mapping_size);
+	return texture;
+}
+
+bool save_texture_file(texture_2d_t* texture, char* filename, bool tiled) {
+	FILE* file = fopen(filename, "wb");
+	if (file == NULL) {
+		printf("Could not open %s for writing\n", filename);
+		return false;
+	}
+	size_t linear_size = 0;
+	for (int i = 0; i < texture->levels_count; i++) {
+		linear_size += sizeof(uint32_t) * texture->levels[i].width * texture->levels[i].height;
+	}
+	// blocks are only ever stored in tile order
+	tiled = tiled || texture->format != TEXTURE_FORMAT_RGBA8;
+	texture_file_header_t header = {
+		.version = TEXTURE_FILE_VERSION,
+		.width = texture->width,
+		.height = texture->height,
+		.levels_count = texture->levels_count,
+		.flags = tiled ? TEXTURE_FILE_TILED : 0,
+		.texels_size = tiled ? texture->texels_size : linear_size,
+		.format = texture->format
+	};
+	memcpy(header.magic, TEXTURE_FILE_MAGIC, sizeof(header.magic));
+	bool is_written = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (tiled) {
+		is_written = is_written && fwrite(texture->texels, texture->texels_size, 1, file) == 1;
+	} else {
+		uint32_t* row = malloc(sizeof(uint32_t) * texture->width);
+		for (int i = 0; i < texture->levels_count && is_written; i++) {
+			texture_level_t* level = &texture->levels[i];
+			for (int y = 0; y < level->height && is_written; y++) {
+				for (int x = 0; x < level->width; x++) {
+					row[x] = get_level_texel(level, x, y);
+				}
+				is_written = fwrite(row, sizeof(uint32_t) * level->width, 1, file) == 1;
+			}
+		}
+		free(row);
+	}
+	if (fclose(file) != 0 || !is_written) {
+		printf("Could not write %s\n", filename);
+		return false;
+	}
+	return true;
+}
+
+char* get_texture_file_name(char* png_filename) {
+	return replace_file_extension(png_filename, TEXTURE_FILE_EXTENSION);
+}
+
+texture_2d_t* load_texture(char* png_filename) {
+	texture_2d_t* texture = NULL;
+	char* filename = get_texture_file_name(png_filename);
+	struct stat png_stat;
+	struct stat file_stat;
+	if (stat(filename, &file_stat) == 0) {
+		// a png edited after the conversion wins over the stale texture file
+		bool is_stale = stat(png_filename, &png_stat) == 0 && png_stat.st_mtime > file_stat.st_mtime;
+		if (!is_stale) {
+			texture = load_texture_file(filename);
+		}
+	}
+	free(filename);
+	if (texture == NULL) {
+		texture = load_png_data(png_filename);
+	}
+	return texture;
+}
+
+typedef struct {
+	char* path;
+	texture_2d_t* texture;
+	int ref_count;
+	// cache clock value of the last acquire, for picking eviction victims
+	unsigned long last_used;
+} texture_cache_entry_t;
+
+static texture_cache_entry_t* cache_entries = NULL;
+static unsigned long cache_clock = 0;
+static size_t cache_budget = 0;
+static size_t cache_size = 0;
+static texture_retire_callback retire_callback = NULL;
+
+void set_texture_retire_callback(texture_retire_callback callback) {
+	retire_callback = callback;
+}
+
+// another thread may still be drawing with the texture, let it finish first
+static void retire_texture(texture_2d_t* texture) {
+	if (retire_callback != NULL) {
+		retire_callback(texture);
+	} else {
+		free_texture(texture);
+	}
+}
+
+static void remove_texture_cache_entry(int index) {
+	texture_cache_entry_t* entry = &cache_entries[index];
+	cache_size -= entry->texture->texels_size;
+	retire_texture(entry->texture);
+	free(entry->path);
+	// order does not matter, move the last entry into the hole
+	cache_entries[index] = cache_entries[array_length(cache_entries) - 1];
+	array_pop(cache_entries);
+}
+
+static void evict_textures_over_budget(void) {
+	while (cache_budget != 0 && cache_size > cache_budget) {
+		int victim = -1;
+		for (int i = 0; i < array_length(cache_entries); i++) {
+			texture_cache_entry_t* entry = &cache_entries[i];
+			if (entry->ref_count == 0 && (victim == -1 || entry->last_used < cache_entries[victim].last_used)) {
+				victim = i;
+			}
+		}
+		if (victim == -1) {
+			// everything left is in use
+			return;
+		}
+		remove_texture_cache_entry(victim);
+	}
+}
+
+// different spellings of the same file share one entry
+static char* get_texture_cache_key(char* png_filename) {
+	char* path = realpath(png_filename, NULL);
+	if (path == NULL) {
+		path = strdup(png_filename);
+	}
+	return path;
+}
+
+texture_2d_t* acquire_cached_texture(char* png_filename) {
+	char* path = get_texture_cache_key(png_filename);
+	cache_clock++;
+	for (int i = 0; i < array_length(cache_entries); i++) {
+		texture_cache_entry_t* entry = &cache_entries[i];
+		if (strcmp(entry->path, path) == 0) {
+			entry->ref_count++;
+			entry->last_used = cache_clock;
+			free(path);
+			return entry->texture;
+		}
+	}
+	free(path);
 	return NULL;
 }
 
-uint32_t get_pixel(upng_t* texture, int x, int y) {
-	int texture_width = upng_get_width(texture);
-	int texture_height = upng_get_height(texture);
-	if (x < 0 || x >= texture_width || y < 0 || y >= texture_height) {
-		// return a nice debug color
-		return 0xff0000ff;
+void insert_cached_texture(char* png_filename, texture_2d_t* texture) {
+	texture_cache_entry_t entry = {
+		.path = get_texture_cache_key(png_filename),
+		.texture = texture,
+		.ref_count = 1,
+		.last_used = ++cache_clock
+	};
+	array_push(cache_entries, entry);
+	cache_size += texture->texels_size;
+	evict_textures_over_budget();
+}
+
+texture_2d_t* acquire_texture(char* png_filename) {
+	texture_2d_t* texture = acquire_cached_texture(png_filename);
+	if (texture != NULL) {
+		return texture;
+	}
+	texture = load_texture(png_filename);
+	if (texture != NULL) {
+		insert_cached_texture(png_filename, texture);
+	}
+	return texture;
+}
+
+texture_2d_t* acquire_placeholder_texture(void) {
+	texture_2d_t* texture = acquire_cached_texture(TEXTURE_PLACEHOLDER_NAME);
+	if (texture == NULL) {
+		uint32_t texel = TEXTURE_PLACEHOLDER_COLOR;
+		texture = make_texture(&texel, 1, 1);
+		insert_cached_texture(TEXTURE_PLACEHOLDER_NAME, texture);
 	}
-	uint32_t* texture_buffer = (uint32_t*)upng_get_buffer(texture);
-	return texture_buffer[y * texture_width + x];
+	return texture;
+}
+
+void release_texture(texture_2d_t* texture) {
+	if (texture == NULL) {
+		return;
+	}
+	for (int i = 0; i < array_length(cache_entries); i++) {
+		texture_cache_entry_t* entry = &cache_entries[i];
+		if (entry->texture == texture) {
+			assert(entry->ref_count > 0);
+			entry->ref_count--;
+			evict_textures_over_budget();
+			return;
+		}
+	}
+	// not owned by the cache
+	retire_texture(texture);
+}
+
+void set_texture_cache_budget(size_t budget_bytes) {
+	cache_budget = budget_bytes;
+	evict_textures_over_budget();
+}
+
+size_t get_texture_cache_size(void) {
+	return cache_size;
+}
+
+void free_texture_cache(void) {
+	while (array_length(cache_entries) > 0) {
+		texture_cache_entry_t* entry = &cache_entries[0];
+		if (entry->ref_count != 0) {
+			printf("Texture %s is still referenced %d times\n", entry->path, entry->ref_count);
+		}
+		remove_texture_cache_entry(0);
+	}
+	array_free(cache_entries);
+	cache_entries = NULL;
+	cache_clock = 0;
 }
 
 tex2_t tex2_clone(tex2_t* t) {
@@ -34,109 +775,335 @@ tex2_t tex2_clone(tex2_t* t) {
 	return result;
 };
 
+// Power of two levels repeat by masking, everything else clamps to the edge
+static inline int resolve_level_x(texture_level_t* level, int x) {
+	return level->is_pow2 ? x & level->width_mask : CLAMP(0, level->width - 1, x);
+}
+
+static inline int resolve_level_y(texture_level_t* level, int y) {
+	return level->is_pow2 ? y & level->height_mask : CLAMP(0, level->height - 1, y);
+}
+
+// Blends two packed colors with an 8 bit weight, two channels at a time
+static inline uint32_t lerp_color(uint32_t a, uint32_t b, uint32_t weight) {
+	uint32_t inv_weight = 256 - weight;
+	uint32_t rb = (((a & 0x00ff00ff) * inv_weight + (b & 0x00ff00ff) * weight) >> 8) & 0x00ff00ff;
+	uint32_t ag = (((a >> 8) & 0x00ff00ff) * inv_weight + ((b >> 8) & 0x00ff00ff) * weight) & 0xff00ff00;
+	return rb | ag;
+}
+
+// Bilinear blend of a 2x2 texel footprint with 8.8 fixed point weights, tx and ty
+// in 0..256. The four weights are derived so they always sum to exactly 256
+static inline uint32_t bilerp_color(uint32_t t00, uint32_t t10, uint32_t t01, uint32_t t11, uint32_t tx, uint32_t ty) {
+#ifdef __SSE2__
+	int w11 = (tx * ty + 128) >> 8;
+	int w10 = tx - w11;
+	int w01 = ty - w11;
+	int w00 = 256 - tx - ty + w11;
+	__m128i zero = _mm_setzero_si128();
+	// interleave the channels of horizontal neighbours so one multiply-add per row
+	// weighs both texels: [r00 r10 g00 g10 b00 b10 a00 a10]
+	__m128i top = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(t00), _mm_cvtsi32_si128(t10)), zero);
+	__m128i bottom = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(t01), _mm_cvtsi32_si128(t11)), zero);
+	top = _mm_unpacklo_epi16(top, _mm_srli_si128(top, 8));
+	bottom = _mm_unpacklo_epi16(bottom, _mm_srli_si128(bottom, 8));
+	__m128i top_weights = _mm_set1_epi32(w00 | (w10 << 16));
+	__m128i bottom_weights = _mm_set1_epi32(w01 | (w11 << 16));
+	__m128i sum = _mm_add_epi32(_mm_madd_epi16(top, top_weights), _mm_madd_epi16(bottom, bottom_weights));
+	sum = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(128)), 8);
+	sum = _mm_packs_epi32(sum, zero);
+	return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sum, zero));
+#else
+	return lerp_color(lerp_color(t00, t10, tx), lerp_color(t01, t11, tx), ty);
+#endif
+}
+
+static uint32_t sample_level_nearest(texture_level_t* level, float u, float v) {
+	int x = resolve_level_x(level, (int)floorf(u * level->width));
+	int y = resolve_level_y(level, (int)floorf(v * level->height));
+	return get_level_texel(level, x, y);
+}
+
+static uint32_t sample_level_bilinear(texture_level_t* level, float u, float v) {
+	float fx = u * level->width - 0.5f;
+	float fy = v * level->height - 0.5f;
+	int x0 = (int)floorf(fx);
+	int y0 = (int)floorf(fy);
+	uint32_t tx = (uint32_t)((fx - x0) * 256.0f);
+	uint32_t ty = (uint32_t)((fy - y0) * 256.0f);
+	int x1 = resolve_level_x(level, x0 + 1);
+	int y1 = resolve_level_y(level, y0 + 1);
+	x0 = resolve_level_x(level, x0);
+	y0 = resolve_level_y(level, y0);
+	return bilerp_color(
+		get_level_texel(level, x0, y0),
+		get_level_texel(level, x1, y0),
+		get_level_texel(level, x0, y1),
+		get_level_texel(level, x1, y1),
+		tx,
+		ty
+	);
+}
+
 uint32_t sample_texture(texture_2d_t* texture, float u, float v) {
 	if (texture == NULL) {
 		return 0xffff0000;
 	}
-	int texture_width = upng_get_width(texture);
-	int texture_height = upng_get_height(texture);
-	int tex_x = abs((int)(u * texture_width)) % texture_width;
-	int tex_y = abs((int)(v * texture_height)) % texture_height;
-	uint32_t* texture_buffer = (uint32_t*)upng_get_buffer(texture);
-	return texture_buffer[tex_y * texture_width + tex_x];
+	return sample_level_nearest(&texture->levels[0], u, v);
 }
 
-// https://gist.github.com/NickBeeuwsaert/5753386
 uint32_t sample_texture_bilinear(texture_2d_t* texture, float u, float v) {
-	int texture_width = upng_get_width(texture);
-	int texture_height = upng_get_height(texture);
-	float tex_x = fabs(u * (float)(texture_width - 1));
-	float tex_y = fabs(v * (float)(texture_height - 1));
-	int gxi = (int)tex_x;
-	int gyi = (int)tex_y;
-	if (gxi < 0 || gxi >= texture_width - 1 || gyi < 0 || gyi >= texture_height - 1) {
-		// return a nice debug color
-		return 0xff0000ff;
-	}
-	uint32_t t00 = get_pixel(texture, gxi, gyi);
-	uint32_t t01 = get_pixel(texture, gxi + 1, gyi);
-	uint32_t t10 = get_pixel(texture, gxi, gyi + 1);
-	uint32_t t11 = get_pixel(texture, gxi + 1, gyi + 1);
+	if (texture == NULL) {
+		return 0xffff0000;
+	}
+	return sample_level_bilinear(&texture->levels[0], u, v);
+}
 
-	uint32_t result = 0;
-	
-	for(int i = 0; i < sizeof(result); i++){
-		result |= (uint8_t)blerp(
-			GET_BYTE(t00, i),
-			GET_BYTE(t10, i),
-			GET_BYTE(t01, i),
-			GET_BYTE(t11, i),
-			(tex_x - gxi),
-			(tex_y - gyi)
-		) << (8 * i);
+void sample_texture_bilinear_batch(texture_2d_t* texture, const float* u, const float* v, int count, uint32_t* out) {
+	if (texture == NULL) {
+		for (int i = 0; i < count; i++) {
+			out[i] = 0xffff0000;
+		}
+		return;
+	}
+	texture_level_t* level = &texture->levels[0];
+	int i = 0;
+#ifdef __SSE2__
+	// texel coordinates and weights for four samples at once, the fetches and the
+	// blend stay per sample
+	__m128 width = _mm_set1_ps((float)level->width);
+	__m128 height = _mm_set1_ps((float)level->height);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 weight_scale = _mm_set1_ps(256.0f);
+	for (; i + 4 <= count; i += 4) {
+		__m128 fx = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(u + i), width), half);
+		__m128 fy = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(v + i), height), half);
+		// floor: truncate, then step down where truncation rounded up
+		__m128 floor_x = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+		__m128 floor_y = _mm_cvtepi32_ps(_mm_cvttps_epi32(fy));
+		floor_x = _mm_sub_ps(floor_x, _mm_and_ps(_mm_cmpgt_ps(floor_x, fx), one));
+		floor_y = _mm_sub_ps(floor_y, _mm_and_ps(_mm_cmpgt_ps(floor_y, fy), one));
+		int x0[4], y0[4], tx[4], ty[4];
+		_mm_storeu_si128((__m128i*)x0, _mm_cvttps_epi32(floor_x));
+		_mm_storeu_si128((__m128i*)y0, _mm_cvttps_epi32(floor_y));
+		_mm_storeu_si128((__m128i*)tx, _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(fx, floor_x), weight_scale)));
+		_mm_storeu_si128((__m128i*)ty, _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(fy, floor_y), weight_scale)));
+		for (int j = 0; j < 4; j++) {
+			int x1 = resolve_level_x(level, x0[j] + 1);
+			int y1 = resolve_level_y(level, y0[j] + 1);
+			int x = resolve_level_x(level, x0[j]);
+			int y = resolve_level_y(level, y0[j]);
+			out[i + j] = bilerp_color(
+				get_level_texel(level, x, y),
+				get_level_texel(level, x1, y),
+				get_level_texel(level, x, y1),
+				get_level_texel(level, x1, y1),
+				tx[j],
+				ty[j]
+			);
+		}
 	}
+#endif
+	for (; i < count; i++) {
+		out[i] = sample_level_bilinear(level, u[i], v[i]);
+	}
+}
 
-	return result;
+// Level of detail from the screen space UV derivatives, measured in level 0 texels
+float get_texture_lod(texture_2d_t* texture, float du_dx, float dv_dx, float du_dy, float dv_dy) {
+	float dx_u = du_dx * texture->width;
+	float dx_v = dv_dx * texture->height;
+	float dy_u = du_dy * texture->width;
+	float dy_v = dv_dy * texture->height;
+	float rho_squared = MAX(dx_u * dx_u + dx_v * dx_v, dy_u * dy_u + dy_v * dy_v);
+	if (rho_squared <= 1.0f) {
+		return 0;
+	}
+	// log2(sqrt(x)) == 0.5 * log2(x)
+	return 0.5f * log2f(rho_squared);
+}
+
+uint32_t sample_texture_lod(texture_2d_t* texture, float u, float v, float lod, int mip_mode) {
+	if (texture == NULL) {
+		return 0xffff0000;
+	}
+	int max_level = texture->levels_count - 1;
+	if (mip_mode == TEXTURE_MIP_NEAREST || lod <= 0 || max_level == 0) {
+		int level = CLAMP(0, max_level, (int)(lod + 0.5f));
+		return sample_level_nearest(&texture->levels[level], u, v);
+	}
+	if (lod >= max_level) {
+		return sample_level_bilinear(&texture->levels[max_level], u, v);
+	}
+	int level = (int)lod;
+	uint32_t weight = (uint32_t)((lod - level) * 256.0f);
+	uint32_t fine = sample_level_bilinear(&texture->levels[level], u, v);
+	uint32_t coarse = sample_level_bilinear(&texture->levels[level + 1], u, v);
+	return lerp_color(fine, coarse, weight);
+}
+
+uint32_t sample_texture_grad(
+	texture_2d_t* texture,
+	float u,
+	float v,
+	float du_dx,
+	float dv_dx,
+	float du_dy,
+	float dv_dy,
+	int mip_mode
+) {
+	if (texture == NULL) {
+		return 0xffff0000;
+	}
+	float lod = get_texture_lod(texture, du_dx, dv_dx, du_dy, dv_dy);
+	return sample_texture_lod(texture, u, v, lod, mip_mode);
+}
+
+texture_view_t make_color_texture_view(color_framebuffer* framebuffer, int wrap_mode, int filter_mode) {
+	texture_view_t view = {
+		.width = framebuffer->width,
+		.height = framebuffer->height,
+		.color_buffer = framebuffer->buffer,
+		.depth_buffer = NULL,
+		.wrap_mode = wrap_mode,
+		.filter_mode = filter_mode
+	};
+	return view;
+}
+
+texture_view_t make_depth_texture_view(depth_framebuffer* framebuffer, int wrap_mode, int filter_mode) {
+	texture_view_t view = {
+		.width = framebuffer->width,
+		.height = framebuffer->height,
+		.color_buffer = NULL,
+		.depth_buffer = framebuffer->buffer,
+		.wrap_mode = wrap_mode,
+		.filter_mode = filter_mode
+	};
+	return view;
+}
+
+static inline int wrap_texel_coord(int coord, int size, int wrap_mode) {
+	if (wrap_mode == TEXTURE_WRAP_CLAMP) {
+		return CLAMP(0, size - 1, coord);
+	}
+	coord %= size;
+	return coord < 0 ? coord + size : coord;
+}
+
+// Finds the texel index for nearest sampling, or the four texel indices and the
+// blend weights for bilinear sampling, using texel centers at half coordinates
+static void get_texture_view_texels(texture_view_t* view, float u, float v, int texels[4], float* tx, float* ty) {
+	if (view->filter_mode == TEXTURE_FILTER_NEAREST) {
+		int x = wrap_texel_coord((int)floorf(u * view->width), view->width, view->wrap_mode);
+		int y = wrap_texel_coord((int)floorf(v * view->height), view->height, view->wrap_mode);
+		texels[0] = y * view->width + x;
+		return;
+	}
+	float fx = u * view->width - 0.5f;
+	float fy = v * view->height - 0.5f;
+	int x0 = (int)floorf(fx);
+	int y0 = (int)floorf(fy);
+	*tx = fx - x0;
+	*ty = fy - y0;
+	int x1 = wrap_texel_coord(x0 + 1, view->width, view->wrap_mode);
+	int y1 = wrap_texel_coord(y0 + 1, view->height, view->wrap_mode);
+	x0 = wrap_texel_coord(x0, view->width, view->wrap_mode);
+	y0 = wrap_texel_coord(y0, view->height, view->wrap_mode);
+	texels[0] = y0 * view->width + x0;
+	texels[1] = y0 * view->width + x1;
+	texels[2] = y1 * view->width + x0;
+	texels[3] = y1 * view->width + x1;
+}
+
+uint32_t sample_color_texture_view(texture_view_t* view, float u, float v) {
+	int texels[4];
+	float tx = 0;
+	float ty = 0;
+	get_texture_view_texels(view, u, v, texels, &tx, &ty);
+	if (view->filter_mode == TEXTURE_FILTER_NEAREST) {
+		return view->color_buffer[texels[0]];
+	}
+	return bilerp_color(
+		view->color_buffer[texels[0]],
+		view->color_buffer[texels[1]],
+		view->color_buffer[texels[2]],
+		view->color_buffer[texels[3]],
+		(uint32_t)(tx * 256.0f),
+		(uint32_t)(ty * 256.0f)
+	);
+}
+
+float sample_depth_texture_view(texture_view_t* view, float u, float v) {
+	int texels[4];
+	float tx = 0;
+	float ty = 0;
+	get_texture_view_texels(view, u, v, texels, &tx, &ty);
+	if (view->filter_mode == TEXTURE_FILTER_NEAREST) {
+		return view->depth_buffer[texels[0]];
+	}
+	return blerp(
+		view->depth_buffer[texels[0]],
+		view->depth_buffer[texels[1]],
+		view->depth_buffer[texels[2]],
+		view->depth_buffer[texels[3]],
+		tx,
+		ty
+	);
 }
 
 // https://github.com/niepp/srpbr/blob/c33c99ed8122e4972d15b640e543a6c9ff6aa337/texture.h#L138
 // the original method uses left hand z-up coordinate system
 // my method is hacked around right handed y-up coordinate system
-// TODO: need to revisit the calculations, less hacky
-static int direction_to_cubeuv(vec3_t dir, tex2_t* tc) {
-	int face_index = 0;
-	float absX = fabs(dir.x);
-	float absY = fabs(dir.y);
-	float absZ = fabs(dir.z);
-	float ma;
-	if (absZ >= absX && absZ >= absY) {
-		face_index = dir.z > 0.0f ? 2 : 3;
-		tc->u = dir.x;
-		tc->v = dir.z > 0.0f ? dir.y : -dir.y;
-		ma = absZ;
-		tc->u = (tc->u / ma + 1.0f) * 0.5f;
-		tc->v = (tc->v / ma + 1.0f) * 0.5f;
-		if (dir.z > 0) {
-			tc->u = 1.0 - tc->u;
-			tc->v = 1.0 - tc->v;
-		}
-	} else if (absY >= absX) {
-		face_index = dir.y > 0.0f ? 5 : 4;
-		tc->u = dir.y > 0.0f ? -dir.x : dir.x;
-		tc->v = dir.z;
-		ma = absY;
-		tc->u = (tc->u / ma + 1.0f) * 0.5f;
-		tc->v = (tc->v / ma + 1.0f) * 0.5f;
-	} else {
-		face_index = dir.x > 0.0f ? 0 : 1;
-		tc->u = dir.x > 0.0f ? dir.z : -dir.z;
-		tc->v = dir.y;
-		ma = absX;
-		tc->u = (tc->u / ma + 1.0f) * 0.5f;
-		tc->v = 1 - (tc->v / ma + 1.0f) * 0.5f;
-	}
-	return face_index;
+//
+// Picking a face is a few compares feeding selects rather than a branch per axis:
+// u reads z on x faces and x elsewhere, v reads z on y faces and y elsewhere
+static const int cube_face_indices[3][2] = { { 1, 0 }, { 4, 5 }, { 3, 2 } };
+
+static inline int get_cube_face_uv(vec3_t dir, float* u, float* v) {
+	float abs_x = fabsf(dir.x);
+	float abs_y = fabsf(dir.y);
+	float abs_z = fabsf(dir.z);
+	int is_z = abs_z >= abs_x && abs_z >= abs_y;
+	int is_y = !is_z && abs_y >= abs_x;
+	int is_x = !is_z && !is_y;
+	float major = is_z ? dir.z : is_y ? dir.y : dir.x;
+	int is_positive = major > 0.0f;
+	float half_inv_major = 0.5f / fabsf(major);
+	// u follows the major sign on x faces and runs against it on the others,
+	// v is flipped everywhere but on y faces
+	float u_scale = is_x == is_positive ? half_inv_major : -half_inv_major;
+	float v_scale = is_y ? half_inv_major : -half_inv_major;
+	*u = (is_x ? dir.z : dir.x) * u_scale + 0.5f;
+	*v = (is_y ? dir.z : dir.y) * v_scale + 0.5f;
+	return cube_face_indices[is_z * 2 + is_y][is_positive];
 }
 
 texture_cube_t make_cube_texture(char* textures_paths[6]) {
 	texture_cube_t cube_texture = {
 		.width = 0,
-		.height = 0,
-		.face_textures = NULL
+		.height = 0
 	};
 	for (int i = 0; i < 6; i++) {
-		array_push(cube_texture.face_textures, *load_png_data(textures_paths[i]));
+		cube_texture.face_textures[i] = acquire_texture(textures_paths[i]);
+		assert(cube_texture.face_textures[i] != NULL);
 	}
-	int width = upng_get_width(&cube_texture.face_textures[0]);
-	int height = upng_get_height(&cube_texture.face_textures[0]);
-	cube_texture.width = width;
-	cube_texture.height = height;
+	cube_texture.width = cube_texture.face_textures[0]->width;
+	cube_texture.height = cube_texture.face_textures[0]->height;
 	return cube_texture;
 }
 
-static tex2_t cube_uvs = { .u = 0, .v = 0 };
+void free_cube_texture(texture_cube_t* cube_texture) {
+	for (int i = 0; i < 6; i++) {
+		release_texture(cube_texture->face_textures[i]);
+		cube_texture->face_textures[i] = NULL;
+	}
+}
+
 uint32_t sample_cube_texture(texture_cube_t* cube_texture, vec3_t coord) {
-	int face_idx = direction_to_cubeuv(coord, &cube_uvs);
-	texture_2d_t* face_texture = &cube_texture->face_textures[face_idx];
-	return sample_texture(face_texture, cube_uvs.u, cube_uvs.v);
+	float u, v;
+	int face_index = get_cube_face_uv(coord, &u, &v);
+	return sample_texture(cube_texture->face_textures[face_index], u, v);
 }
+
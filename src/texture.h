@@ -1,15 +1,93 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include "vector.h"
 #include "upng.h"
+#include "framebuffer.h"
 
-typedef upng_t texture_2d_t;
+#define TEXTURE_MAX_LEVELS 16
+
+// Texels are stored in 4x4 tiles of one cache line each rather than in rows, so
+// a bilinear footprint nearly always touches a single line no matter which way
+// the triangle walks across the texture
+#define TEXTURE_TILE_SHIFT 2
+#define TEXTURE_TILE_SIZE (1 << TEXTURE_TILE_SHIFT)
+#define TEXTURE_ALIGNMENT 64
+
+// Precompiled textures, written by tools/texture-convert.c next to the source png
+#define TEXTURE_FILE_EXTENSION ".tex"
+#define TEXTURE_FILE_MAGIC "RTEX"
+#define TEXTURE_FILE_VERSION 2
+// texels are stored tiled, ready to be sampled in place
+#define TEXTURE_FILE_TILED 0x1
+
+// Bytes of one compressed 4x4 block, stored where a tile would be
+#define TEXTURE_BC1_BLOCK_SIZE 8
+#define TEXTURE_BC3_BLOCK_SIZE 16
+// Every thread keeps the blocks of an 8x8 block window decoded
+#define TEXTURE_BLOCK_CACHE_WINDOW 8
+
+#define TEXTURE_PLACEHOLDER_NAME "<placeholder>"
+#define TEXTURE_PLACEHOLDER_COLOR 0xff808080
+
+enum texture_format {
+	TEXTURE_FORMAT_RGBA8,
+	// 565 endpoints with 2 bit indices, opaque
+	TEXTURE_FORMAT_BC1,
+	// BC1 color plus 8 bit alpha endpoints with 3 bit indices
+	TEXTURE_FORMAT_BC3
+};
+
+typedef struct {
+	int width;
+	int height;
+	// same as the texture's, kept here so fetching a texel only needs the level
+	int format;
+	// power of two levels wrap with the masks, other sizes clamp
+	bool is_pow2;
+	int width_mask;
+	int height_mask;
+	int tiles_per_row;
+	uint32_t* texels;
+} texture_level_t;
+
+// Level 0 is the decoded image, every following level halves the previous one
+// down to 1x1. All levels share one allocation.
+typedef struct {
+	int width;
+	int height;
+	int format;
+	int levels_count;
+	texture_level_t levels[TEXTURE_MAX_LEVELS];
+	uint32_t* texels;
+	size_t texels_size;
+	// set when the texels point into a mapped texture file instead of the heap
+	void* mapping;
+	size_t mapping_size;
+} texture_2d_t;
+
+// A texture file is this header followed by the texels of every level, level 0
+// first. Tiled files hold the exact texels block of texture_2d_t, linear ones
+// plain rows. Compressed textures are always written tiled. The header is one
+// tile in size so mapped tiles stay aligned.
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t levels_count;
+	uint32_t flags;
+	uint64_t texels_size;
+	uint32_t format;
+	uint8_t reserved[28];
+} texture_file_header_t;
 
 typedef struct {
 	int width;
 	int height;
-	texture_2d_t* face_textures;
+	texture_2d_t* face_textures[6];
 } texture_cube_t;
 
 typedef struct {
@@ -17,12 +95,97 @@ typedef struct {
 	float v;
 } tex2_t;
 
+enum texture_mip_mode {
+	TEXTURE_MIP_NEAREST,
+	TEXTURE_MIP_TRILINEAR
+};
+
+enum texture_wrap_mode {
+	TEXTURE_WRAP_REPEAT,
+	TEXTURE_WRAP_CLAMP
+};
+
+enum texture_filter_mode {
+	TEXTURE_FILTER_NEAREST,
+	TEXTURE_FILTER_BILINEAR
+};
+
+// A texture view samples the memory of a color or depth framebuffer in place,
+// so render targets can be read back by later passes without copying them
+typedef struct {
+	int width;
+	int height;
+	uint32_t* color_buffer;
+	float* depth_buffer;
+	int wrap_mode;
+	int filter_mode;
+} texture_view_t;
+
 texture_2d_t* load_png_data(char* png_filename);
+// PNG already in memory, name is only used in messages
+texture_2d_t* load_png_bytes(const uint8_t* data, size_t size, char* name);
+texture_2d_t* make_texture(uint32_t* pixels, int width, int height);
+void free_texture(texture_2d_t* texture);
+// Re-encodes every level of an RGBA8 texture into 4x4 blocks, BC3 when any texel
+// is translucent and BC1 otherwise. Samplers decode blocks on the fly
+void compress_texture(texture_2d_t* texture);
+
+// Maps a texture file written by save_texture_file(). Tiled files are sampled
+// straight from the mapped pages, linear ones are tiled into memory once
+texture_2d_t* load_texture_file(char* filename);
+bool save_texture_file(texture_2d_t* texture, char* filename, bool tiled);
+// "dir/name.png" -> "dir/name.tex", to be freed by the caller
+char* get_texture_file_name(char* png_filename);
+// Picks the precompiled .tex next to the png when it is at least as new,
+// otherwise decodes the png
+texture_2d_t* load_texture(char* png_filename);
+
+// Textures loaded through the cache are decoded once per canonical path and
+// shared. Every acquire_texture() must be paired with a release_texture().
+// Unreferenced textures stay resident for reuse; with a non zero budget the least
+// recently used of them are evicted once the cache grows past it
+texture_2d_t* acquire_texture(char* png_filename);
+// Cache lookup without loading, NULL when the file is not resident
+texture_2d_t* acquire_cached_texture(char* png_filename);
+// Hands a texture loaded elsewhere to the cache, the caller keeps one reference
+void insert_cached_texture(char* png_filename, texture_2d_t* texture);
+// 1x1 texture shown while the real one is still loading
+texture_2d_t* acquire_placeholder_texture(void);
+void release_texture(texture_2d_t* texture);
+void set_texture_cache_budget(size_t budget_bytes);
+size_t get_texture_cache_size(void);
+void free_texture_cache(void);
+// Textures released or evicted go to the callback instead of being freed, for
+// when a render thread may still be sampling them. NULL frees them right away
+typedef void (*texture_retire_callback)(texture_2d_t* texture);
+void set_texture_retire_callback(texture_retire_callback callback);
+
 tex2_t tex2_clone(tex2_t* t);
 uint32_t sample_texture(texture_2d_t* texture, float u, float v);
 uint32_t sample_texture_bilinear(texture_2d_t* texture, float u, float v);
+// Filters count UV pairs in one call, for shaders that sample whole spans
+void sample_texture_bilinear_batch(texture_2d_t* texture, const float* u, const float* v, int count, uint32_t* out);
+float get_texture_lod(texture_2d_t* texture, float du_dx, float dv_dx, float du_dy, float dv_dy);
+uint32_t sample_texture_lod(texture_2d_t* texture, float u, float v, float lod, int mip_mode);
+uint32_t sample_texture_grad(
+	texture_2d_t* texture,
+	float u,
+	float v,
+	float du_dx,
+	float dv_dx,
+	float du_dy,
+	float dv_dy,
+	int mip_mode
+);
+
+texture_view_t make_color_texture_view(color_framebuffer* framebuffer, int wrap_mode, int filter_mode);
+texture_view_t make_depth_texture_view(depth_framebuffer* framebuffer, int wrap_mode, int filter_mode);
+uint32_t sample_color_texture_view(texture_view_t* view, float u, float v);
+float sample_depth_texture_view(texture_view_t* view, float u, float v);
 
 texture_cube_t make_cube_texture(char* textures_paths[6]);
+void free_cube_texture(texture_cube_t* cube_texture);
+// Reentrant, cube samplers may run on any number of threads at once
 uint32_t sample_cube_texture(texture_cube_t* cube_texture, vec3_t coord);
 
 #endif
\ No newline at end of file
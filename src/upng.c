@@ -28,6 +28,11 @@ freely, subject to the following restrictions:
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "upng.h"
 
@@ -47,27 +52,14 @@ freely, subject to the following restrictions:
 #define NUM_CODE_LENGTH_CODES 19	/*the code length codes. 0-15: code lengths, 16: copy previous 3-6 times, 17: 3-10 zeros, 18: 11-138 zeros */
 #define MAX_SYMBOLS 288 /* largest number of symbols used by any tree type */
 
-#define DEFLATE_CODE_BITLEN 15
-#define DISTANCE_BITLEN 15
-#define CODE_LENGTH_BITLEN 7
 #define MAX_BIT_LENGTH 15 /* largest bitlen used by any tree type */
 
-#define DEFLATE_CODE_BUFFER_SIZE (NUM_DEFLATE_CODE_SYMBOLS * 2)
-#define DISTANCE_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
-#define CODE_LENGTH_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
-
 #define SET_ERROR(upng,code) do { (upng)->error = (code); (upng)->error_line = __LINE__; } while (0)
 
 #define upng_chunk_length(chunk) MAKE_DWORD_PTR(chunk)
 #define upng_chunk_type(chunk) MAKE_DWORD_PTR((chunk) + 4)
 #define upng_chunk_critical(chunk) (((chunk)[4] & 32) == 0)
 
-typedef struct huffman_tree {
-	unsigned* tree2d;
-	unsigned maxbitlen;	/*maximum number of bits a single code can get */
-	unsigned numcodes;	/*number of symbols in the alphabet = number of codes */
-} huffman_tree;
-
 static const unsigned LENGTH_BASE[29] = {	/*the base lengths represented by codes 257-285 */
 	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
 	67, 83, 99, 115, 131, 163, 195, 227, 258
@@ -91,387 +83,403 @@ static const unsigned DISTANCE_EXTRA[30] = {	/*the extra bits of backwards dista
 static const unsigned CLCL[NUM_CODE_LENGTH_CODES]	/*the order in which "code length alphabet code lengths" are stored, out of this the huffman tree of the dynamic huffman tree lengths is generated */
 = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
 
-static const unsigned FIXED_DEFLATE_CODE_TREE[NUM_DEFLATE_CODE_SYMBOLS * 2] = {
-	289, 370, 290, 307, 546, 291, 561, 292, 293, 300, 294, 297, 295, 296, 0, 1,
-	2, 3, 298, 299, 4, 5, 6, 7, 301, 304, 302, 303, 8, 9, 10, 11, 305, 306, 12,
-	13, 14, 15, 308, 339, 309, 324, 310, 317, 311, 314, 312, 313, 16, 17, 18,
-	19, 315, 316, 20, 21, 22, 23, 318, 321, 319, 320, 24, 25, 26, 27, 322, 323,
-	28, 29, 30, 31, 325, 332, 326, 329, 327, 328, 32, 33, 34, 35, 330, 331, 36,
-	37, 38, 39, 333, 336, 334, 335, 40, 41, 42, 43, 337, 338, 44, 45, 46, 47,
-	340, 355, 341, 348, 342, 345, 343, 344, 48, 49, 50, 51, 346, 347, 52, 53,
-	54, 55, 349, 352, 350, 351, 56, 57, 58, 59, 353, 354, 60, 61, 62, 63, 356,
-	363, 357, 360, 358, 359, 64, 65, 66, 67, 361, 362, 68, 69, 70, 71, 364,
-	367, 365, 366, 72, 73, 74, 75, 368, 369, 76, 77, 78, 79, 371, 434, 372,
-	403, 373, 388, 374, 381, 375, 378, 376, 377, 80, 81, 82, 83, 379, 380, 84,
-	85, 86, 87, 382, 385, 383, 384, 88, 89, 90, 91, 386, 387, 92, 93, 94, 95,
-	389, 396, 390, 393, 391, 392, 96, 97, 98, 99, 394, 395, 100, 101, 102, 103,
-	397, 400, 398, 399, 104, 105, 106, 107, 401, 402, 108, 109, 110, 111, 404,
-	419, 405, 412, 406, 409, 407, 408, 112, 113, 114, 115, 410, 411, 116, 117,
-	118, 119, 413, 416, 414, 415, 120, 121, 122, 123, 417, 418, 124, 125, 126,
-	127, 420, 427, 421, 424, 422, 423, 128, 129, 130, 131, 425, 426, 132, 133,
-	134, 135, 428, 431, 429, 430, 136, 137, 138, 139, 432, 433, 140, 141, 142,
-	143, 435, 483, 436, 452, 568, 437, 438, 445, 439, 442, 440, 441, 144, 145,
-	146, 147, 443, 444, 148, 149, 150, 151, 446, 449, 447, 448, 152, 153, 154,
-	155, 450, 451, 156, 157, 158, 159, 453, 468, 454, 461, 455, 458, 456, 457,
-	160, 161, 162, 163, 459, 460, 164, 165, 166, 167, 462, 465, 463, 464, 168,
-	169, 170, 171, 466, 467, 172, 173, 174, 175, 469, 476, 470, 473, 471, 472,
-	176, 177, 178, 179, 474, 475, 180, 181, 182, 183, 477, 480, 478, 479, 184,
-	185, 186, 187, 481, 482, 188, 189, 190, 191, 484, 515, 485, 500, 486, 493,
-	487, 490, 488, 489, 192, 193, 194, 195, 491, 492, 196, 197, 198, 199, 494,
-	497, 495, 496, 200, 201, 202, 203, 498, 499, 204, 205, 206, 207, 501, 508,
-	502, 505, 503, 504, 208, 209, 210, 211, 506, 507, 212, 213, 214, 215, 509,
-	512, 510, 511, 216, 217, 218, 219, 513, 514, 220, 221, 222, 223, 516, 531,
-	517, 524, 518, 521, 519, 520, 224, 225, 226, 227, 522, 523, 228, 229, 230,
-	231, 525, 528, 526, 527, 232, 233, 234, 235, 529, 530, 236, 237, 238, 239,
-	532, 539, 533, 536, 534, 535, 240, 241, 242, 243, 537, 538, 244, 245, 246,
-	247, 540, 543, 541, 542, 248, 249, 250, 251, 544, 545, 252, 253, 254, 255,
-	547, 554, 548, 551, 549, 550, 256, 257, 258, 259, 552, 553, 260, 261, 262,
-	263, 555, 558, 556, 557, 264, 265, 266, 267, 559, 560, 268, 269, 270, 271,
-	562, 565, 563, 564, 272, 273, 274, 275, 566, 567, 276, 277, 278, 279, 569,
-	572, 570, 571, 280, 281, 282, 283, 573, 574, 284, 285, 286, 287, 0, 0
-};
+/* Huffman codes are decoded with two level lookup tables instead of walking a
+ * tree bit by bit. The root table is indexed by the next ROOT_BITS bits of the
+ * stream; codes longer than that jump to a sub table indexed by the remaining
+ * bits. Each entry packs the symbol (or sub table offset) in the low 16 bits,
+ * the number of bits to consume (or the sub table index width) in bits 16-23
+ * and HUFFMAN_SUBTABLE_FLAG for links. A zero length marks an unused code. */
+#define LITLEN_ROOT_BITS 10
+#define DISTANCE_ROOT_BITS 8
+#define CODE_LENGTH_ROOT_BITS 7
+
+#define HUFFMAN_SUBTABLE_FLAG 0x80000000u
+#define HUFFMAN_ENTRY(symbol, bits) ((unsigned)(symbol) | ((unsigned)(bits) << 16))
+#define HUFFMAN_ENTRY_SYMBOL(entry) ((entry) & 0xFFFF)
+#define HUFFMAN_ENTRY_BITS(entry) (((entry) >> 16) & 0xFF)
+
+/* root table plus the worst case of one full sub table per symbol */
+#define LITLEN_TABLE_SIZE ((1 << LITLEN_ROOT_BITS) + NUM_DEFLATE_CODE_SYMBOLS * (1 << (MAX_BIT_LENGTH - LITLEN_ROOT_BITS)))
+#define DISTANCE_TABLE_SIZE ((1 << DISTANCE_ROOT_BITS) + NUM_DISTANCE_SYMBOLS * (1 << (MAX_BIT_LENGTH - DISTANCE_ROOT_BITS)))
+#define CODE_LENGTH_TABLE_SIZE (1 << CODE_LENGTH_ROOT_BITS)
+
+typedef struct huffman_table {
+	unsigned* entries;
+	unsigned root_bits;
+} huffman_table;
+
+typedef struct inflate_tables {
+	unsigned litlen[LITLEN_TABLE_SIZE];
+	unsigned distance[DISTANCE_TABLE_SIZE];
+	unsigned code_length[CODE_LENGTH_TABLE_SIZE];
+} inflate_tables;
+
+/* LSB first bit reader over a 64 bit buffer. Refills load whole words while the
+ * input allows and pad with zero bytes past its end; reading into the padding is
+ * detected by bit_reader_overrun() */
+typedef struct bit_reader {
+	const unsigned char* in;
+	unsigned long inlength;
+	unsigned long pos;	/* next byte to load, padding included */
+	uint64_t bits;
+	unsigned count;
+} bit_reader;
+
+static void bit_reader_init(bit_reader* reader, const unsigned char* in, unsigned long inlength)
+{
+	reader->in = in;
+	reader->inlength = inlength;
+	reader->pos = 0;
+	reader->bits = 0;
+	reader->count = 0;
+}
 
-static const unsigned FIXED_DISTANCE_TREE[NUM_DISTANCE_SYMBOLS * 2] = {
-	33, 48, 34, 41, 35, 38, 36, 37, 0, 1, 2, 3, 39, 40, 4, 5, 6, 7, 42, 45, 43,
-	44, 8, 9, 10, 11, 46, 47, 12, 13, 14, 15, 49, 56, 50, 53, 51, 52, 16, 17,
-	18, 19, 54, 55, 20, 21, 22, 23, 57, 60, 58, 59, 24, 25, 26, 27, 61, 62, 28,
-	29, 30, 31, 0, 0
-};
+/* guarantees at least 56 bits in the buffer */
+static inline void bit_reader_refill(bit_reader* reader)
+{
+	if (reader->pos + 8 <= reader->inlength) {
+		uint64_t word;
+		memcpy(&word, reader->in + reader->pos, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		word = __builtin_bswap64(word);
+#endif
+		reader->bits |= word << reader->count;
+		reader->pos += (63 - reader->count) >> 3;
+		reader->count |= 56;
+		return;
+	}
+	while (reader->count <= 56) {
+		uint64_t byte = reader->pos < reader->inlength ? reader->in[reader->pos] : 0;
+		reader->bits |= byte << reader->count;
+		reader->pos++;
+		reader->count += 8;
+	}
+}
 
-static unsigned char read_bit(unsigned long *bitpointer, const unsigned char *bitstream)
+static inline unsigned bit_reader_peek(bit_reader* reader, unsigned nbits)
 {
-	unsigned char result = (unsigned char)((bitstream[(*bitpointer) >> 3] >> ((*bitpointer) & 0x7)) & 1);
-	(*bitpointer)++;
-	return result;
+	return (unsigned)(reader->bits & ((1ull << nbits) - 1));
 }
 
-static unsigned read_bits(unsigned long *bitpointer, const unsigned char *bitstream, unsigned long nbits)
+static inline void bit_reader_consume(bit_reader* reader, unsigned nbits)
 {
-	unsigned result = 0, i;
-	for (i = 0; i < nbits; i++)
-		result |= ((unsigned)read_bit(bitpointer, bitstream)) << i;
+	reader->bits >>= nbits;
+	reader->count -= nbits;
+}
+
+static inline unsigned bit_reader_read(bit_reader* reader, unsigned nbits)
+{
+	unsigned result = bit_reader_peek(reader, nbits);
+	bit_reader_consume(reader, nbits);
 	return result;
 }
 
-/* the buffer must be numcodes*2 in size! */
-static void huffman_tree_init(huffman_tree* tree, unsigned* buffer, unsigned numcodes, unsigned maxbitlen)
+/* number of bytes consumed so far, counting a partially read byte */
+static inline unsigned long bit_reader_consumed(bit_reader* reader)
+{
+	return reader->pos - reader->count / 8;
+}
+
+static inline int bit_reader_overrun(bit_reader* reader)
 {
-	tree->tree2d = buffer;
+	return reader->pos * 8 - reader->count > reader->inlength * 8;
+}
 
-	tree->numcodes = numcodes;
-	tree->maxbitlen = maxbitlen;
+/* reverses the low nbits bits of code; deflate stores huffman codes MSB first */
+static inline unsigned reverse_bits(unsigned code, unsigned nbits)
+{
+	unsigned result = 0;
+	while (nbits--) {
+		result = (result << 1) | (code & 1);
+		code >>= 1;
+	}
+	return result;
 }
 
-/*given the code lengths (as stored in the PNG file), generate the tree as defined by Deflate. maxbitlen is the maximum bits that a code in the tree can have. return value is error.*/
-static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const unsigned *bitlen)
+/* given the code lengths (as stored in the PNG file), build the lookup table for the canonical code they describe */
+static void huffman_table_build(upng_t* upng, huffman_table* table, unsigned* entries, unsigned table_size, unsigned root_bits, const unsigned* bitlen, unsigned numcodes)
 {
-	unsigned tree1d[MAX_SYMBOLS];
-	unsigned blcount[MAX_BIT_LENGTH];
-	unsigned nextcode[MAX_BIT_LENGTH+1];
-	unsigned bits, n, i;
-	unsigned nodefilled = 0;	/*up to which node it is filled */
-	unsigned treepos = 0;	/*position in the tree (1 of the numcodes columns) */
-
-	/* initialize local vectors */
+	unsigned blcount[MAX_BIT_LENGTH + 1];
+	unsigned nextcode[MAX_BIT_LENGTH + 1];
+	unsigned codes[MAX_SYMBOLS];
+	unsigned subtable_bits[1 << LITLEN_ROOT_BITS];
+	unsigned root_size = 1u << root_bits;
+	unsigned used = root_size;
+	unsigned bits, n;
+	int left = 1;
+
+	table->entries = entries;
+	table->root_bits = root_bits;
+
 	memset(blcount, 0, sizeof(blcount));
 	memset(nextcode, 0, sizeof(nextcode));
+	for (n = 0; n < numcodes; n++) {
+		blcount[bitlen[n]]++;
+	}
+	blcount[0] = 0;
 
-	/*step 1: count number of instances of each code length */
-	for (bits = 0; bits < tree->numcodes; bits++) {
-		blcount[bitlen[bits]]++;
+	/* reject oversubscribed codes; incomplete ones are legal (e.g. a single distance code) */
+	for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
+		left = (left << 1) - (int)blcount[bits];
+		if (left < 0) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
 	}
 
-	/*step 2: generate the nextcode values */
-	for (bits = 1; bits <= tree->maxbitlen; bits++) {
+	for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
 		nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
 	}
-
-	/*step 3: generate all the codes */
-	for (n = 0; n < tree->numcodes; n++) {
+	for (n = 0; n < numcodes; n++) {
 		if (bitlen[n] != 0) {
-			tree1d[n] = nextcode[bitlen[n]]++;
+			codes[n] = reverse_bits(nextcode[bitlen[n]]++, bitlen[n]);
 		}
 	}
 
-	/*convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means uninited, a value >= numcodes is an address to another bit, a value < numcodes is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as many columns as codes - 1
-	   a good huffmann tree has N * 2 - 1 nodes, of which N - 1 are internal nodes. Here, the internal nodes are stored (what their 0 and 1 option point to). There is only memory for such good tree currently, if there are more nodes (due to too long length codes), error 55 will happen */
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		tree->tree2d[n] = 32767;	/*32767 here means the tree2d isn't filled there yet */
-	}
+	memset(entries, 0, sizeof(unsigned) * root_size);
 
-	for (n = 0; n < tree->numcodes; n++) {	/*the codes */
-		for (i = 0; i < bitlen[n]; i++) {	/*the bits for this code */
-			unsigned char bit = (unsigned char)((tree1d[n] >> (bitlen[n] - i - 1)) & 1);
-			/* check if oversubscribed */
-			if (treepos > tree->numcodes - 2) {
+	/* first pass: size the sub table hanging off every root slot with long codes */
+	memset(subtable_bits, 0, sizeof(unsigned) * root_size);
+	for (n = 0; n < numcodes; n++) {
+		if (bitlen[n] > root_bits) {
+			unsigned slot = codes[n] & (root_size - 1);
+			unsigned extra = bitlen[n] - root_bits;
+			if (extra > subtable_bits[slot]) {
+				subtable_bits[slot] = extra;
+			}
+		}
+	}
+	for (n = 0; n < root_size; n++) {
+		if (subtable_bits[n] != 0) {
+			unsigned size = 1u << subtable_bits[n];
+			if (used + size > table_size) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
-
-			if (tree->tree2d[2 * treepos + bit] == 32767) {	/*not yet filled in */
-				if (i + 1 == bitlen[n]) {	/*last bit */
-					tree->tree2d[2 * treepos + bit] = n;	/*put the current code in it */
-					treepos = 0;
-				} else {	/*put address of the next step in here, first that address has to be found of course (it's just nodefilled + 1)... */
-					nodefilled++;
-					tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes;	/*addresses encoded with numcodes added to it */
-					treepos = nodefilled;
-				}
-			} else {
-				treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
-			}
+			entries[n] = HUFFMAN_SUBTABLE_FLAG | HUFFMAN_ENTRY(used, subtable_bits[n]);
+			memset(entries + used, 0, sizeof(unsigned) * size);
+			used += size;
 		}
 	}
 
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		if (tree->tree2d[n] == 32767) {
-			tree->tree2d[n] = 0;	/*remove possible remaining 32767's */
+	/* second pass: replicate every code over all the slots its prefix covers */
+	for (n = 0; n < numcodes; n++) {
+		unsigned len = bitlen[n];
+		unsigned step, i;
+		if (len == 0) {
+			continue;
+		}
+		if (len <= root_bits) {
+			step = 1u << len;
+			for (i = codes[n]; i < root_size; i += step) {
+				entries[i] = HUFFMAN_ENTRY(n, len);
+			}
+		} else {
+			unsigned link = entries[codes[n] & (root_size - 1)];
+			unsigned* subtable = entries + HUFFMAN_ENTRY_SYMBOL(link);
+			unsigned sub_size = 1u << HUFFMAN_ENTRY_BITS(link);
+			unsigned sub_len = len - root_bits;
+			step = 1u << sub_len;
+			for (i = codes[n] >> root_bits; i < sub_size; i += step) {
+				subtable[i] = HUFFMAN_ENTRY(n, sub_len);
+			}
 		}
 	}
 }
 
-static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in, unsigned long *bp, const huffman_tree* codetree, unsigned long inlength)
+/* the buffer must hold at least MAX_BIT_LENGTH bits */
+static inline unsigned huffman_decode_symbol(upng_t* upng, bit_reader* reader, const huffman_table* table)
 {
-	unsigned treepos = 0, ct;
-	unsigned char bit;
-	for (;;) {
-		/* error: end of input memory reached without endcode */
-		if (((*bp) & 0x07) == 0 && ((*bp) >> 3) > inlength) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
-		}
+	unsigned entry = table->entries[bit_reader_peek(reader, table->root_bits)];
+	if (entry & HUFFMAN_SUBTABLE_FLAG) {
+		bit_reader_consume(reader, table->root_bits);
+		entry = table->entries[HUFFMAN_ENTRY_SYMBOL(entry) + bit_reader_peek(reader, HUFFMAN_ENTRY_BITS(entry))];
+	}
+	if (HUFFMAN_ENTRY_BITS(entry) == 0) {
+		/* a code the block never assigned */
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return 0;
+	}
+	bit_reader_consume(reader, HUFFMAN_ENTRY_BITS(entry));
+	return HUFFMAN_ENTRY_SYMBOL(entry);
+}
 
-		bit = read_bit(bp, in);
+static void build_fixed_tables(upng_t* upng, inflate_tables* tables, huffman_table* codetree, huffman_table* codetreeD)
+{
+	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
+	unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+	unsigned n;
 
-		ct = codetree->tree2d[(treepos << 1) | bit];
-		if (ct < codetree->numcodes) {
-			return ct;
-		}
+	for (n = 0; n < 144; n++) bitlen[n] = 8;
+	for (; n < 256; n++) bitlen[n] = 9;
+	for (; n < 280; n++) bitlen[n] = 7;
+	for (; n < NUM_DEFLATE_CODE_SYMBOLS; n++) bitlen[n] = 8;
+	for (n = 0; n < NUM_DISTANCE_SYMBOLS; n++) bitlenD[n] = 5;
 
-		treepos = ct - codetree->numcodes;
-		if (treepos >= codetree->numcodes) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
-		}
+	huffman_table_build(upng, codetree, tables->litlen, LITLEN_TABLE_SIZE, LITLEN_ROOT_BITS, bitlen, NUM_DEFLATE_CODE_SYMBOLS);
+	if (upng->error == UPNG_EOK) {
+		huffman_table_build(upng, codetreeD, tables->distance, DISTANCE_TABLE_SIZE, DISTANCE_ROOT_BITS, bitlenD, NUM_DISTANCE_SYMBOLS);
 	}
 }
 
-/* get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, const unsigned char *in, unsigned long *bp, unsigned long inlength)
+/* get the tables of a deflated block with dynamic codes, the code lengths themselves are also Huffman compressed with a known code */
+static void get_tables_inflate_dynamic(upng_t* upng, inflate_tables* tables, huffman_table* codetree, huffman_table* codetreeD, bit_reader* reader)
 {
 	unsigned codelengthcode[NUM_CODE_LENGTH_CODES];
-	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
-	unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS + NUM_DISTANCE_SYMBOLS];
+	huffman_table codelengthcodetree;
 	unsigned n, hlit, hdist, hclen, i;
 
-	/*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated */
-	/*C-code note: use no "return" between ctor and dtor of an uivector! */
-	if ((*bp) >> 3 >= inlength - 2) {
+	memset(bitlen, 0, sizeof(bitlen));
+
+	bit_reader_refill(reader);
+	hlit = bit_reader_read(reader, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
+	hdist = bit_reader_read(reader, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
+	hclen = bit_reader_read(reader, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
+
+	if (hlit > NUM_DEFLATE_CODE_SYMBOLS || hdist > NUM_DISTANCE_SYMBOLS) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	/* clear bitlen arrays */
-	memset(bitlen, 0, sizeof(bitlen));
-	memset(bitlenD, 0, sizeof(bitlenD));
-
-	/*the bit pointer is or will go past the memory */
-	hlit = read_bits(bp, in, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
-	hdist = read_bits(bp, in, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
-	hclen = read_bits(bp, in, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
-
 	for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
-		if (i < hclen) {
-			codelengthcode[CLCL[i]] = read_bits(bp, in, 3);
-		} else {
-			codelengthcode[CLCL[i]] = 0;	/*if not, it must stay 0 */
+		if (i % 8 == 0) {
+			bit_reader_refill(reader);
 		}
+		codelengthcode[CLCL[i]] = i < hclen ? bit_reader_read(reader, 3) : 0;
 	}
 
-	huffman_tree_create_lengths(upng, codelengthcodetree, codelengthcode);
-
-	/* bail now if we encountered an error earlier */
+	huffman_table_build(upng, &codelengthcodetree, tables->code_length, CODE_LENGTH_TABLE_SIZE, CODE_LENGTH_ROOT_BITS, codelengthcode, NUM_CODE_LENGTH_CODES);
 	if (upng->error != UPNG_EOK) {
 		return;
 	}
 
-	/*now we can use this tree to read the lengths for the tree that this function will return */
+	/* the literal/length and distance lengths form one sequence, repeats may run across both */
 	i = 0;
-	while (i < hlit + hdist) {	/*i is the current symbol we're reading in the part that contains the code lengths of lit/len codes and dist codes */
-		unsigned code = huffman_decode_symbol(upng, in, bp, codelengthcodetree, inlength);
+	while (i < hlit + hdist) {
+		unsigned code, replength, value;
+
+		bit_reader_refill(reader);
+		code = huffman_decode_symbol(upng, reader, &codelengthcodetree);
 		if (upng->error != UPNG_EOK) {
-			break;
+			return;
 		}
 
 		if (code <= 15) {	/*a length code */
-			if (i < hlit) {
-				bitlen[i] = code;
-			} else {
-				bitlenD[i - hlit] = code;
-			}
-			i++;
-		} else if (code == 16) {	/*repeat previous */
-			unsigned replength = 3;	/*read in the 2 bits that indicate repeat length (3-6) */
-			unsigned value;	/*set value to the previous code */
-
-			if ((*bp) >> 3 >= inlength) {
+			bitlen[i++] = code;
+			continue;
+		} else if (code == 16) {	/*repeat previous 3-6 times */
+			if (i == 0) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
-				break;
-			}
-			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 2);
-
-			if ((i - 1) < hlit) {
-				value = bitlen[i - 1];
-			} else {
-				value = bitlenD[i - hlit - 1];
-			}
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-
-				if (i < hlit) {
-					bitlen[i] = value;
-				} else {
-					bitlenD[i - hlit] = value;
-				}
-				i++;
+				return;
 			}
+			replength = 3 + bit_reader_read(reader, 2);
+			value = bitlen[i - 1];
 		} else if (code == 17) {	/*repeat "0" 3-10 times */
-			unsigned replength = 3;	/*read in the bits that indicate repeat length */
-			if ((*bp) >> 3 >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				break;
-			}
-
-			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 3);
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* error: i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-
-				if (i < hlit) {
-					bitlen[i] = 0;
-				} else {
-					bitlenD[i - hlit] = 0;
-				}
-				i++;
-			}
+			replength = 3 + bit_reader_read(reader, 3);
+			value = 0;
 		} else if (code == 18) {	/*repeat "0" 11-138 times */
-			unsigned replength = 11;	/*read in the bits that indicate repeat length */
-			/* error, bit pointer jumps past memory */
-			if ((*bp) >> 3 >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				break;
-			}
-
-			replength += read_bits(bp, in, 7);
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-				if (i < hlit)
-					bitlen[i] = 0;
-				else
-					bitlenD[i - hlit] = 0;
-				i++;
-			}
+			replength = 11 + bit_reader_read(reader, 7);
+			value = 0;
 		} else {
-			/* somehow an unexisting code appeared. This can never happen. */
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			break;
+			return;
+		}
+
+		if (i + replength > hlit + hdist) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+		for (n = 0; n < replength; n++) {
+			bitlen[i++] = value;
 		}
 	}
 
-	if (upng->error == UPNG_EOK && bitlen[256] == 0) {
+	if (bit_reader_overrun(reader)) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
 	}
 
 	/*the length of the end code 256 must be larger than 0 */
-	/*now we've finally got hlit and hdist, so generate the code trees, and the function is done */
-	if (upng->error == UPNG_EOK) {
-		huffman_tree_create_lengths(upng, codetree, bitlen);
+	if (bitlen[256] == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
 	}
+
+	huffman_table_build(upng, codetree, tables->litlen, LITLEN_TABLE_SIZE, LITLEN_ROOT_BITS, bitlen, hlit);
 	if (upng->error == UPNG_EOK) {
-		huffman_tree_create_lengths(upng, codetreeD, bitlenD);
+		huffman_table_build(upng, codetreeD, tables->distance, DISTANCE_TABLE_SIZE, DISTANCE_ROOT_BITS, bitlen + hlit, hdist);
 	}
 }
 
-/*inflate a block with dynamic of fixed Huffman tree*/
-static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength, unsigned btype)
+/* copies a length byte match from distance bytes back. Matches far enough back
+ * move in 8 byte words and may write up to 7 bytes past the match, the caller
+ * guarantees that room */
+static inline void copy_match(unsigned char* out, unsigned long pos, unsigned long length, unsigned long distance)
 {
-	unsigned codetree_buffer[DEFLATE_CODE_BUFFER_SIZE];
-	unsigned codetreeD_buffer[DISTANCE_BUFFER_SIZE];
-	unsigned done = 0;
+	unsigned char* dst = out + pos;
+	const unsigned char* src = dst - distance;
+	unsigned char* end = dst + length;
+
+	if (distance >= 8) {
+		do {
+			uint64_t word;
+			memcpy(&word, src, sizeof(word));
+			memcpy(dst, &word, sizeof(word));
+			src += 8;
+			dst += 8;
+		} while (dst < end);
+	} else if (distance == 1) {
+		memset(dst, *src, length);
+	} else {
+		while (dst < end) {
+			*dst++ = *src++;
+		}
+	}
+}
 
-	huffman_tree codetree;
-	huffman_tree codetreeD;
+/*inflate a block with dynamic of fixed Huffman codes*/
+static void inflate_huffman(upng_t* upng, inflate_tables* tables, unsigned char* out, unsigned long outsize, bit_reader* reader, unsigned long *pos, unsigned btype)
+{
+	huffman_table codetree;
+	huffman_table codetreeD;
 
 	if (btype == 1) {
-		/* fixed trees */
-		huffman_tree_init(&codetree, (unsigned*)FIXED_DEFLATE_CODE_TREE, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, (unsigned*)FIXED_DISTANCE_TREE, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-	} else if (btype == 2) {
-		/* dynamic trees */
-		unsigned codelengthcodetree_buffer[CODE_LENGTH_BUFFER_SIZE];
-		huffman_tree codelengthcodetree;
-
-		huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-		huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer, NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
-		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, in, bp, inlength);
+		build_fixed_tables(upng, tables, &codetree, &codetreeD);
+	} else {
+		get_tables_inflate_dynamic(upng, tables, &codetree, &codetreeD, reader);
+	}
+	if (upng->error != UPNG_EOK) {
+		return;
 	}
 
-	while (done == 0) {
-		unsigned code = huffman_decode_symbol(upng, in, bp, &codetree, inlength);
+	for (;;) {
+		unsigned code;
+
+		/* one refill covers the longest length code, its extra bits, distance code and distance extra bits: 15 + 5 + 15 + 13 bits */
+		bit_reader_refill(reader);
+		code = huffman_decode_symbol(upng, reader, &codetree);
 		if (upng->error != UPNG_EOK) {
 			return;
 		}
 
-		if (code == 256) {
-			/* end code */
-			done = 1;
-		} else if (code <= 255) {
+		if (code <= 255) {
 			/* literal symbol */
 			if ((*pos) >= outsize) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
-
-			/* store output */
 			out[(*pos)++] = (unsigned char)(code);
-		} else if (code >= FIRST_LENGTH_CODE_INDEX && code <= LAST_LENGTH_CODE_INDEX) {	/*length code */
-			/* part 1: get length base */
-			unsigned long length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX];
-			unsigned codeD, distance, numextrabitsD;
-			unsigned long start, forward, backward, numextrabits;
+		} else if (code == 256) {
+			/* end code */
+			break;
+		} else if (code <= LAST_LENGTH_CODE_INDEX) {	/*length code */
+			unsigned long length, distance;
+			unsigned codeD;
 
-			/* part 2: get extra bits and add the value of that to length */
-			numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
+			length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX] + bit_reader_read(reader, LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX]);
 
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
-			}
-			length += read_bits(bp, in, numextrabits);
-
-			/*part 3: get distance code */
-			codeD = huffman_decode_symbol(upng, in, bp, &codetreeD, inlength);
+			codeD = huffman_decode_symbol(upng, reader, &codetreeD);
 			if (upng->error != UPNG_EOK) {
 				return;
 			}
@@ -481,54 +489,47 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
+			distance = DISTANCE_BASE[codeD] + bit_reader_read(reader, DISTANCE_EXTRA[codeD]);
 
-			distance = DISTANCE_BASE[codeD];
-
-			/*part 4: get extra bits from distance */
-			numextrabitsD = DISTANCE_EXTRA[codeD];
-
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
+			if (distance > (*pos) || (*pos) + length > outsize) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
 
-			distance += read_bits(bp, in, numextrabitsD);
-
-			/*part 5: fill in all the out[n] values based on the length and dist */
-			start = (*pos);
-			backward = start - distance;
-
-			if ((*pos) + length >= outsize) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
-			}
-
-			for (forward = 0; forward < length; forward++) {
-				out[(*pos)++] = out[backward];
-				backward++;
-
-				if (backward >= start) {
-					backward = start - distance;
+			if ((*pos) + length + 8 <= outsize) {
+				copy_match(out, *pos, length, distance);
+			} else {
+				/* too close to the end of the buffer for word copies */
+				unsigned long n;
+				for (n = 0; n < length; n++) {
+					out[(*pos) + n] = out[(*pos) + n - distance];
 				}
 			}
+			(*pos) += length;
+		} else {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+
+		if (bit_reader_overrun(reader)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
 		}
 	}
 }
 
-static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength)
+static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, bit_reader* reader, unsigned long *pos)
 {
+	const unsigned char* in = reader->in;
 	unsigned long p;
-	unsigned len, nlen, n;
+	unsigned len, nlen;
 
-	/* go to first boundary of byte */
-	while (((*bp) & 0x7) != 0) {
-		(*bp)++;
-	}
-	p = (*bp) / 8;		/*byte position */
+	/* go to first boundary of byte, then continue reading bytes straight from the input */
+	bit_reader_consume(reader, reader->count & 7);
+	p = bit_reader_consumed(reader);
 
 	/* read len (2 bytes) and nlen (2 bytes) */
-	if (p >= inlength - 4) {
+	if (p + 4 > reader->inlength) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
@@ -544,61 +545,68 @@ static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long
 		return;
 	}
 
-	if ((*pos) + len >= outsize) {
+	if ((*pos) + len > outsize || p + len > reader->inlength) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
 	/* read the literal data: len bytes are now stored in the out buffer */
-	if (p + len > inlength) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		return;
-	}
-
-	for (n = 0; n < len; n++) {
-		out[(*pos)++] = in[p++];
-	}
-
-	(*bp) = p * 8;
+	memcpy(out + (*pos), in + p, len);
+	(*pos) += len;
+	p += len;
+
+	/* restart the bit buffer after the stored bytes */
+	reader->pos = p;
+	reader->bits = 0;
+	reader->count = 0;
 }
 
 /*inflate the deflated data (cfr. deflate spec); return value is the error*/
 static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long insize, unsigned long inpos)
 {
-	unsigned long bp = 0;	/*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
+	bit_reader reader;
 	unsigned long pos = 0;	/*byte position in the out buffer */
-
 	unsigned done = 0;
+	/* the tables are too big for the stack, and reused by every block */
+	inflate_tables* tables = (inflate_tables*)malloc(sizeof(inflate_tables));
+
+	if (tables == NULL) {
+		SET_ERROR(upng, UPNG_ENOMEM);
+		return upng->error;
+	}
+
+	bit_reader_init(&reader, in + inpos, insize - inpos);
 
 	while (done == 0) {
 		unsigned btype;
 
 		/* ensure next bit doesn't point past the end of the buffer */
-		if ((bp >> 3) >= insize) {
+		if (bit_reader_consumed(&reader) >= reader.inlength) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+			break;
 		}
 
 		/* read block control bits */
-		done = read_bit(&bp, &in[inpos]);
-		btype = read_bit(&bp, &in[inpos]) | (read_bit(&bp, &in[inpos]) << 1);
+		bit_reader_refill(&reader);
+		done = bit_reader_read(&reader, 1);
+		btype = bit_reader_read(&reader, 2);
 
 		/* process control type appropriateyly */
 		if (btype == 3) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
 		} else if (btype == 0) {
-			inflate_uncompressed(upng, out, outsize, &in[inpos], &bp, &pos, insize);	/*no compression */
+			inflate_uncompressed(upng, out, outsize, &reader, &pos);	/*no compression */
 		} else {
-			inflate_huffman(upng, out, outsize, &in[inpos], &bp, &pos, insize, btype);	/*compression, btype 01 or 10 */
+			inflate_huffman(upng, tables, out, outsize, &reader, &pos, btype);	/*compression, btype 01 or 10 */
 		}
 
 		/* stop if an error has occured */
 		if (upng->error != UPNG_EOK) {
-			return upng->error;
+			break;
 		}
 	}
 
+	free(tables);
 	return upng->error;
 }
 
@@ -650,6 +658,100 @@ static int paeth_predictor(int a, int b, int c)
 		return c;
 }
 
+#ifdef __SSE2__
+/* SSE2 unfiltering for 4 byte pixels (RGBA8, LA16). Sub, Average and Paeth depend
+ * on the pixel to the left, so they run one whole pixel per step with all four
+ * channels in one register; Up has no such dependency and runs 16 bytes a step */
+static inline __m128i load4(const unsigned char* p)
+{
+	int value;
+	memcpy(&value, p, sizeof(value));
+	return _mm_cvtsi32_si128(value);
+}
+
+static inline void store4(unsigned char* p, __m128i v)
+{
+	int value = _mm_cvtsi128_si32(v);
+	memcpy(p, &value, sizeof(value));
+}
+
+static void unfilter_sub4_sse2(unsigned char* recon, const unsigned char* scanline, unsigned long length)
+{
+	__m128i a = _mm_setzero_si128();
+	unsigned long i;
+	for (i = 0; i < length; i += 4) {
+		a = _mm_add_epi8(a, load4(scanline + i));
+		store4(recon + i, a);
+	}
+}
+
+static void unfilter_up_sse2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, unsigned long length)
+{
+	unsigned long i = 0;
+	for (; i + 16 <= length; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(precon + i));
+		_mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(x, b));
+	}
+	for (; i < length; i++) {
+		recon[i] = scanline[i] + precon[i];
+	}
+}
+
+static void unfilter_average4_sse2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, unsigned long length)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi8(1);
+	__m128i a = zero;
+	unsigned long i;
+	for (i = 0; i < length; i += 4) {
+		__m128i b = precon ? load4(precon + i) : zero;
+		/* avg_epu8 rounds up, the filter floors: subtract the lost low bit */
+		__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+		a = _mm_add_epi8(load4(scanline + i), average);
+		store4(recon + i, a);
+	}
+}
+
+static inline __m128i abs_epi16(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static inline __m128i select_epi16(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static void unfilter_paeth4_sse2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, unsigned long length)
+{
+	__m128i zero = _mm_setzero_si128();
+	/* a: left, b: above, c: above left, all widened to 16 bits */
+	__m128i a = zero;
+	__m128i c = zero;
+	unsigned long i;
+	for (i = 0; i < length; i += 4) {
+		__m128i b = _mm_unpacklo_epi8(load4(precon + i), zero);
+		/* with p = a + b - c: |p - a| = |b - c|, |p - b| = |a - c|, |p - c| = |a + b - 2c| */
+		__m128i pa = _mm_sub_epi16(b, c);
+		__m128i pb = _mm_sub_epi16(a, c);
+		__m128i pc = abs_epi16(_mm_add_epi16(pa, pb));
+		pa = abs_epi16(pa);
+		pb = abs_epi16(pb);
+		__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+		__m128i predictor = select_epi16(
+			_mm_cmpeq_epi16(pa, smallest),
+			a,
+			select_epi16(_mm_cmpeq_epi16(pb, smallest), b, c)
+		);
+		__m128i x = _mm_add_epi8(load4(scanline + i), _mm_packus_epi16(predictor, zero));
+		store4(recon + i, x);
+		a = _mm_unpacklo_epi8(x, zero);
+		c = b;
+	}
+}
+#endif
+
 static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
 {
 	/*
@@ -661,6 +763,32 @@ static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned
 	 */
 
 	unsigned long i;
+
+#ifdef __SSE2__
+	if (bytewidth == 4) {
+		switch (filterType) {
+		case 1:
+			unfilter_sub4_sse2(recon, scanline, length);
+			return;
+		case 2:
+			if (precon) {
+				unfilter_up_sse2(recon, scanline, precon, length);
+				return;
+			}
+			break;
+		case 3:
+			unfilter_average4_sse2(recon, scanline, precon, length);
+			return;
+		case 4:
+			if (precon) {
+				unfilter_paeth4_sse2(recon, scanline, precon, length);
+				return;
+			}
+			break;
+		}
+	}
+#endif
+
 	switch (filterType) {
 	case 0:
 		for (i = 0; i < length; i++)
@@ -792,6 +920,129 @@ static void post_process_scanlines(upng_t* upng, unsigned char *out, unsigned ch
 	}
 }
 
+/* reads sample i of an unfiltered scanline scaled to 8 bits. Sub byte samples are
+ * packed MSB first, 16 bit samples are big endian and keep their high byte */
+static inline unsigned char get_scanline_sample(const unsigned char* line, unsigned depth, unsigned long i)
+{
+	unsigned long bit;
+	unsigned value;
+	switch (depth) {
+	case 16:
+		return line[i * 2];
+	case 8:
+		return line[i];
+	default:
+		bit = i * depth;
+		value = (line[bit >> 3] >> (8 - depth - (bit & 7))) & ((1u << depth) - 1);
+		/* 1, 2 and 4 bit values stretched to 0..255 */
+		return (unsigned char)(value * (255 / ((1u << depth) - 1)));
+	}
+}
+
+/* converts one unfiltered scanline to RGBA8 */
+static void convert_scanline_rgba8(unsigned char* out, const unsigned char* line, unsigned w, upng_color color_type, unsigned depth)
+{
+	unsigned x;
+	if (depth == 8) {
+		switch (color_type) {
+		case UPNG_RGBA:
+			memcpy(out, line, (unsigned long)w * 4);
+			return;
+		case UPNG_RGB:
+			for (x = 0; x < w; x++, out += 4, line += 3) {
+				out[0] = line[0];
+				out[1] = line[1];
+				out[2] = line[2];
+				out[3] = 0xFF;
+			}
+			return;
+		case UPNG_LUMA:
+			for (x = 0; x < w; x++, out += 4, line += 2) {
+				out[0] = out[1] = out[2] = line[0];
+				out[3] = line[1];
+			}
+			return;
+		case UPNG_LUM:
+			for (x = 0; x < w; x++, out += 4) {
+				out[0] = out[1] = out[2] = line[x];
+				out[3] = 0xFF;
+			}
+			return;
+		}
+	}
+	for (x = 0; x < w; x++, out += 4) {
+		switch (color_type) {
+		case UPNG_RGBA:
+			out[0] = get_scanline_sample(line, depth, x * 4);
+			out[1] = get_scanline_sample(line, depth, x * 4 + 1);
+			out[2] = get_scanline_sample(line, depth, x * 4 + 2);
+			out[3] = get_scanline_sample(line, depth, x * 4 + 3);
+			break;
+		case UPNG_RGB:
+			out[0] = get_scanline_sample(line, depth, x * 3);
+			out[1] = get_scanline_sample(line, depth, x * 3 + 1);
+			out[2] = get_scanline_sample(line, depth, x * 3 + 2);
+			out[3] = 0xFF;
+			break;
+		case UPNG_LUMA:
+			out[0] = out[1] = out[2] = get_scanline_sample(line, depth, x * 2);
+			out[3] = get_scanline_sample(line, depth, x * 2 + 1);
+			break;
+		default:
+			out[0] = out[1] = out[2] = get_scanline_sample(line, depth, x);
+			out[3] = 0xFF;
+			break;
+		}
+	}
+}
+
+/* unfilters every scanline and converts it to RGBA8 while it is still in cache,
+ * instead of unfiltering the whole image first and converting it in a second pass */
+static void post_process_scanlines_rgba8(upng_t* upng, unsigned char* out, unsigned char* in)
+{
+	unsigned bpp = upng_get_bpp(upng);
+	unsigned w = upng->width;
+	unsigned h = upng->height;
+	unsigned long bytewidth = (bpp + 7) / 8;
+	unsigned long linebytes = ((unsigned long)w * bpp + 7) / 8;
+	unsigned long outlinebytes = (unsigned long)w * 4;
+	int in_place = upng->color_type == UPNG_RGBA && upng->color_depth == 8;
+	unsigned char* lines = NULL;
+	unsigned char* prevline = NULL;
+	unsigned y;
+
+	if (bpp == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+
+	/* RGBA8 is already the output layout and unfilters straight into it, other
+	 * formats ping-pong between two scratch scanlines */
+	if (!in_place) {
+		lines = (unsigned char*)malloc(linebytes * 2);
+		if (lines == NULL) {
+			SET_ERROR(upng, UPNG_ENOMEM);
+			return;
+		}
+	}
+
+	for (y = 0; y < h; y++) {
+		unsigned long inindex = (1 + linebytes) * y;	/*the extra filterbyte added to each row */
+		unsigned char* line = in_place ? out + outlinebytes * y : lines + linebytes * (y & 1);
+
+		unfilter_scanline(upng, line, &in[inindex + 1], prevline, bytewidth, in[inindex], linebytes);
+		if (upng->error != UPNG_EOK) {
+			break;
+		}
+		if (!in_place) {
+			convert_scanline_rgba8(out + outlinebytes * y, line, w, upng->color_type, upng->color_depth);
+		}
+		prevline = line;
+	}
+
+	free(lines);
+}
+
 static upng_format determine_format(upng_t* upng) {
 	switch (upng->color_type) {
 	case UPNG_LUM:
@@ -923,7 +1174,7 @@ upng_error upng_header(upng_t* upng)
 }
 
 /*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-upng_error upng_decode(upng_t* upng)
+static upng_error upng_decode_to(upng_t* upng, int rgba8_output)
 {
 	const unsigned char *chunk;
 	unsigned char* compressed;
@@ -1048,7 +1299,11 @@ upng_error upng_decode(upng_t* upng)
 	free(compressed);
 
 	/* allocate final image buffer */
-	upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
+	if (rgba8_output) {
+		upng->size = upng->height * upng->width * 4;
+	} else {
+		upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
+	}
 	upng->buffer = (unsigned char*)malloc(upng->size);
 	if (upng->buffer == NULL) {
 		free(inflated);
@@ -1058,7 +1313,11 @@ upng_error upng_decode(upng_t* upng)
 	}
 
 	/* unfilter scanlines */
-	post_process_scanlines(upng, upng->buffer, inflated, upng);
+	if (rgba8_output) {
+		post_process_scanlines_rgba8(upng, upng->buffer, inflated);
+	} else {
+		post_process_scanlines(upng, upng->buffer, inflated, upng);
+	}
 	free(inflated);
 
 	if (upng->error != UPNG_EOK) {
@@ -1067,6 +1326,11 @@ upng_error upng_decode(upng_t* upng)
 		upng->size = 0;
 	} else {
 		upng->state = UPNG_DECODED;
+		if (rgba8_output) {
+			upng->color_type = UPNG_RGBA;
+			upng->color_depth = 8;
+			upng->format = UPNG_RGBA8;
+		}
 	}
 
 	/* we are done with our input buffer; free it if we own it */
@@ -1075,6 +1339,16 @@ upng_error upng_decode(upng_t* upng)
 	return upng->error;
 }
 
+upng_error upng_decode(upng_t* upng)
+{
+	return upng_decode_to(upng, 0);
+}
+
+upng_error upng_decode_rgba8(upng_t* upng)
+{
+	return upng_decode_to(upng, 1);
+}
+
 static upng_t* upng_new(void)
 {
 	upng_t* upng;
@@ -99,6 +99,8 @@ void		upng_free			(upng_t* upng);
 
 upng_error	upng_header			(upng_t* upng);
 upng_error	upng_decode			(upng_t* upng);
+/* decodes and converts any supported format to 8 bit RGBA in one pass */
+upng_error	upng_decode_rgba8	(upng_t* upng);
 
 upng_error	upng_get_error		(const upng_t* upng);
 unsigned	upng_get_error_line	(const upng_t* upng);
@@ -1,3 +1,12 @@
+// open() and mmap() are POSIX, not part of -std=c17
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "utils.h"
 
 void int_swap(int* a, int* b) {
@@ -41,3 +50,48 @@ uint8_t* u32_to_u8(const uint32_t u32, uint8_t* u8) {
   u8[3] = u32 & 0x000000ff;
 	return u8;
 }
+
+void* map_file(char* filename, size_t* size) {
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	void* data = mmap(NULL, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	// the mapping keeps its own reference to the file
+	close(fd);
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+	*size = file_stat.st_size;
+	return data;
+}
+
+void unmap_file(void* data, size_t size) {
+	if (data != NULL) {
+		munmap(data, size);
+	}
+}
+
+char* replace_file_extension(char* filename, char* extension) {
+	char* dot = strrchr(filename, '.');
+	char* slash = strrchr(filename, '/');
+	size_t stem_length = dot != NULL && (slash == NULL || dot > slash) ? dot - filename : strlen(filename);
+	char* result = malloc(stem_length + strlen(extension) + 1);
+	memcpy(result, filename, stem_length);
+	strcpy(result + stem_length, extension);
+	return result;
+}
+
+uint64_t hash_data(const void* data, size_t size) {
+	const uint8_t* bytes = data;
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 0x100000001b3;
+	}
+	return hash;
+}
@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define MESH_DEBUG_COLOR 0xff0000ff
 #define LINE_DEBUG_COLOR 0xffff0000
@@ -10,6 +11,7 @@
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 #define CLAMP(min, max, v) MIN(max, MAX(min, v))
 #define GET_BYTE(value, n) (value >> (n * 8) & 0xFF)
+#define IS_POW2(x) ((x) > 0 && ((x) & ((x) - 1)) == 0)
 
 // make emscripten happy
 #ifndef M_PI
@@ -22,5 +24,13 @@ float float_lerp(float a, float b, float t);
 float blerp(float c00, float c10, float c01, float c11, float tx, float ty);
 uint32_t u8_to_u32(const uint8_t* bytes);
 uint8_t* u32_to_u8(const uint32_t u32, uint8_t* u8);
+// Copy on write private mapping of a whole file, writes never reach the file.
+// NULL when missing or empty
+void* map_file(char* filename, size_t* size);
+void unmap_file(void* data, size_t size);
+// "dir/name.obj", ".mesh" -> "dir/name.mesh", to be freed by the caller
+char* replace_file_extension(char* filename, char* extension);
+// 64 bit FNV-1a
+uint64_t hash_data(const void* data, size_t size);
 
 #endif
\ No newline at end of file
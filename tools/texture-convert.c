@@ -0,0 +1,51 @@
+// Converts PNGs into precompiled texture files next to them, "name.png" becoming
+// "name.tex". The renderer maps these instead of decoding the PNG, see load_texture().
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "texture.h"
+
+int main(int argc, char* argv[]) {
+	bool tiled = true;
+	bool compressed = false;
+	int first_file = 1;
+	for (; first_file < argc && argv[first_file][0] == '-'; first_file++) {
+		if (strcmp(argv[first_file], "--linear") == 0) {
+			// smaller to compress for distribution, tiled once at load
+			tiled = false;
+		} else if (strcmp(argv[first_file], "--compress") == 0) {
+			// BC1 / BC3 blocks, always stored tiled
+			compressed = true;
+		} else {
+			first_file = argc;
+		}
+	}
+	if (first_file >= argc) {
+		printf("usage: %s [--linear] [--compress] file.png ...\n", argv[0]);
+		return 1;
+	}
+	int failed_count = 0;
+	for (int i = first_file; i < argc; i++) {
+		char* png_filename = argv[i];
+		texture_2d_t* texture = load_png_data(png_filename);
+		if (texture == NULL) {
+			printf("%s could not be loaded\n", png_filename);
+			failed_count++;
+			continue;
+		}
+		if (compressed) {
+			compress_texture(texture);
+		}
+		char* filename = get_texture_file_name(png_filename);
+		if (save_texture_file(texture, filename, tiled)) {
+			char* layouts[] = { tiled ? "tiled" : "linear", "bc1", "bc3" };
+			printf("%s -> %s (%dx%d, %d levels, %s)\n", png_filename, filename, texture->width, texture->height, texture->levels_count, layouts[texture->format]);
+		} else {
+			failed_count++;
+		}
+		free(filename);
+		free_texture(texture);
+	}
+	return failed_count == 0 ? 0 : 1;
+}